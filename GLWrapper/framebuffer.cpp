@@ -1,6 +1,7 @@
 #include "framebuffer.h"
 #include "texture.h"
 #include "../debug.h"
+#include <algorithm>
 #if defined(__APPLE__)
 #include <OpenGL/gl.h>
 #else
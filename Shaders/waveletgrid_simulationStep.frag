@@ -4,7 +4,7 @@ in vec2 uv;
 
 const float tau = 6.28318530718f;
 
-const int NUM_K = 2;
+const int NUM_K = 4;
 uniform int NUM_POS = 2048;
 uniform int NUM_THETA = 8;
 
@@ -12,27 +12,35 @@ uniform vec4 wavenumberValues;
 uniform vec4 angularFrequency;
 uniform vec4 advectionSpeed;
 uniform vec4 dispersionSpeed;
-uniform float waterViscosity;
+// per band coefficients precomputed on the cpu, see DispersionPlan
+uniform vec4 spatialDiffusion;
+uniform vec4 angularDiffusion;
+// per second, see DispersionPlan::viscosityRate
+uniform vec4 viscosityRate;
 
 uniform sampler2D _Amplitude[8];
 uniform sampler2D _Height;
 uniform sampler2D _Gradient;
 uniform sampler2D _CloseToBoundary;
+// the shoreline, see ReflectionTable. Per cell the first entry and the number of entries, and
+// per entry the incident theta, the two target thetas and the weight of the first target
+uniform sampler2D _ReflectionIndex;
+uniform sampler2D _Reflections;
 uniform float waterLevel = 0.641;
 
 uniform vec2 waveDirections[8];
 uniform vec4 ambient[8];
 
 uniform float time;
-uniform float deltaTime;
+// per k band, every band is integrated at its own rate
+uniform vec4 deltaTime;
+// 1 for the bands this pass steps, the others keep their amplitude
+uniform vec4 bandMask = vec4(1);
 
 uniform vec4 minParam;
 uniform vec4 maxParam;
 uniform vec4 unitParam;
 
-uniform float spatialDiffusionMultiplier = 126.5625;
-uniform float angularDiffusionMultiplier = 0.025;
-
 layout (location = 0) out vec4 outAmplitude[8];
 
 vec4 intermediateAmplitude[8];
@@ -45,6 +53,21 @@ vec2 toPos(vec2 uv) { return mix(minParam.xy, maxParam.xy, uv); }
 float heightDistanceToBoundary(vec2 uvPos) { return texture(_Height, uvPos).r - waterLevel; }
 bool inDomain(vec2 uvPos) { return heightDistanceToBoundary(uvPos) <= 0; }
 
+// texture(_Amplitude[itheta], uv). GLSL only allows indexing sampler arrays with constants, or
+// from 4.00 with indices that are the same for every fragment, which reflections are not
+vec4 amplitudeAt(int itheta, vec2 uv) {
+    switch (itheta) {
+    case 0: return texture(_Amplitude[0], uv);
+    case 1: return texture(_Amplitude[1], uv);
+    case 2: return texture(_Amplitude[2], uv);
+    case 3: return texture(_Amplitude[3], uv);
+    case 4: return texture(_Amplitude[4], uv);
+    case 5: return texture(_Amplitude[5], uv);
+    case 6: return texture(_Amplitude[6], uv);
+    default: return texture(_Amplitude[7], uv);
+    }
+}
+
 float getReflectedInfo(vec2 wavedir, vec2 normal, out int itheta_refl, out int itheta_reflNext) {
     vec2 wavedir_refl = reflect(wavedir, normal);
 
@@ -67,11 +90,12 @@ vec4 sample(vec2 uv, int itheta) {
             int itheta_refl, itheta_reflNext;
             float t = getReflectedInfo(wavedir, normal, itheta_refl, itheta_reflNext);
             float reflectance = 0.3; // dont make this too high
-            return reflectance * (t * texture(_Amplitude[itheta_refl], data.gb) + (1 - t) * texture(_Amplitude[itheta_reflNext], data.gb));
+            // t is how far past the lower bin the reflection is, the same weights as ReflectionTable
+            return reflectance * ((1 - t) * amplitudeAt(itheta_refl, data.gb) + t * amplitudeAt(itheta_reflNext, data.gb));
         }
         /* return texelFetch(_Amplitude[itheta], ivec2(data.gb * NUM_POS), 0); */
     }
-    return texture(_Amplitude[itheta], uv);
+    return amplitudeAt(itheta, uv);
 }
 
 // courtesy of
@@ -131,17 +155,15 @@ vec4 evaluate(int itheta) {
     float wavenumberResolution = (wavenumber.w - wavenumber.x) / 4;
     float inverseSpatialResolutionSquared = 1/(spatialResolution * spatialResolution);
 
-    vec4 delta = 1e-4 * spatialResolution * spatialResolution * spatialDiffusionMultiplier * 
-        abs(dispersionSpeed);
-    vec4 g = delta * deltaTime * inverseSpatialResolutionSquared;
+    vec4 g = spatialDiffusion * deltaTime * inverseSpatialResolutionSquared;
 
 
-    vec4 amplitude = texture( _Amplitude[itheta], uv );
+    vec4 amplitude = amplitudeAt(itheta, uv);
     // if about to sample on the boundary, don't
 #pragma openNV (unroll all)
     for (int ik = 0; ik < NUM_K; ik++) {
         // if we are supposed to sample inside the boundary, how about don't
-        float p_prime = deltaTime * advectionSpeed[ik];
+        float p_prime = deltaTime[ik] * advectionSpeed[ik];
 
         float samplingDistance = max(unitParam.x / 4, p_prime);
 
@@ -177,8 +199,7 @@ void advectionPass() {
 void angularDiffusionPass() {
     float thetaResolution = unitParam.z;
 
-    vec4 gamma = angularDiffusionMultiplier * advectionSpeed * unitParam.z * unitParam.z / unitParam.x;
-    vec4 g = gamma * deltaTime / thetaResolution / thetaResolution;
+    vec4 g = angularDiffusion * deltaTime / thetaResolution / thetaResolution;
 
 #pragma openNV (unroll all)
     for (int itheta = 0; itheta < NUM_THETA; itheta++) {
@@ -197,40 +218,27 @@ void reflectionPass() {
     for (int itheta = 0; itheta < NUM_THETA; itheta++)
         outAmplitude[itheta] = intermediateAmplitude[itheta];
 
-    bool onBoundary = false;
-    float maxHeight = 0;
-    for (int dx = -1; dx <= 1; dx++) {
-        for (int dy = -1; dy <= 1; dy++) {
-            maxHeight = max(maxHeight, texture(_Height, uv + vec2(dx, dy) / NUM_POS).r);
-        }
-    }
-
-    onBoundary = maxHeight > waterLevel;
-    if (!onBoundary) return;
-
-    /* float gradientThetaUV = texture(_Gradient, uv).r; */
-
-#pragma openNV (unroll all)
-    for (int itheta = 0; itheta < NUM_THETA; itheta++) {
-        vec2 wavedir = waveDirections[itheta];
-
-        // if we are sampling inside of the boundary
-        if (dot(wavedir, normal) >= 0) {
-            int itheta_refl;
-            int itheta_reflNext;
-            float t = getReflectedInfo(wavedir, normal, itheta_refl, itheta_reflNext);
-
-            outAmplitude[itheta_refl] += t * intermediateAmplitude[itheta];
-            outAmplitude[itheta_reflNext] += (1 - t) * intermediateAmplitude[itheta];
-            outAmplitude[itheta] = vec4(0);
-        }
+    vec2 cell = texelFetch(_ReflectionIndex, ivec2(gl_FragCoord.xy), 0).rg;
+    int first = int(cell.r);
+    int count = int(cell.g);
+    if (count == 0) return;
+    int width = textureSize(_Reflections, 0).x;
+
+    // every incident amplitude leaves before any arrives, so reflecting into an incident
+    // direction keeps it, the same as on the cpu
+    for (int i = first; i < first + count; i++)
+        outAmplitude[int(texelFetch(_Reflections, ivec2(i % width, i / width), 0).r)] = vec4(0);
+
+    for (int i = first; i < first + count; i++) {
+        vec4 entry = texelFetch(_Reflections, ivec2(i % width, i / width), 0);
+        vec4 incident = intermediateAmplitude[int(entry.r)];
+        outAmplitude[int(entry.g)] += entry.a * incident;
+        outAmplitude[int(entry.b)] += (1 - entry.a) * incident;
     }
 }
 
 void viscosityPass() {
-    // TODO: precompute this on the cpu, but honestly im too lazy
-    vec4 g = clamp(2 * waterViscosity * wavenumberValues * wavenumberValues 
-        + 0.5 * waterViscosity * sqrt(angularFrequency / (2*waterViscosity)) * wavenumberValues, 0, 1);
+    vec4 g = (1 - exp(-viscosityRate * deltaTime)) * bandMask;
 #pragma openNV (unroll all)
     for (int itheta = 0; itheta < NUM_THETA; itheta++)
         outAmplitude[itheta] = (1 - g) * outAmplitude[itheta];
@@ -250,6 +258,10 @@ void main() {
     reflectionPass();
     viscosityPass();
 
+#pragma openNV (unroll all)
+    for (int itheta = 0; itheta < NUM_THETA; itheta++)
+        outAmplitude[itheta] = mix(amplitudeAt(itheta, uv), outAmplitude[itheta], bandMask);
+
     // TEMPORARY FOR RAIN: REMOVE LATER
 //    if(rand(uv * time) > 0.999 && rand(uv * time * 2) > 0.99){
 //        #pragma openNV (unroll all)
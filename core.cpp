@@ -38,7 +38,11 @@ Core::Core(int width, int height){
     glViewport(0, 0, width, height);
     Debug::checkGLError();
     m_waveletGrid = std::make_shared<WaveletGrid>(glm::vec4(-50, -50, 0, 1), glm::vec4(50, 50, WaveletGrid::tau, 2), 
-            glm::uvec4(1000, 1000, 16, 4));
+            glm::uvec4(1000, 1000, 16, 4), setting);
+    // most of the lake is calm, the tiles within quiescentEpsilon of it are not worth stepping
+    m_waveletGrid->setSkipQuiescentTiles(true);
+    // the long waves of k in [1, 2] keep 8 cells per wavelength on a 4x coarser grid
+    m_waveletGrid->setSamplesPerWavelength(8);
     //m_waveletGrid->takeStep(0);
     //m_waveGeometry->update(m_waveletGrid);
     m_fullscreenQuad = std::make_shared<FullscreenQuad>();
@@ -54,7 +58,6 @@ Core::~Core(){
 }
 
 int Core::update(float seconds){
-    seconds = 0.01;
     /*
     m_camera->move(m_keysDown, seconds);
     if (timeSinceLastUpdate += seconds >= 1.0f/FPS) {
@@ -63,7 +66,7 @@ int Core::update(float seconds){
         timeSinceLastUpdate = 0;
     }
     */
-    m_camera->move(m_keysDown, seconds);
+    m_camera->move(m_keysDown, cameraStep);
 
     const char* items[] = { "Wave geometry", "Advection / Diffusion", "Height Map"};
     static const char* current_item = items[2];
@@ -87,7 +90,7 @@ int Core::update(float seconds){
         Debug::checkGLError();
         glDisable(GL_BLEND);
         Debug::checkGLError();
-        m_simulator->takeStep(seconds);
+        m_simulator->advance(seconds);
         Debug::checkGLError();
         m_fullscreenQuad->bind();
         Debug::checkGLError();
@@ -119,11 +122,13 @@ int Core::update(float seconds){
 
     } else if (current_item == items[1]) {
         if (!simulationPaused) {
-            m_simulator->takeStep(seconds);
+            m_simulator->advance(seconds);
+            const glm::ivec4 substeps = m_simulator->bandSubsteps();
+            ImGui::Text("substeps per band %d %d %d %d", substeps[0], substeps[1], substeps[2], substeps[3]);
             if (ImGui::Button("Pause"))     simulationPaused = true;
         } else {
             if (ImGui::Button("Unpause"))   simulationPaused = false;
-            if (ImGui::Button("Step"))      m_simulator->takeStep(seconds);
+            if (ImGui::Button("Step"))      m_simulator->advance(m_simulator->maxStableTimeStep());
         }
         m_simulator->visualize(m_FBOSize);
     } else if (current_item == items[2]) {
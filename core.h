@@ -42,6 +42,8 @@ private:
 
     glm::ivec2 m_FBOSize = glm::ivec2(640, 480);
     const float FPS = 0.5f;
+    // the camera speed is tuned for a step of 0.01 s every frame, whatever the frame time
+    const float cameraStep = 0.01f;
     float timeSinceLastUpdate;
     bool m_mouseDown = false;
     glm::vec2 m_mousePos = glm::vec2(0, 0);
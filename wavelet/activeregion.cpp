@@ -0,0 +1,106 @@
+#include "activeregion.h"
+
+#include <algorithm>
+
+ActiveRegion::ActiveRegion(glm::uvec2 resolution, unsigned int tileSize)
+    : m_resolution(resolution), m_tileSize(tileSize)
+{
+    m_rowOffsets.push_back(0);
+    std::vector<bool> wet(resolution.x, true);
+    for (unsigned int y = 0; y < resolution.y; y++)
+        addRow(wet);
+    computeTiles();
+}
+
+ActiveRegion::ActiveRegion(const std::vector<float> &heights, int width, int height, float waterHeight,
+        glm::uvec2 resolution, unsigned int tileSize)
+    : m_resolution(resolution), m_tileSize(tileSize)
+{
+    m_rowOffsets.push_back(0);
+    std::vector<bool> wet(resolution.x);
+    for (unsigned int y = 0; y < resolution.y; y++) {
+        // nearest texel of the cell center, the same thing the shader samples
+        int j = std::min<int>((y + 0.5f) / resolution.y * height, height - 1);
+        for (unsigned int x = 0; x < resolution.x; x++) {
+            int i = std::min<int>((x + 0.5f) / resolution.x * width, width - 1);
+            wet[x] = heights[i + j * width] <= waterHeight;
+        }
+        addRow(wet);
+    }
+    computeTiles();
+}
+
+ActiveRegion ActiveRegion::downsampled(unsigned int factor) const {
+    ActiveRegion region(glm::uvec2(0), m_tileSize);
+    region.m_resolution = (m_resolution + factor - 1u) / factor;
+
+    std::vector<bool> wet(region.m_resolution.x);
+    for (unsigned int y = 0; y < region.m_resolution.y; y++) {
+        std::fill(wet.begin(), wet.end(), false);
+        for (unsigned int fineY = y * factor; fineY < std::min(m_resolution.y, (y + 1) * factor); fineY++)
+            for (const Span *span = spansBegin(fineY); span != spansEnd(fineY); span++)
+                for (unsigned int x = span->begin / factor; x <= (span->end - 1) / factor; x++)
+                    wet[x] = true;
+        region.addRow(wet);
+    }
+    region.computeTiles();
+    return region;
+}
+
+ActiveRegion ActiveRegion::cropped(glm::uvec2 begin, glm::uvec2 end) const {
+    ActiveRegion region(glm::uvec2(0), m_tileSize);
+    region.m_resolution = end - begin;
+
+    std::vector<bool> wet(region.m_resolution.x);
+    for (unsigned int y = begin.y; y < end.y; y++) {
+        std::fill(wet.begin(), wet.end(), false);
+        for (const Span *span = spansBegin(y); span != spansEnd(y); span++)
+            for (unsigned int x = std::max(span->begin, begin.x); x < std::min(span->end, end.x); x++)
+                wet[x - begin.x] = true;
+        region.addRow(wet);
+    }
+    region.computeTiles();
+    return region;
+}
+
+bool ActiveRegion::isWet(unsigned int x, unsigned int y) const {
+    for (const Span *span = spansBegin(y); span != spansEnd(y); span++)
+        if (span->begin <= x && x < span->end) return true;
+    return false;
+}
+
+void ActiveRegion::addRow(const std::vector<bool> &wet) {
+    unsigned int x = 0;
+    while (x < m_resolution.x) {
+        while (x < m_resolution.x && !wet[x]) x++;
+        if (x == m_resolution.x) break;
+
+        Span span;
+        span.begin = x;
+        while (x < m_resolution.x && wet[x]) x++;
+        span.end = x;
+
+        m_spans.push_back(span);
+        m_activeCells += span.end - span.begin;
+    }
+    m_rowOffsets.push_back(m_spans.size());
+}
+
+void ActiveRegion::computeTiles() {
+    for (unsigned int tileY = 0; tileY < m_resolution.y; tileY += m_tileSize) {
+        for (unsigned int tileX = 0; tileX < m_resolution.x; tileX += m_tileSize) {
+            bool anyWet = false;
+            unsigned int tileEndX = std::min(m_resolution.x, tileX + m_tileSize);
+            unsigned int tileEndY = std::min(m_resolution.y, tileY + m_tileSize);
+
+            for (unsigned int y = tileY; y < tileEndY && !anyWet; y++)
+                for (const Span *span = spansBegin(y); span != spansEnd(y); span++)
+                    if (span->begin < tileEndX && span->end > tileX) {
+                        anyWet = true;
+                        break;
+                    }
+
+            if (anyWet) m_tiles.push_back(glm::uvec2(tileX, tileY));
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+/**
+ * @brief The wet part of a simulation grid, compacted so that the step loops only visit cells
+ * that are below the water height.
+ *
+ * Each row is stored as run-length spans of wet cells, and the grid is also summarized as a list
+ * of square tiles containing at least one wet cell, which is what the gpu simulator draws.
+ */
+class ActiveRegion {
+public:
+    struct Span {
+        unsigned int begin; // first wet x
+        unsigned int end;   // one past the last wet x
+    };
+
+    /**
+     * @brief A region where every cell is wet.
+     */
+    ActiveRegion(glm::uvec2 resolution = glm::uvec2(0), unsigned int tileSize = 32);
+
+    /**
+     * @brief Builds the region from a heightmap covering the whole grid.
+     *
+     * @param heights the heightmap, indexed by i + j * width.
+     * @param width the width of the heightmap.
+     * @param height the height of the heightmap.
+     * @param waterHeight cells whose height is at most this are wet.
+     * @param resolution the x,y resolution of the grid. The heightmap is sampled at the nearest texel.
+     * @param tileSize the side length of the tiles, in cells.
+     */
+    ActiveRegion(const std::vector<float> &heights, int width, int height, float waterHeight,
+            glm::uvec2 resolution, unsigned int tileSize = 32);
+
+    /**
+     * @brief The same region on a grid that is factor times coarser. A coarse cell is wet if any
+     * of the cells it covers is.
+     */
+    ActiveRegion downsampled(unsigned int factor) const;
+
+    /**
+     * @brief The cells [begin, end) of the region, as a region of their own.
+     */
+    ActiveRegion cropped(glm::uvec2 begin, glm::uvec2 end) const;
+
+    glm::uvec2 getResolution() const { return m_resolution; }
+    unsigned int getTileSize() const { return m_tileSize; }
+
+    /**
+     * @brief The wet spans of row y, in increasing x.
+     */
+    const Span *spansBegin(unsigned int y) const { return m_spans.data() + m_rowOffsets[y]; }
+    const Span *spansEnd(unsigned int y) const { return m_spans.data() + m_rowOffsets[y + 1]; }
+
+    /**
+     * @brief Origins, in cells, of the tiles that contain at least one wet cell.
+     */
+    const std::vector<glm::uvec2> &getTiles() const { return m_tiles; }
+
+    bool isWet(unsigned int x, unsigned int y) const;
+    size_t activeCells() const { return m_activeCells; }
+
+private:
+    void addRow(const std::vector<bool> &wet);
+    void computeTiles();
+
+    glm::uvec2 m_resolution;
+    unsigned int m_tileSize;
+    size_t m_activeCells = 0;
+
+    std::vector<unsigned int> m_rowOffsets; // row y owns m_spans[m_rowOffsets[y], m_rowOffsets[y+1])
+    std::vector<Span> m_spans;
+    std::vector<glm::uvec2> m_tiles;
+};
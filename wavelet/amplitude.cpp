@@ -1,32 +1,309 @@
 #include "amplitude.h"
+#include "topology.h"
+
+#include <algorithm>
 
 unsigned int Amplitude::getResolution(Parameter p){
     return m_resolution[p];
 }
 
 void Amplitude::resize(glm::uvec4 newResolution){
-    m_resolution = newResolution;
-    m_data.resize(m_resolution[Parameter::X] * m_resolution[Parameter::Y] * m_resolution[Parameter::THETA] * m_resolution[Parameter::K]);
+    std::vector<glm::uvec2> bandResolutions(newResolution[Parameter::K],
+            glm::uvec2(newResolution[Parameter::X], newResolution[Parameter::Y]));
+    resize(bandResolutions, newResolution[Parameter::THETA]);
+}
+
+void Amplitude::resize(const std::vector<glm::uvec2> &bandResolutions, unsigned int thetaResolution){
+    allocate(bandResolutions, thetaResolution);
+    for (unsigned int k = 0; k < bandResolutions.size(); k++)
+        clearRows(k, -(int) m_ghost, bandResolutions[k].y + m_ghost);
+}
+
+void Amplitude::allocate(const std::vector<glm::uvec2> &bandResolutions, unsigned int thetaResolution){
+    m_resolution = glm::uvec4(0, 0, thetaResolution, bandResolutions.size());
+    m_bandResolutions = bandResolutions;
+    m_bandOffsets.clear();
+
+    size_t size = 0;
+    for (unsigned int k = 0; k < bandResolutions.size(); k++) {
+        m_resolution[Parameter::X] = std::max(m_resolution[Parameter::X], bandResolutions[k].x);
+        m_resolution[Parameter::Y] = std::max(m_resolution[Parameter::Y], bandResolutions[k].y);
+        m_bandOffsets.push_back(size);
+        size += Layout::dispatch(m_layout, [&](auto layout) {
+            return decltype(layout)::size(paddedResolution(k), paddedThetaResolution());
+        });
+    }
+    // the layout of every band may have changed, so nothing old is kept. Fresh vectors, so
+    // that the samples are new pages nobody touched yet
+    m_data = {};
+    m_packedData = {};
+    if (m_storage == Storage::Type::Float32) m_data.resize(size);
+    else m_packedData.resize(size);
+}
+
+void Amplitude::allocateLike(const Amplitude &other){
+    m_storage = other.m_storage;
+    m_layout = other.m_layout;
+    m_ghost = other.m_ghost;
+    m_thetaGhost = other.m_thetaGhost;
+    allocate(other.m_bandResolutions, other.m_resolution[Parameter::THETA]);
+}
+
+void Amplitude::clearRows(unsigned int k, int begin, int end){
+    // +0 is all zero bits in every storage type
+    const size_t elementSize = Storage::elementSize(m_storage);
+    char *data = m_storage == Storage::Type::Float32 ? (char *) m_data.data() : (char *) m_packedData.data();
+    forEachRowSpan(k, begin, end, [&](size_t index, size_t count) {
+        std::fill(data + index * elementSize, data + (index + count) * elementSize, 0);
+    });
+}
+
+void Amplitude::copyRows(const Amplitude &source, unsigned int k, int begin, int end){
+    assert(source.m_storage == m_storage && source.m_layout == m_layout && source.m_ghost == m_ghost &&
+            source.m_thetaGhost == m_thetaGhost && source.m_bandResolutions == m_bandResolutions);
+    const size_t elementSize = Storage::elementSize(m_storage);
+    const bool fp32 = m_storage == Storage::Type::Float32;
+    const char *from = fp32 ? (const char *) source.m_data.data() : (const char *) source.m_packedData.data();
+    char *to = fp32 ? (char *) m_data.data() : (char *) m_packedData.data();
+    forEachRowSpan(k, begin, end, [&](size_t index, size_t count) {
+        std::copy(from + index * elementSize, from + (index + count) * elementSize, to + index * elementSize);
+    });
+}
+
+std::vector<size_t> Amplitude::residentBytes() const {
+    const void *data = m_storage == Storage::Type::Float32 ? (const void *) m_data.data() : (const void *) m_packedData.data();
+    return Topology::residentBytes(data, bytes());
+}
+
+void Amplitude::setStorage(Storage::Type storage){
+    if (storage == m_storage) return;
+
+    Memory::Vector<float> data(m_data.size() + m_packedData.size());
+    if (m_storage == Storage::Type::Float32) data.swap(m_data);
+    else Storage::decode(m_storage, m_packedData.data(), data.data(), data.size());
+
+    m_storage = storage;
+    if (m_storage == Storage::Type::Float32) {
+        m_data.swap(data);
+        m_packedData = {};
+    } else {
+        m_packedData.resize(data.size());
+        Storage::encode(m_storage, data.data(), m_packedData.data(), data.size());
+        m_data = {};
+    }
+}
+
+void Amplitude::setLayout(Layout::Type layout){
+    if (layout == m_layout) return;
+    reorder(layout, m_ghost, m_thetaGhost);
+}
+
+void Amplitude::setGhostCells(unsigned int ghost, unsigned int thetaGhost){
+    if (ghost == m_ghost && thetaGhost == m_thetaGhost) return;
+    reorder(m_layout, ghost, thetaGhost);
+}
+
+void Amplitude::reorder(Layout::Type layout, unsigned int ghost, unsigned int thetaGhost){
+    Amplitude reordered;
+    reordered.m_storage = m_storage;
+    reordered.m_layout = layout;
+    reordered.m_ghost = ghost;
+    reordered.m_thetaGhost = thetaGhost;
+    reordered.resize(m_bandResolutions, m_resolution[Parameter::THETA]);
+
+    // the ghost cells both have, stored values convert back and forth exactly
+    const int keptGhost = std::min(ghost, m_ghost);
+    const int keptThetaGhost = std::min(thetaGhost, m_thetaGhost);
+    const int thetaResolution = m_resolution[Parameter::THETA];
+    std::vector<float> row(m_resolution[Parameter::X] + 2 * keptGhost);
+    for (unsigned int k = 0; k < m_resolution[Parameter::K]; k++) {
+        const glm::ivec2 resolution(m_bandResolutions[k]);
+        for (int theta = -keptThetaGhost; theta < thetaResolution + keptThetaGhost; theta++)
+        for (int y = -keptGhost; y < resolution.y + keptGhost; y++) {
+            decode(y, theta, k, -keptGhost, resolution.x + keptGhost, row.data());
+            reordered.encode(y, theta, k, -keptGhost, resolution.x + keptGhost, row.data());
+        }
+    }
+    *this = std::move(reordered);
 }
 
-float& Amplitude::operator()(glm::uvec4 index){
+void Amplitude::refreshGhostCells(unsigned int k, const float *ambient){
+    const int ghost = m_ghost;
+    const int thetaGhost = m_thetaGhost;
+    const int thetaResolution = m_resolution[Parameter::THETA];
+    const glm::ivec2 resolution(m_bandResolutions[k]);
+
+    if (ghost > 0) {
+        for (int theta = 0; theta < thetaResolution; theta++) {
+            for (int y = -ghost; y < 0; y++)
+                fillRow(y, theta, k, -ghost, resolution.x + ghost, ambient[theta]);
+            for (int y = 0; y < resolution.y; y++) {
+                fillRow(y, theta, k, -ghost, 0, ambient[theta]);
+                fillRow(y, theta, k, resolution.x, resolution.x + ghost, ambient[theta]);
+            }
+            for (int y = resolution.y; y < resolution.y + ghost; y++)
+                fillRow(y, theta, k, -ghost, resolution.x + ghost, ambient[theta]);
+        }
+    }
+
+    // whole padded rows, the runs of a row are at the same x for every theta
+    const size_t elementSize = Storage::elementSize(m_storage);
+    char *data = m_storage == Storage::Type::Float32 ? (char *) m_data.data() : (char *) m_packedData.data();
+    for (int i = 0; i < 2 * thetaGhost; i++) {
+        const int theta = i < thetaGhost ? i - thetaGhost : thetaResolution + i - thetaGhost;
+        const int wrapped = (theta + thetaResolution) % thetaResolution;
+        for (int y = -ghost; y < resolution.y + ghost; y++) {
+            forEachRun(y, theta, k, -ghost, resolution.x + ghost, [&](size_t index, unsigned int offset, unsigned int count) {
+                const size_t source = dataIndex(glm::ivec4((int) offset - ghost, y, wrapped, k));
+                std::copy(data + source * elementSize, data + (source + count) * elementSize, data + index * elementSize);
+            });
+        }
+    }
+}
+
+float Amplitude::quantize(float value) const {
+    return Storage::dispatch(m_storage, [&](auto element) {
+        return Storage::toFloat(Storage::fromFloat<decltype(element)>(value));
+    });
+}
+
+float& Amplitude::operator()(glm::ivec4 index){
+    assert(m_storage == Storage::Type::Float32);
     return m_data[dataIndex(index)];
 }
 
-float const &Amplitude::operator()(glm::uvec4 index) const {
+float const &Amplitude::operator()(glm::ivec4 index) const {
+    assert(m_storage == Storage::Type::Float32);
     return m_data[dataIndex(index)];
 }
 
+float Amplitude::get(glm::ivec4 index) const {
+    if (m_storage == Storage::Type::Float32) return m_data[dataIndex(index)];
+    return Storage::dispatch(m_storage, [&](auto element) {
+        using T = decltype(element);
+        return Storage::toFloat(reinterpret_cast<const T *>(m_packedData.data())[dataIndex(index)]);
+    });
+}
+
+void Amplitude::set(glm::ivec4 index, float value){
+    if (m_storage == Storage::Type::Float32) {
+        m_data[dataIndex(index)] = value;
+        return;
+    }
+    Storage::encode(m_storage, &value, m_packedData.data() + dataIndex(index), 1);
+}
+
+float *Amplitude::row(int y, int theta, unsigned int k){
+    assert(directRows());
+    return m_data.data() + dataIndex(glm::ivec4(0, y, theta, k));
+}
+
+const float *Amplitude::row(int y, int theta, unsigned int k) const {
+    assert(directRows());
+    return m_data.data() + dataIndex(glm::ivec4(0, y, theta, k));
+}
+
+template <class F>
+void Amplitude::forEachRun(int y, int theta, unsigned int k, int begin, int end, F &&f) const {
+    Layout::dispatch(m_layout, [&](auto layout) {
+        using L = decltype(layout);
+        // the layouts see the padded band, whose x start at 0
+        const unsigned int paddedEnd = end + m_ghost;
+        const glm::uvec2 resolution = paddedResolution(k);
+        const unsigned int thetaResolution = paddedThetaResolution();
+        for (unsigned int x = begin + m_ghost; x < paddedEnd;) {
+            const unsigned int runEnd = L::runEnd(x, paddedEnd);
+            f(m_bandOffsets[k] + L::index(x, y + m_ghost, theta + m_thetaGhost, resolution, thetaResolution),
+                    x - m_ghost - begin, runEnd - x);
+            x = runEnd;
+        }
+    });
+}
+
+template <class F>
+void Amplitude::forEachRowSpan(unsigned int k, int begin, int end, F &&f) const {
+    Layout::dispatch(m_layout, [&](auto layout) {
+        decltype(layout)::forEachRowSpan(begin + m_ghost, end + m_ghost, paddedResolution(k), paddedThetaResolution(),
+                [&](size_t index, size_t count) { f(m_bandOffsets[k] + index, count); });
+    });
+}
+
+const float *Amplitude::readRow(unsigned int y, unsigned int theta, unsigned int k, float *scratch) const {
+    if (directRows()) return row(y, theta, k);
+    decode(y, theta, k, 0, m_bandResolutions[k].x, scratch);
+    return scratch;
+}
+
+void Amplitude::decode(int y, int theta, unsigned int k, int begin, int end, float *out) const {
+    if (m_layout == Layout::Type::Morton) {
+        // the runs are pairs of samples, so walk the row one sample at a time instead
+        Storage::dispatch(m_storage, [&](auto element) {
+            const auto *data = dataAs<decltype(element)>();
+            Layout::Morton::RowIterator sample = mortonRow(begin, y, theta, k);
+            for (int x = begin; x < end; x++, ++sample) out[x - begin] = Storage::toFloat(data[*sample]);
+        });
+        return;
+    }
+
+    forEachRun(y, theta, k, begin, end, [&](size_t index, unsigned int offset, unsigned int count) {
+        if (m_storage == Storage::Type::Float32)
+            std::copy(m_data.data() + index, m_data.data() + index + count, out + offset);
+        else
+            Storage::decode(m_storage, m_packedData.data() + index, out + offset, count);
+    });
+}
+
+float *Amplitude::rowBuffer(unsigned int y, unsigned int theta, unsigned int k, float *scratch){
+    return directRows() ? row(y, theta, k) : scratch;
+}
+
+void Amplitude::writeRow(unsigned int y, unsigned int theta, unsigned int k, const float *row){
+    // rows handed out by rowBuffer are already in place
+    if (directRows() && row == this->row(y, theta, k)) return;
+    encode(y, theta, k, 0, m_bandResolutions[k].x, row);
+}
+
+void Amplitude::encode(int y, int theta, unsigned int k, int begin, int end, const float *in){
+    if (m_layout == Layout::Type::Morton) {
+        Storage::dispatch(m_storage, [&](auto element) {
+            using T = decltype(element);
+            T *data = const_cast<T *>(dataAs<T>());
+            Layout::Morton::RowIterator sample = mortonRow(begin, y, theta, k);
+            for (int x = begin; x < end; x++, ++sample) data[*sample] = Storage::fromFloat<T>(in[x - begin]);
+        });
+        return;
+    }
+
+    forEachRun(y, theta, k, begin, end, [&](size_t index, unsigned int offset, unsigned int count) {
+        if (m_storage == Storage::Type::Float32)
+            std::copy(in + offset, in + offset + count, m_data.data() + index);
+        else
+            Storage::encode(m_storage, in + offset, m_packedData.data() + index, count);
+    });
+}
+
+void Amplitude::fillRow(int y, int theta, unsigned int k, int begin, int end, float value){
+    std::uint16_t packed = 0;
+    if (m_storage != Storage::Type::Float32) Storage::encode(m_storage, &value, &packed, 1);
+
+    forEachRun(y, theta, k, begin, end, [&](size_t index, unsigned int, unsigned int count) {
+        if (m_storage == Storage::Type::Float32)
+            std::fill(m_data.data() + index, m_data.data() + index + count, value);
+        else
+            std::fill(m_packedData.data() + index, m_packedData.data() + index + count, packed);
+    });
+}
+
 void Amplitude::setTemporaryData(){
-    for(int x = 0; x < m_resolution[Parameter::X]; x++){
-        for(int y = 0; y < m_resolution[Parameter::Y]; y++){
-            for(int theta = 0; theta < m_resolution[Parameter::THETA]; theta++){
-                for(int k = 0; k < m_resolution[Parameter::K]; k++){
+    for(unsigned int k = 0; k < m_resolution[Parameter::K]; k++){
+        for(unsigned int x = 0; x < m_bandResolutions[k].x; x++){
+            for(unsigned int y = 0; y < m_bandResolutions[k].y; y++){
+                for(unsigned int theta = 0; theta < m_resolution[Parameter::THETA]; theta++){
                     if(theta == 0 && k == 0){
-                        m_data[dataIndex(glm::uvec4(x, y, theta, k))] = 1;
+                        set(glm::uvec4(x, y, theta, k), 1);
                     }
                     else{
-                        m_data[dataIndex(glm::uvec4(x, y, k, theta))] = 0;
+                        set(glm::uvec4(x, y, k, theta), 0);
                     }
                 }
             }
@@ -34,9 +311,12 @@ void Amplitude::setTemporaryData(){
     }
 }
 
-unsigned int Amplitude::dataIndex(glm::uvec4 index) const{
-    return index[Parameter::X] +
-            index[Parameter::Y] * m_resolution[Parameter::X] +
-            index[Parameter::THETA] * m_resolution[Parameter::X] * m_resolution[Parameter::Y] +
-            index[Parameter::K] * m_resolution[Parameter::X] * m_resolution[Parameter::Y] * m_resolution[Parameter::THETA];
+size_t Amplitude::dataIndex(glm::ivec4 index) const{
+    const unsigned int k = index[Parameter::K];
+    const glm::uvec2 resolution = paddedResolution(k);
+    const unsigned int thetaResolution = paddedThetaResolution();
+    return m_bandOffsets[k] + Layout::dispatch(m_layout, [&](auto layout) {
+        return decltype(layout)::index(index[Parameter::X] + m_ghost, index[Parameter::Y] + m_ghost,
+                index[Parameter::THETA] + m_thetaGhost, resolution, thetaResolution);
+    });
 }
@@ -1,9 +1,15 @@
 #pragma once
 
 #include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 #include <glm/vec2.hpp>
 #include <glm/vec4.hpp>
+#include "layout.h"
+#include "memory.h"
+#include "storage.h"
 
 enum Parameter{
     X = 0,
@@ -17,19 +23,224 @@ class Amplitude
 {
 public:
     Amplitude(){};
-    ~Amplitude(){};
 
+    /**
+     * @brief The resolution along p. For X and Y this is the finest resolution of any k band.
+     */
     unsigned int getResolution(Parameter p);
+    glm::uvec2 getBandResolution(unsigned int k) const { return m_bandResolutions[k]; }
+
     void resize(glm::uvec4 newResolution);
 
-    float &operator()(glm::uvec4 index);
-    float const &operator()(glm::uvec4 index) const;
+    /**
+     * @brief Gives every k band its own x,y resolution.
+     *
+     * @param bandResolutions the x,y resolution of each k band, one entry per band.
+     * @param thetaResolution the theta resolution shared by all bands.
+     */
+    void resize(const std::vector<glm::uvec2> &bandResolutions, unsigned int thetaResolution);
+
+    /**
+     * @brief resize without writing any sample, every sample is unspecified until clearRows or
+     * copyRows writes it. Whichever thread writes a page first places it on its NUMA node, so
+     * this lets the threads that step the rows of a band be the ones that touch them first.
+     */
+    void allocate(const std::vector<glm::uvec2> &bandResolutions, unsigned int thetaResolution);
+    // allocate with the resolutions, storage, layout and ghost cells of other
+    void allocateLike(const Amplitude &other);
+
+    /**
+     * @brief Sets the rows [begin, end) of band k to 0 for every theta, ghost cells and layout
+     * padding included. The rows go from -ghost cells to the band resolution + ghost cells.
+     */
+    void clearRows(unsigned int k, int begin, int end);
+    /**
+     * @brief clearRows, but copies the rows from source, which must have been allocated alike.
+     */
+    void copyRows(const Amplitude &source, unsigned int k, int begin, int end);
+
+    /**
+     * @brief The bytes of the samples that are resident on every NUMA node, see Topology.
+     */
+    std::vector<size_t> residentBytes() const;
+
+    /**
+     * @brief Converts every sample to storage, rounding to nearest.
+     */
+    void setStorage(Storage::Type storage);
+    Storage::Type getStorage() const { return m_storage; }
+
+    /**
+     * @brief Reorders every band to layout.
+     */
+    void setLayout(Layout::Type layout);
+    Layout::Type getLayout() const { return m_layout; }
+
+    /**
+     * @brief Pads every band with ghost cells: ghost cells on either side of it in x and y, and
+     * thetaGhost thetas on either side of [0, thetaResolution) that wrap around. The samples
+     * inside the bands are kept, the ghost cells hold whatever refreshGhostCells last put there.
+     */
+    void setGhostCells(unsigned int ghost, unsigned int thetaGhost = 0);
+    unsigned int getGhostCells() const { return m_ghost; }
+    unsigned int getThetaGhostCells() const { return m_thetaGhost; }
+
+    /**
+     * @brief Sets the x,y ghost cells of band k to ambient[theta] for every theta and copies
+     * the wrapped thetas into the theta ghost cells. Nothing but this writes the ghost cells, so
+     * it has to be called again once the band or the ambient amplitude changed.
+     */
+    void refreshGhostCells(unsigned int k, const float *ambient);
+
+    /**
+     * @brief The distance between consecutive y rows of band k, ghost cells included. Only for
+     * the x major layout.
+     */
+    std::ptrdiff_t rowStride(unsigned int k) const {
+        assert(m_layout == Layout::Type::XMajor);
+        return m_bandResolutions[k].x + 2 * m_ghost;
+    }
+
+    /**
+     * @brief Whether the x rows are contiguous fp32, so that row can be used. All the row
+     * helpers below work for every storage and layout.
+     */
+    bool directRows() const { return m_storage == Storage::Type::Float32 && m_layout == Layout::Type::XMajor; }
+
+    /**
+     * @brief Size of the samples in bytes.
+     */
+    size_t bytes() const { return m_data.size() * sizeof(float) + m_packedData.size() * sizeof(std::uint16_t); }
+
+    /**
+     * @brief value as it reads back after being stored.
+     */
+    float quantize(float value) const;
+
+    // direct access to the samples, only for fp32 storage. Every index accessor below takes
+    // x,y up to the ghost cells outside the band and theta up to the theta ghost cells outside
+    // [0, thetaResolution)
+    float &operator()(glm::ivec4 index);
+    float const &operator()(glm::ivec4 index) const;
+
+    float get(glm::ivec4 index) const;
+    void set(glm::ivec4 index, float value);
+
+    /**
+     * @brief Pointer to the contiguous x row at (y, theta, k), at x = 0. The ghost cells are
+     * in front of and behind it. Only if directRows.
+     */
+    float *row(int y, int theta, unsigned int k);
+    const float *row(int y, int theta, unsigned int k) const;
+
+    /**
+     * @brief Pointer to the contiguous x row at (y, theta, k) in the storage type T. Only for
+     * the x major layout.
+     */
+    template <class T>
+    const T *rowAs(int y, int theta, unsigned int k) const {
+        assert(m_layout == Layout::Type::XMajor);
+        return dataAs<T>() + dataIndex(glm::ivec4(0, y, theta, k));
+    }
+
+    /**
+     * @brief Walks the x row at (y, theta, k) from x on, yielding indices into dataAs. Only for
+     * the morton layout, whose rows aren't contiguous.
+     */
+    Layout::Morton::RowIterator mortonRow(int x, int y, int theta, unsigned int k) const {
+        assert(m_layout == Layout::Type::Morton);
+        return Layout::Morton::RowIterator(dataIndex(glm::ivec4(x, y, theta, k)), x + m_ghost, y + m_ghost);
+    }
+
+    /**
+     * @brief The samples of (theta, k) in the storage type T, from padded x = y = 0 on. In the
+     * morton layout sample (x, y) is Layout::Morton::xOffset(x + ghost) +
+     * yOffset(y + ghost, paddedResolution(k)) past it.
+     */
+    template <class T>
+    const T *sliceAs(int theta, unsigned int k) const {
+        assert(m_layout == Layout::Type::Morton);
+        return dataAs<T>() + dataIndex(glm::ivec4(-(int) m_ghost, -(int) m_ghost, theta, k));
+    }
+
+    /**
+     * @brief The x,y resolution of band k and its theta resolution, ghost cells included.
+     */
+    glm::uvec2 paddedResolution(unsigned int k) const { return m_bandResolutions[k] + 2 * m_ghost; }
+    unsigned int paddedThetaResolution() const { return m_resolution[Parameter::THETA] + 2 * m_thetaGhost; }
+
+    /**
+     * @brief The samples in the storage type T.
+     */
+    template <class T>
+    const T *dataAs() const {
+        assert(sizeof(T) == Storage::elementSize(m_storage));
+        const void *data = m_storage == Storage::Type::Float32 ? (const void *) m_data.data() : (const void *) m_packedData.data();
+        return static_cast<const T *>(data);
+    }
+
+    /**
+     * @brief The x row at (y, theta, k) in fp32. That is the row itself if directRows,
+     * otherwise the row is gathered and decoded into scratch, which must hold a full row.
+     */
+    const float *readRow(unsigned int y, unsigned int theta, unsigned int k, float *scratch) const;
+
+    /**
+     * @brief Converts x in [begin, end) of the row at (y, theta, k) to fp32, into out[0, end - begin).
+     */
+    void decode(int y, int theta, unsigned int k, int begin, int end, float *out) const;
+
+    /**
+     * @brief Where to put the fp32 x row at (y, theta, k): the row itself if directRows,
+     * otherwise scratch. writeRow stores it once it is complete.
+     */
+    float *rowBuffer(unsigned int y, unsigned int theta, unsigned int k, float *scratch);
+    void writeRow(unsigned int y, unsigned int theta, unsigned int k, const float *row);
+
+    /**
+     * @brief Sets x in [begin, end) of the row at (y, theta, k) to value.
+     */
+    void fillRow(int y, int theta, unsigned int k, int begin, int end, float value);
 
     void setTemporaryData();
 
 private:
-    unsigned int dataIndex(glm::uvec4 index) const;
+    size_t dataIndex(glm::ivec4 index) const;
+
+    /**
+     * @brief The inverse of decode, for x in [begin, end) of the row at (y, theta, k).
+     */
+    void encode(int y, int theta, unsigned int k, int begin, int end, const float *in);
+
+    /**
+     * @brief Moves the samples to another layout and ghost cell count, keeping the ghost cells
+     * both have.
+     */
+    void reorder(Layout::Type layout, unsigned int ghost, unsigned int thetaGhost);
+
+    /**
+     * @brief Calls f(index, offset, count) for every run of x in [begin, end) of the row at
+     * (y, theta, k) that is contiguous in memory, offset being relative to begin.
+     */
+    template <class F>
+    void forEachRun(int y, int theta, unsigned int k, int begin, int end, F &&f) const;
+
+    /**
+     * @brief Calls f(index, count) for the contiguous spans that hold the rows [begin, end) of
+     * band k, see Layout.
+     */
+    template <class F>
+    void forEachRowSpan(unsigned int k, int begin, int end, F &&f) const;
 
-    std::vector<float> m_data = {};
+    Storage::Type m_storage = Storage::Type::Float32;
+    Layout::Type m_layout = Layout::Type::XMajor;
+    // the samples are in m_data for fp32 storage and in m_packedData otherwise
+    // indexed with size_t, the bands together can hold more than 2^32 samples
+    Memory::Vector<float> m_data = {};
+    Memory::Vector<std::uint16_t> m_packedData = {};
     glm::uvec4 m_resolution = glm::uvec4(0, 0, 0, 0);
+    unsigned int m_ghost = 0, m_thetaGhost = 0;
+    // per k band x,y resolution and the index its data starts at
+    std::vector<glm::uvec2> m_bandResolutions;
+    std::vector<size_t> m_bandOffsets;
 };
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "wavelet/waveletgrid.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+// What the grid benchmarks share: random amplitudes in every cell, so that no tile is quiescent
+// and every kernel runs everywhere, and the time a step takes.
+namespace GridBenchmark {
+
+    inline void fillRandom(WaveletGrid &grid, unsigned int thetaResolution, unsigned int kResolution,
+            unsigned int seed = 1) {
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<float> amplitude(0.0f, 1.0f);
+        for (unsigned int i_k = 0; i_k < kResolution; i_k++) {
+            const glm::uvec2 resolution = grid.getBandResolution(i_k);
+            std::vector<float> rows((size_t) resolution.x * resolution.y * thetaResolution);
+            for (float &value : rows) value = amplitude(random);
+            grid.writeBandRows(i_k, 0, resolution.y, rows.data());
+        }
+    }
+
+    // one step to warm up, then the mean of steps steps
+    inline double millisecondsPerStep(WaveletGrid &grid, float deltaTime, int steps) {
+        grid.takeStep(deltaTime);
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < steps; i++) grid.takeStep(deltaTime);
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / steps;
+    }
+}
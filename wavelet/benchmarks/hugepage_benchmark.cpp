@@ -0,0 +1,164 @@
+// Sweeps over a large Amplitude allocated with every Memory::HugePages mode, with the time and
+// the dTLB load misses of each sweep, and how much of the process is backed by huge pages.
+//
+//   hugepage_benchmark [resolution = 768] [sweeps = 3]
+//
+// The amplitude is resolution x resolution x 16 x 4 fp32. The row sweep reads every row with
+// its two theta neighbours, like the diffusion, the gather sweep reads cells at random, like
+// backtraces that leave the rows. The misses come from perf_event_open, and are n/a where the
+// kernel or the cpu doesn't count them. Explicit only differs from Transparent if huge pages
+// are reserved, e.g. in /proc/sys/vm/nr_hugepages.
+
+#include "wavelet/amplitude.h"
+#include "wavelet/memory.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+    // the dTLB load misses of the calling thread, if the kernel lets us count them
+    class TlbMissCounter {
+    public:
+        TlbMissCounter() {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            m_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+        ~TlbMissCounter() {
+            if (m_fd >= 0) close(m_fd);
+        }
+
+        bool available() const { return m_fd >= 0; }
+
+        void start() {
+            if (m_fd < 0) return;
+            ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+
+        std::uint64_t stop() {
+            std::uint64_t misses = 0;
+            if (m_fd < 0) return misses;
+            ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(m_fd, &misses, sizeof(misses)) != sizeof(misses)) misses = 0;
+            return misses;
+        }
+
+    private:
+        int m_fd = -1;
+    };
+
+    // a field of /proc/self/smaps_rollup in kB, 0 if there is none
+    std::size_t smapsKilobytes(const std::string &field) {
+        std::ifstream smaps("/proc/self/smaps_rollup");
+        std::string name;
+        std::size_t kilobytes;
+        while (smaps >> name) {
+            if (name == field + ":" && smaps >> kilobytes) return kilobytes;
+            smaps.ignore(1 << 16, '\n');
+        }
+        return 0;
+    }
+
+    const char *hugePagesName(Memory::HugePages hugePages) {
+        switch (hugePages) {
+            case Memory::HugePages::None: return "none";
+            case Memory::HugePages::Transparent: return "transparent";
+            case Memory::HugePages::Explicit: return "explicit";
+        }
+        return "?";
+    }
+
+    void report(const char *sweep, double milliseconds, std::uint64_t misses, const TlbMissCounter &counter) {
+        std::printf("  %-7s %8.1f ms", sweep, milliseconds);
+        if (counter.available()) std::printf("   %12llu dTLB load misses\n", (unsigned long long) misses);
+        else std::printf("   dTLB load misses n/a\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    const unsigned int resolution = argc > 1 ? std::atoi(argv[1]) : 768;
+    const int sweeps = argc > 2 ? std::atoi(argv[2]) : 3;
+    const unsigned int thetaResolution = 16, kResolution = 4;
+    const glm::uvec4 size(resolution, resolution, thetaResolution, kResolution);
+
+    // the same random cells for every mode
+    std::mt19937 random(1);
+    std::uniform_int_distribution<int> x(0, resolution - 1), theta(0, thetaResolution - 1), k(0, kResolution - 1);
+    std::vector<glm::ivec4> cells(1 << 22);
+    for (glm::ivec4 &cell : cells) cell = glm::ivec4(x(random), x(random), theta(random), k(random));
+
+    TlbMissCounter counter;
+    std::printf("%ux%ux%ux%u fp32, %d sweeps each\n", resolution, resolution, thetaResolution, kResolution, sweeps);
+    for (Memory::HugePages hugePages : {Memory::HugePages::None, Memory::HugePages::Transparent,
+            Memory::HugePages::Explicit}) {
+        Memory::setHugePages(hugePages);
+        Amplitude amplitude;
+        amplitude.resize(size);
+        for (unsigned int i_k = 0; i_k < kResolution; i_k++)
+            for (unsigned int i_theta = 0; i_theta < thetaResolution; i_theta++)
+                for (unsigned int i_y = 0; i_y < resolution; i_y++) {
+                    float *row = amplitude.row(i_y, i_theta, i_k);
+                    for (unsigned int i_x = 0; i_x < resolution; i_x++) row[i_x] = (i_x + i_y + i_theta) % 7;
+                }
+
+        std::printf("%s: %.1f MB, %zu kB AnonHugePages, %zu kB Private_Hugetlb\n", hugePagesName(hugePages),
+                amplitude.bytes() / 1e6, smapsKilobytes("AnonHugePages"), smapsKilobytes("Private_Hugetlb"));
+
+        // keeps the sums alive
+        volatile float sink = 0;
+
+        counter.start();
+        auto start = std::chrono::steady_clock::now();
+        for (int sweep = 0; sweep < sweeps; sweep++) {
+            float sum = 0;
+            for (unsigned int i_k = 0; i_k < kResolution; i_k++)
+                for (unsigned int i_theta = 0; i_theta < thetaResolution; i_theta++) {
+                    const unsigned int i_thetaPrev = (i_theta + thetaResolution - 1) % thetaResolution;
+                    const unsigned int i_thetaNext = (i_theta + 1) % thetaResolution;
+                    for (unsigned int i_y = 0; i_y < resolution; i_y++) {
+                        const float *center = amplitude.row(i_y, i_theta, i_k);
+                        const float *prev = amplitude.row(i_y, i_thetaPrev, i_k);
+                        const float *next = amplitude.row(i_y, i_thetaNext, i_k);
+                        for (unsigned int i_x = 0; i_x < resolution; i_x++)
+                            sum += prev[i_x] + next[i_x] - 2 * center[i_x];
+                    }
+                }
+            sink = sink + sum;
+        }
+        std::uint64_t misses = counter.stop();
+        report("rows", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() /
+                sweeps, misses / sweeps, counter);
+
+        counter.start();
+        start = std::chrono::steady_clock::now();
+        for (int sweep = 0; sweep < sweeps; sweep++) {
+            float sum = 0;
+            for (const glm::ivec4 &cell : cells) sum += amplitude(cell);
+            sink = sink + sum;
+        }
+        misses = counter.stop();
+        report("gather", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() /
+                sweeps, misses / sweeps, counter);
+    }
+    return 0;
+}
@@ -0,0 +1,63 @@
+// Milliseconds per step of every step kernel on the x major and the theta blocked layout, for
+// fp32 and fp16 storage, and whether both layouts step to the same amplitudes.
+//
+//   layout_benchmark [resolution = 256] [steps = 10]
+//
+// The grid is resolution x resolution x 16 x 4, every band at full resolution.
+
+#include "gridbenchmark.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+namespace {
+    struct Kernel {
+        const char *name;
+        AdvectionMode advectionMode;
+        bool fusedStep;
+    };
+
+    const Kernel kernels[] = {
+        {"interpolated", AdvectionMode::Interpolated, false},
+        {"constant disp", AdvectionMode::ConstantDisplacement, false},
+        {"fused", AdvectionMode::Interpolated, true},
+    };
+
+    const Layout::Type layouts[] = {Layout::Type::XMajor, Layout::Type::ThetaBlocked};
+    const char *layoutNames[] = {"x major", "theta blocked"};
+}
+
+int main(int argc, char **argv) {
+    const unsigned int resolution = argc > 1 ? std::atoi(argv[1]) : 256;
+    const int steps = argc > 2 ? std::atoi(argv[2]) : 10;
+    const unsigned int thetaResolution = 16, kResolution = 4;
+    const float deltaTime = 0.05f;
+
+    std::printf("%ux%ux%ux%u, %d steps, ms per step\n", resolution, resolution, thetaResolution, kResolution, steps);
+    for (Storage::Type storage : {Storage::Type::Float32, Storage::Type::Float16}) {
+        for (const Kernel &kernel : kernels) {
+            std::printf("%s %-14s", storage == Storage::Type::Float32 ? "fp32" : "fp16", kernel.name);
+
+            std::unique_ptr<WaveletGrid> reference;
+            bool identical = true;
+            for (int i = 0; i < 2; i++) {
+                auto grid = std::make_unique<WaveletGrid>(glm::vec4(-50, -50, 0, 0),
+                        glm::vec4(50, 50, WaveletGrid::tau, 1), glm::uvec4(resolution, resolution, thetaResolution,
+                            kResolution));
+                grid->setSamplesPerWavelength(0);
+                grid->setAdvectionMode(kernel.advectionMode);
+                grid->setFusedStep(kernel.fusedStep);
+                GridBenchmark::fillRandom(*grid, thetaResolution, kResolution);
+                grid->setStorage(storage);
+                grid->setLayout(layouts[i]);
+
+                std::printf("   %s %7.1f", layoutNames[i], GridBenchmark::millisecondsPerStep(*grid, deltaTime, steps));
+                if (reference) identical = identical && grid->amplitudeError(*reference).maxAbsolute == 0;
+                else reference = std::move(grid);
+            }
+            std::printf("   %s\n", identical ? "identical" : "DIFFERENT");
+        }
+    }
+    return 0;
+}
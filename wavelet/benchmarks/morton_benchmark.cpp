@@ -0,0 +1,48 @@
+// Seconds per step of the x major and the Morton layout across step lengths, for both advection
+// modes, and whether both layouts step to the same amplitudes. The longer the step, the further
+// the backtraces reach and the more rows they touch.
+//
+//   morton_benchmark [resolution = 512] [steps = 3]
+//
+// The grid is resolution x resolution x 16 x 4 with implicit diffusion, so that the long steps
+// are stable, and every tile is stepped.
+
+#include "gridbenchmark.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+int main(int argc, char **argv) {
+    const unsigned int resolution = argc > 1 ? std::atoi(argv[1]) : 512;
+    const int steps = argc > 2 ? std::atoi(argv[2]) : 3;
+    const unsigned int thetaResolution = 16, kResolution = 4;
+
+    std::printf("%ux%ux%ux%u, %d steps, s per step\n", resolution, resolution, thetaResolution, kResolution, steps);
+    std::printf("  dt      mode                    x major   morton\n");
+    for (AdvectionMode advectionMode : {AdvectionMode::ConstantDisplacement, AdvectionMode::Interpolated}) {
+        for (float deltaTime : {0.05f, 0.2f, 0.5f, 1.0f}) {
+            std::printf("  %.2f    %-22s", deltaTime,
+                    advectionMode == AdvectionMode::Interpolated ? "interpolated" : "constant displacement");
+
+            std::unique_ptr<WaveletGrid> reference;
+            bool identical = true;
+            for (Layout::Type layout : {Layout::Type::XMajor, Layout::Type::Morton}) {
+                auto grid = std::make_unique<WaveletGrid>(glm::vec4(-500, -500, 0, 0),
+                        glm::vec4(500, 500, WaveletGrid::tau, 1), glm::uvec4(resolution, resolution, thetaResolution,
+                            kResolution));
+                grid->setAdvectionMode(advectionMode);
+                grid->setDiffusionMode(DiffusionMode::Implicit);
+                grid->setSkipQuiescentTiles(false);
+                GridBenchmark::fillRandom(*grid, thetaResolution, kResolution);
+                grid->setLayout(layout);
+
+                std::printf("  %7.2f", GridBenchmark::millisecondsPerStep(*grid, deltaTime, steps) / 1000);
+                if (reference) identical = identical && grid->amplitudeError(*reference).maxAbsolute == 0;
+                else reference = std::move(grid);
+            }
+            std::printf("   %s\n", identical ? "identical" : "DIFFERENT");
+        }
+    }
+    return 0;
+}
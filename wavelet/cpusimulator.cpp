@@ -0,0 +1,274 @@
+#include "cpusimulator.h"
+
+#include "wavelet/interpolation.h"
+#include "wavelet/storage.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+CpuSimulator::CpuSimulator(Setting setting, std::shared_ptr<const Terrain> terrain)
+    : terrain(terrain), setting(setting) {
+    if (setting.simulationResolution[3] != 4)
+        throw std::runtime_error("CpuSimulator: the k bands are packed in a vec4, but the resolution has " +
+                std::to_string(setting.simulationResolution[3]));
+    resolution = glm::ivec2(setting.simulationResolution[0], setting.simulationResolution[1]);
+    thetaResolution = setting.simulationResolution[2];
+
+    minParam = glm::vec4(-setting.size, -setting.size, 0, setting.kValues.x);
+    maxParam = glm::vec4(setting.size, setting.size, Setting::tau, setting.kValues.w);
+    unitParam = (maxParam - minParam) / glm::vec4(resolution, thetaResolution, 4);
+
+    std::vector<float> wavenumbers = {setting.kValues.x, setting.kValues.y, setting.kValues.z, setting.kValues.w};
+    std::vector<float> thetas(thetaResolution);
+    for (int i_theta = 0; i_theta < thetaResolution; i_theta++)
+        thetas[i_theta] = minParam.z + (i_theta + 0.5f) * unitParam.z;
+    plan = std::make_shared<const DispersionPlan>(setting, glm::uvec4(resolution, thetaResolution, 4), unitParam.x,
+            wavenumbers, thetas);
+    advectionSpeed = DispersionPlan::pack(plan->advectionSpeeds());
+    spatialDiffusion = DispersionPlan::pack(plan->spatialDiffusions());
+    angularDiffusion = DispersionPlan::pack(plan->angularDiffusions());
+    viscosityRate = DispersionPlan::pack(plan->viscosityRates());
+
+    for (int i_theta = 0; i_theta < thetaResolution; i_theta++) {
+        glm::vec4 bands;
+        for (int i_k = 0; i_k < 4; i_k++)
+            bands[i_k] = plan->ambientAmplitude(i_theta, i_k);
+        ambient.push_back(bands * setting.ambientStrength);
+    }
+
+    // the height texture is RGB16F, round the same way so that the same cells are wet
+    const std::vector<glm::vec3> &texels = terrain->getHeightWithSampleLocationInDomain();
+    heightMap.resize(texels.size());
+    for (size_t i = 0; i < texels.size(); i++)
+        for (int c = 0; c < 3; c++)
+            heightMap[i][c] = Storage::toFloat(Storage::fromFloat<Storage::Half>(texels[i][c]));
+
+    reflectionTable = terrain->reflectionTable(glm::uvec2(resolution), plan->thetas());
+    rowStep = rowStepFor(thetaResolution);
+
+    amplitude[0].resize(thetaResolution);
+    amplitude[1].resize(thetaResolution);
+    reset();
+}
+
+void CpuSimulator::advance(float interval) {
+    // the most restricted band decides how much of the interval fits in maxSubsteps
+    StepSchedule schedule = plan->schedule(interval, setting.cflNumber, setting.maxSubsteps);
+    interval = schedule.substeps * schedule.deltaTime;
+
+    glm::ivec4 substeps;
+    glm::vec4 deltaTime;
+    for (int i_k = 0; i_k < 4; i_k++) {
+        StepSchedule bandSchedule = plan->bandSchedule(i_k, interval, setting.cflNumber);
+        substeps[i_k] = bandSchedule.substeps;
+        deltaTime[i_k] = bandSchedule.deltaTime;
+    }
+
+    // spread the steps of every band evenly over the passes, so they all end together
+    const int passes = std::max(std::max(substeps[0], substeps[1]), std::max(substeps[2], substeps[3]));
+    for (int pass = 0; pass < passes; pass++) {
+        glm::vec4 bandMask;
+        for (int i_k = 0; i_k < 4; i_k++)
+            bandMask[i_k] = (pass + 1) * substeps[i_k] / passes > pass * substeps[i_k] / passes;
+        takeStep(deltaTime, bandMask);
+    }
+    timeElapsed += interval;
+}
+
+float CpuSimulator::maxStableTimeStep() const {
+    return plan->maxStableTimeStep(setting.cflNumber);
+}
+
+void CpuSimulator::takeStep(float dt) {
+    if (!dt) dt = 0.0001;
+    takeStep(glm::vec4(dt), glm::vec4(1));
+    timeElapsed += dt;
+}
+
+void CpuSimulator::reset() {
+    for (int pass = 0; pass < 2; pass++)
+        for (std::vector<glm::vec4> &image : amplitude[pass])
+            image.assign((size_t) resolution.x * resolution.y, glm::vec4(0));
+}
+
+void CpuSimulator::setAmplitudes(int i_theta, const std::vector<glm::vec4> &amplitudes) {
+    if (amplitudes.size() != (size_t) resolution.x * resolution.y)
+        throw std::runtime_error("CpuSimulator: expected " + std::to_string(resolution.x * resolution.y) +
+                " amplitudes but got " + std::to_string(amplitudes.size()));
+    amplitude[whichPass][i_theta] = amplitudes;
+}
+
+int CpuSimulator::numThreads() const {
+#ifdef _OPENMP
+    return threadCount > 0 ? threadCount : omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+void CpuSimulator::takeStep(glm::vec4 deltaTime, glm::vec4 bandMask) {
+#pragma omp parallel num_threads(numThreads())
+    {
+        std::vector<glm::vec4> advected(thetaResolution), diffused(thetaResolution);
+        // dry rows are next to free, so hand the rows out as the threads get through them
+#pragma omp for schedule(dynamic, 4)
+        for (int y = 0; y < resolution.y; y++)
+            (this->*rowStep)(y, deltaTime, bandMask, advected.data(), diffused.data());
+    }
+    whichPass ^= 1;
+}
+
+CpuSimulator::RowStep CpuSimulator::rowStepFor(int thetaResolution) {
+    // the theta resolutions deployments run with, see Setting::simulationResolution
+    static constexpr struct {
+        int thetaResolution;
+        RowStep rowStep;
+    } compiled[] = {
+        {4, &CpuSimulator::stepRow<4>},
+        {8, &CpuSimulator::stepRow<8>},
+        {16, &CpuSimulator::stepRow<16>},
+    };
+    for (const auto &entry : compiled)
+        if (entry.thetaResolution == thetaResolution) return entry.rowStep;
+    return &CpuSimulator::stepRow<0>;
+}
+
+template <int NTheta>
+void CpuSimulator::stepRow(int y, glm::vec4 deltaTime, glm::vec4 bandMask, glm::vec4 *advected, glm::vec4 *diffused) {
+    // a constant when compiled for a resolution, so the theta loops unroll and wrap around with masks
+    const int thetaResolution = NTheta > 0 ? NTheta : this->thetaResolution;
+    const std::vector<std::vector<glm::vec4>> &in = amplitude[whichPass];
+    std::vector<std::vector<glm::vec4>> &out = amplitude[whichPass ^ 1];
+    const glm::vec4 angular = angularDiffusion * deltaTime / unitParam.z / unitParam.z;
+    const glm::vec4 viscosity = (1.0f - glm::exp(-viscosityRate * deltaTime)) * bandMask;
+    const ReflectionTable::Entry *entry = reflectionTable.entriesBegin(y);
+    const ReflectionTable::Entry *rowEnd = reflectionTable.entriesEnd(y);
+
+    for (int x = 0; x < resolution.x; x++) {
+        const size_t cell = x + (size_t) y * resolution.x;
+        const glm::vec2 uv = (glm::vec2(x, y) + 0.5f) / glm::vec2(resolution);
+        const ReflectionTable::Entry *cellBegin = entry;
+        while (entry != rowEnd && (int) entry->cell.x == x) entry++;
+
+        // the gpu only draws the wet tiles, which are cleared to 0
+        if (sampleHeight(uv).r - terrain->getWaterHeight() > 0) {
+            for (int i_theta = 0; i_theta < thetaResolution; i_theta++)
+                out[i_theta][cell] = glm::vec4(0);
+            continue;
+        }
+
+        // normalize is undefined on flat ground, where the reflections of the shader are as well
+        const glm::vec2 gradient = sampleGradient(uv);
+        const glm::vec2 normal = gradient == glm::vec2(0) ? glm::vec2(0) : glm::normalize(gradient);
+
+        for (int i_theta = 0; i_theta < thetaResolution; i_theta++)
+            advected[i_theta] = evaluate(uv, i_theta, normal, deltaTime);
+
+        for (int i_theta = 0; i_theta < thetaResolution; i_theta++) {
+            const int previous = (i_theta + thetaResolution - 1) % thetaResolution;
+            const int next = (i_theta + 1) % thetaResolution;
+            diffused[i_theta] = (1.0f - 2.0f * angular) * advected[i_theta] +
+                angular * (advected[previous] + advected[next]);
+        }
+
+        // every incident amplitude leaves before any arrives, the same as on the gpu
+        std::copy(diffused, diffused + thetaResolution, advected);
+        for (const ReflectionTable::Entry *reflection = cellBegin; reflection != entry; reflection++)
+            advected[reflection->theta] = glm::vec4(0);
+        for (const ReflectionTable::Entry *reflection = cellBegin; reflection != entry; reflection++) {
+            const glm::vec4 incident = diffused[reflection->theta];
+            advected[reflection->targets[0]] += reflection->weights[0] * incident;
+            advected[reflection->targets[1]] += (1 - reflection->weights[0]) * incident;
+        }
+
+        // viscosity, and the bands that are not due keep their amplitude
+        for (int i_theta = 0; i_theta < thetaResolution; i_theta++)
+            out[i_theta][cell] = glm::mix(in[i_theta][cell], (1.0f - viscosity) * advected[i_theta], bandMask);
+    }
+}
+
+glm::vec4 CpuSimulator::evaluate(glm::vec2 uv, int i_theta, glm::vec2 normal, glm::vec4 deltaTime) const {
+    const glm::vec2 direction = plan->waveDirection(i_theta);
+    const glm::vec2 pos = glm::mix(glm::vec2(minParam), glm::vec2(maxParam), uv);
+    const float spatialResolution = unitParam.x;
+    const glm::vec4 g = spatialDiffusion * deltaTime * (1 / (spatialResolution * spatialResolution));
+
+    glm::vec4 amplitude = sampleAmplitude(i_theta, uv);
+    for (int i_k = 0; i_k < 4; i_k++) {
+        const float distance = deltaTime[i_k] * advectionSpeed[i_k];
+        // the samples are at least a quarter cell apart, the diffusion is spread over them
+        const float samplingDistance = std::max(spatialResolution / 4, distance);
+
+        float p[6];
+        for (int i = 0; i < 6; i++) {
+            const glm::vec2 samplePos = pos - samplingDistance * direction * float(i - 2);
+            const glm::vec2 sampleUV = (samplePos - glm::vec2(minParam)) / (glm::vec2(maxParam) - glm::vec2(minParam));
+            p[i] = sample(sampleUV, i_theta, normal)[i_k];
+        }
+
+        // spatial diffusion along the wave direction
+        float diffused[4];
+        for (int i = 0; i < 4; i++)
+            diffused[i] = (1 - 2 * g[i_k]) * p[i + 1] + g[i_k] * (p[i] + p[i + 2]);
+
+        amplitude[i_k] = std::max(Math::limitedMonotoneCubic(diffused[0], diffused[1], diffused[2], diffused[3],
+                    distance / samplingDistance), 0.0f);
+    }
+    return amplitude;
+}
+
+glm::vec4 CpuSimulator::sample(glm::vec2 uv, int i_theta, glm::vec2 normal) const {
+    const glm::vec3 data = sampleHeight(uv);
+    if (data.r - terrain->getWaterHeight() > 0) {
+        const glm::vec2 direction = plan->waveDirection(i_theta);
+        // the shader tests the direction against uv rather than the normal, kept so both agree
+        if (glm::dot(direction, uv) >= 0) {
+            const glm::vec2 reflected = glm::reflect(direction, normal);
+            const float angle = glm::fract(std::atan2(reflected.y, reflected.x) / Setting::tau);
+            const float bin = glm::fract(angle - 0.5f / thetaResolution) * thetaResolution;
+            const int lower = std::min<int>(bin, thetaResolution - 1);
+            const int upper = (int) std::ceil(bin) % thetaResolution;
+            const float t = glm::fract(bin);
+
+            // dry land takes the amplitude of the closest water
+            constexpr float reflectance = 0.3f;
+            const glm::vec2 location(data.g, data.b);
+            return reflectance * ((1 - t) * sampleAmplitude(lower, location) + t * sampleAmplitude(upper, location));
+        }
+    }
+    return sampleAmplitude(i_theta, uv);
+}
+
+glm::vec4 CpuSimulator::sampleAmplitude(int i_theta, glm::vec2 uv) const {
+    const std::vector<glm::vec4> &image = amplitude[whichPass][i_theta];
+    const glm::vec2 st = uv * glm::vec2(resolution) - 0.5f;
+    const glm::vec2 origin = glm::floor(st);
+    const glm::vec2 t = st - origin;
+    const int i = origin.x, j = origin.y;
+
+    // GL_LINEAR with GL_CLAMP_TO_BORDER
+    auto texel = [&](int i, int j) {
+        if (i < 0 || i >= resolution.x || j < 0 || j >= resolution.y) return ambient[i_theta];
+        return image[i + (size_t) j * resolution.x];
+    };
+    return glm::mix(glm::mix(texel(i, j), texel(i + 1, j), t.x), glm::mix(texel(i, j + 1), texel(i + 1, j + 1), t.x), t.y);
+}
+
+glm::vec3 CpuSimulator::sampleHeight(glm::vec2 uv) const {
+    // GL_NEAREST with GL_CLAMP_TO_EDGE
+    const int width = terrain->getWidth(), height = terrain->getHeight();
+    const int i = std::clamp<int>(std::floor(uv.x * width), 0, width - 1);
+    const int j = std::clamp<int>(std::floor(uv.y * height), 0, height - 1);
+    return heightMap[i + j * width];
+}
+
+glm::vec2 CpuSimulator::sampleGradient(glm::vec2 uv) const {
+    const int width = terrain->getWidth(), height = terrain->getHeight();
+    const int i = std::clamp<int>(std::floor(uv.x * width), 0, width - 1);
+    const int j = std::clamp<int>(std::floor(uv.y * height), 0, height - 1);
+    return terrain->getGradients()[i + j * width];
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "wavelet/dispersionplan.h"
+#include "wavelet/reflectiontable.h"
+#include "wavelet/setting.h"
+#include "wavelet/terrain.h"
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief The simulation step of Simulator on the cpu, for machines without a gpu.
+ *
+ * Every pass of Shaders/waveletgrid_simulationStep.frag is done the same way, with the same
+ * Setting and DispersionPlan: advection with the 6 tap spatial diffusion along the wave
+ * direction, angular diffusion, shoreline reflection and viscosity. The amplitudes are kept
+ * as the textures of Simulator hold them, one image per theta with the four k bands of a cell
+ * in a vec4, and they are sampled the way the textures are, bilinearly with the ambient
+ * amplitude as the border. The results match the gpu up to the precision of its texture
+ * filtering.
+ *
+ * The rows of the grid are split over the threads with OpenMP, and the four k bands of a cell
+ * are computed together in vec4s. Every cell loops over its thetas a few times, so the row
+ * step is compiled for the usual theta resolutions, where those loops unroll and the theta
+ * neighbours wrap around with constants.
+ */
+class CpuSimulator {
+public:
+    /**
+     * @brief A simulator over the whole terrain. The resolution must have 4 k bands, any number
+     * of thetas works.
+     */
+    CpuSimulator(Setting setting, std::shared_ptr<const Terrain> terrain);
+
+    void takeStep(float dt);
+    // advances by interval, every k band in as few steps as are stable for that band
+    void advance(float interval);
+    float maxStableTimeStep() const;
+    // sets every amplitude to 0
+    void reset();
+
+    /**
+     * @brief The amplitudes of direction i_theta, indexed by x + y * resolution x.
+     */
+    const std::vector<glm::vec4> &getAmplitudes(int i_theta) const { return amplitude[whichPass][i_theta]; }
+    void setAmplitudes(int i_theta, const std::vector<glm::vec4> &amplitudes);
+
+    /**
+     * @brief Sets the number of threads the steps use, 0 for the OpenMP default.
+     */
+    void setThreadCount(int threadCount) { this->threadCount = threadCount; }
+
+private:
+    int whichPass = 0; // the amplitudes are read from amplitude[whichPass] and written to the other
+    float timeElapsed = 0;
+    int threadCount = 0;
+
+    std::shared_ptr<const Terrain> terrain;
+    // the heights and sample locations as the height texture holds them, in fp16
+    std::vector<glm::vec3> heightMap;
+    ReflectionTable reflectionTable;
+
+    std::vector<std::vector<glm::vec4>> amplitude[2];
+    // the border color of the amplitude textures, per theta
+    std::vector<glm::vec4> ambient;
+
+    Setting setting;
+    glm::ivec2 resolution;
+    int thetaResolution;
+    glm::vec4 minParam, maxParam, unitParam;
+    std::shared_ptr<const DispersionPlan> plan;
+
+    // the per band coefficients, packed as in the shader
+    glm::vec4 advectionSpeed, spatialDiffusion, angularDiffusion, viscosityRate;
+
+    // steps the k bands where bandMask is 1, each by its own deltaTime
+    void takeStep(glm::vec4 deltaTime, glm::vec4 bandMask);
+
+    /**
+     * @brief The whole step for the cells of row y, with NTheta thetas or thetaResolution if
+     * NTheta is 0. advected and diffused hold thetaResolution amplitudes each.
+     */
+    template <int NTheta>
+    void stepRow(int y, glm::vec4 deltaTime, glm::vec4 bandMask, glm::vec4 *advected, glm::vec4 *diffused);
+
+    using RowStep = void (CpuSimulator::*)(int y, glm::vec4 deltaTime, glm::vec4 bandMask, glm::vec4 *advected,
+            glm::vec4 *diffused);
+    /**
+     * @brief The stepRow compiled for thetaResolution, or the one for any resolution if there
+     * is none.
+     */
+    static RowStep rowStepFor(int thetaResolution);
+    RowStep rowStep;
+
+    // texture(_Amplitude[i_theta], uv)
+    glm::vec4 sampleAmplitude(int i_theta, glm::vec2 uv) const;
+    // texture(_Height, uv) and texture(_Gradient, uv)
+    glm::vec3 sampleHeight(glm::vec2 uv) const;
+    glm::vec2 sampleGradient(glm::vec2 uv) const;
+    // sample of the shader, which reflects the samples that fall on dry land
+    glm::vec4 sample(glm::vec2 uv, int i_theta, glm::vec2 normal) const;
+    // evaluate of the shader, the advection and spatial diffusion of one cell
+    glm::vec4 evaluate(glm::vec2 uv, int i_theta, glm::vec2 normal, glm::vec4 deltaTime) const;
+
+    int numThreads() const;
+};
@@ -0,0 +1,266 @@
+#include "diffusionkernels.h"
+#include "diffusionkernels_impl.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace DiffusionKernels {
+
+    void diffuseRowScalar(const Coefficients &coefficients, const Rows &rows, unsigned int begin, unsigned int end) {
+        for (unsigned int x = begin; x < end; x++)
+            rows.out[x] = diffuseCell(coefficients, rows, x);
+    }
+
+    Isa detectIsa() {
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+        static const Isa isa = []() {
+            __builtin_cpu_init();
+#ifdef WAVELET_HAS_AVX512
+            if (__builtin_cpu_supports("avx512f")) return Isa::AVX512;
+#endif
+#ifdef WAVELET_HAS_AVX2
+            if (__builtin_cpu_supports("avx2")) return Isa::AVX2;
+#endif
+#ifdef WAVELET_HAS_SSE4
+            if (__builtin_cpu_supports("sse4.1")) return Isa::SSE4;
+#endif
+            return Isa::Scalar;
+        }();
+        return isa;
+#else
+        return Isa::Scalar;
+#endif
+    }
+
+    RowKernel rowKernel(Isa isa) {
+        // never hand out a variant the cpu can't run
+        if (isa > detectIsa()) isa = detectIsa();
+
+        switch (isa) {
+            case Isa::AVX512: return diffuseRowAVX512;
+            case Isa::AVX2: return diffuseRowAVX2;
+            case Isa::SSE4: return diffuseRowSSE4;
+            default: return diffuseRowScalar;
+        }
+    }
+
+    const char *isaName(Isa isa) {
+        switch (isa) {
+            case Isa::AVX512: return "AVX-512";
+            case Isa::AVX2: return "AVX2";
+            case Isa::SSE4: return "SSE4.1";
+            default: return "scalar";
+        }
+    }
+
+    void solveDiffusion(float r, const std::uint8_t *free, float *d, float *scratch, unsigned int n, unsigned int batch) {
+        // the thomas algorithm, scratch holding the eliminated upper diagonal
+        for (unsigned int b = 0; b < batch; b++)
+            scratch[b] = 0;
+        for (unsigned int i = 1; i < n; i++) {
+            const std::uint8_t *freeRow = free + (size_t) i * batch;
+            const float *upperPrev = scratch + (size_t) (i - 1) * batch;
+            const float *dPrev = d + (size_t) (i - 1) * batch;
+            float *upper = scratch + (size_t) i * batch;
+            float *dRow = d + (size_t) i * batch;
+            for (unsigned int b = 0; b < batch; b++) {
+                const float offDiagonal = freeRow[b] ? -r : 0.0f;
+                const float diagonal = freeRow[b] ? 1 + 2 * r : 1.0f;
+                const float pivot = 1.0f / (diagonal - offDiagonal * upperPrev[b]);
+                upper[b] = offDiagonal * pivot;
+                dRow[b] = (dRow[b] - offDiagonal * dPrev[b]) * pivot;
+            }
+        }
+        for (unsigned int i = n - 1; i-- > 0;) {
+            const float *upper = scratch + (size_t) i * batch;
+            const float *dNext = d + (size_t) (i + 1) * batch;
+            float *dRow = d + (size_t) i * batch;
+            for (unsigned int b = 0; b < batch; b++)
+                dRow[b] -= upper[b] * dNext[b];
+        }
+    }
+
+    void solvePeriodicDiffusion(float r, float *d, float *scratch, unsigned int n, unsigned int batch) {
+        if (n == 1 || r == 0) return;
+        if (n == 2) {
+            // both neighbours are the other unknown
+            const float scale = 1.0f / (1 + 4 * r);
+            for (unsigned int b = 0; b < batch; b++) {
+                const float d0 = d[b], d1 = d[batch + b];
+                d[b] = ((1 + 2 * r) * d0 + 2 * r * d1) * scale;
+                d[batch + b] = ((1 + 2 * r) * d1 + 2 * r * d0) * scale;
+            }
+            return;
+        }
+
+        // sherman-morrison: the matrix is a tridiagonal T plus u v^T, with u = (gamma, 0, .., -r)
+        // and v = (1, 0, .., -r / gamma) carrying the corners. T is factored once, and z = T^-1 u
+        // is the same for every system
+        const float diagonal = 1 + 2 * r;
+        const float gamma = -diagonal;
+        float *upper = scratch;
+        float *z = scratch + n;
+        auto tDiagonal = [&](unsigned int i) {
+            if (i == 0) return diagonal - gamma;
+            if (i == n - 1) return diagonal - r * r / gamma;
+            return diagonal;
+        };
+
+        float pivot = 1.0f / tDiagonal(0);
+        upper[0] = -r * pivot;
+        z[0] = gamma * pivot;
+        for (unsigned int i = 1; i < n; i++) {
+            pivot = 1.0f / (tDiagonal(i) + r * upper[i - 1]);
+            upper[i] = -r * pivot;
+            z[i] = ((i == n - 1 ? -r : 0.0f) + r * z[i - 1]) * pivot;
+        }
+        for (unsigned int i = n - 1; i-- > 0;)
+            z[i] -= upper[i] * z[i + 1];
+        const float vz = 1 + z[0] - r / gamma * z[n - 1];
+
+        // T^-1 d for every system, with the pivots of the factorization above
+        float *dRow;
+        pivot = 1.0f / tDiagonal(0);
+        for (unsigned int b = 0; b < batch; b++)
+            d[b] *= pivot;
+        for (unsigned int i = 1; i < n; i++) {
+            pivot = 1.0f / (tDiagonal(i) + r * upper[i - 1]);
+            const float *dPrev = d + (size_t) (i - 1) * batch;
+            dRow = d + (size_t) i * batch;
+            for (unsigned int b = 0; b < batch; b++)
+                dRow[b] = (dRow[b] + r * dPrev[b]) * pivot;
+        }
+        for (unsigned int i = n - 1; i-- > 0;) {
+            const float *dNext = d + (size_t) (i + 1) * batch;
+            dRow = d + (size_t) i * batch;
+            for (unsigned int b = 0; b < batch; b++)
+                dRow[b] -= upper[i] * dNext[b];
+        }
+
+        // x = y - z (v.y) / (1 + v.z), the first and last row last since v.y reads them
+        float *last = d + (size_t) (n - 1) * batch;
+        for (unsigned int i = 1; i + 1 < n; i++) {
+            dRow = d + (size_t) i * batch;
+            const float zi = z[i] / vz;
+            for (unsigned int b = 0; b < batch; b++)
+                dRow[b] -= zi * (d[b] - r / gamma * last[b]);
+        }
+        for (unsigned int b = 0; b < batch; b++) {
+            const float factor = (d[b] - r / gamma * last[b]) / vz;
+            d[b] -= z[0] * factor;
+            last[b] -= z[n - 1] * factor;
+        }
+    }
+
+    SpectralDecay::SpectralDecay(unsigned int n, float r) : m_n(n) {
+        const double pi = 3.14159265358979323846;
+        for (unsigned int m = 0; m < n; m++)
+            m_decay.push_back(std::exp(-r * (2 - 2 * std::cos(2 * pi * m / n))) / n);
+
+        if (n & (n - 1)) {
+            // x[i] = sum_j c[(i - j) mod n] x[j], with c the inverse transform of the decay
+            for (unsigned int k = 0; k < n; k++) {
+                double c = 0;
+                for (unsigned int m = 0; m < n; m++)
+                    c += m_decay[m] * std::cos(2 * pi * m * k / n);
+                m_circulant.push_back(c);
+            }
+            return;
+        }
+
+        for (unsigned int k = 0; k < n / 2; k++) {
+            m_cos.push_back(std::cos(2 * pi * k / n));
+            m_sin.push_back(-std::sin(2 * pi * k / n));
+        }
+        unsigned int bits = 0;
+        while ((1u << bits) < n) bits++;
+        for (unsigned int i = 0; i < n; i++) {
+            unsigned int reversed = 0;
+            for (unsigned int bit = 0; bit < bits; bit++)
+                reversed |= ((i >> bit) & 1) << (bits - 1 - bit);
+            m_reversed.push_back(reversed);
+        }
+    }
+
+    void SpectralDecay::fft(float *re, float *im, unsigned int lanes, bool inverse) const {
+        const unsigned int n = m_n;
+        for (unsigned int i = 0; i < n; i++) {
+            const unsigned int j = m_reversed[i];
+            if (j <= i) continue;
+            std::swap_ranges(re + (size_t) i * lanes, re + (size_t) (i + 1) * lanes, re + (size_t) j * lanes);
+            std::swap_ranges(im + (size_t) i * lanes, im + (size_t) (i + 1) * lanes, im + (size_t) j * lanes);
+        }
+
+        // radix 2 butterflies, every lane the same
+        const float sign = inverse ? -1.0f : 1.0f;
+        for (unsigned int length = 2; length <= n; length *= 2) {
+            const unsigned int half = length / 2;
+            const unsigned int twiddleStride = n / length;
+            for (unsigned int start = 0; start < n; start += length) {
+                for (unsigned int k = 0; k < half; k++) {
+                    const float wRe = m_cos[k * twiddleStride];
+                    const float wIm = sign * m_sin[k * twiddleStride];
+                    float *aRe = re + (size_t) (start + k) * lanes, *aIm = im + (size_t) (start + k) * lanes;
+                    float *bRe = re + (size_t) (start + k + half) * lanes, *bIm = im + (size_t) (start + k + half) * lanes;
+                    for (unsigned int p = 0; p < lanes; p++) {
+                        const float tRe = bRe[p] * wRe - bIm[p] * wIm;
+                        const float tIm = bRe[p] * wIm + bIm[p] * wRe;
+                        bRe[p] = aRe[p] - tRe;
+                        bIm[p] = aIm[p] - tIm;
+                        aRe[p] += tRe;
+                        aIm[p] += tIm;
+                    }
+                }
+            }
+        }
+    }
+
+    void SpectralDecay::apply(float *d, float *scratch, unsigned int batch) const {
+        const unsigned int n = m_n;
+        if (n == 1) return;
+
+        if (!m_circulant.empty()) {
+            std::copy(d, d + (size_t) n * batch, scratch);
+            for (unsigned int i = 0; i < n; i++) {
+                float *row = d + (size_t) i * batch;
+                std::fill(row, row + batch, 0.0f);
+                for (unsigned int j = 0; j < n; j++) {
+                    const float c = m_circulant[(i + n - j) % n];
+                    const float *source = scratch + (size_t) j * batch;
+                    for (unsigned int b = 0; b < batch; b++)
+                        row[b] += c * source[b];
+                }
+            }
+            return;
+        }
+
+        // the first half of the systems as the real parts, the second as the imaginary ones
+        const unsigned int lanes = (batch + 1) / 2;
+        float *re = scratch;
+        float *im = scratch + (size_t) n * lanes;
+        for (unsigned int i = 0; i < n; i++) {
+            const float *row = d + (size_t) i * batch;
+            std::copy(row, row + lanes, re + (size_t) i * lanes);
+            std::copy(row + lanes, row + batch, im + (size_t) i * lanes);
+            // an odd batch leaves the last imaginary lane without a system
+            std::fill(im + (size_t) i * lanes + (batch - lanes), im + (size_t) (i + 1) * lanes, 0.0f);
+        }
+
+        fft(re, im, lanes, false);
+        for (unsigned int m = 0; m < n; m++) {
+            const float decay = m_decay[m];
+            float *modeRe = re + (size_t) m * lanes, *modeIm = im + (size_t) m * lanes;
+            for (unsigned int p = 0; p < lanes; p++) {
+                modeRe[p] *= decay;
+                modeIm[p] *= decay;
+            }
+        }
+        fft(re, im, lanes, true);
+
+        for (unsigned int i = 0; i < n; i++) {
+            float *row = d + (size_t) i * batch;
+            std::copy(re + (size_t) i * lanes, re + (size_t) (i + 1) * lanes, row);
+            std::copy(im + (size_t) i * lanes, im + (size_t) i * lanes + (batch - lanes), row + lanes);
+        }
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/vec2.hpp>
+#include <vector>
+
+/**
+ * Vectorized kernels for the interior of WaveletGrid::diffusionStep.
+ *
+ * Each kernel updates a contiguous x row of one (theta,k) band from the same row, its
+ * y neighbours and its theta neighbours. Every ISA variant evaluates exactly the same
+ * sequence of float operations as diffuseRowScalar, so all of them produce identical
+ * results. The variant is chosen once at runtime from the features of the cpu.
+ */
+namespace DiffusionKernels {
+
+    enum class Isa {
+        Scalar = 0,
+        SSE4 = 1,
+        AVX2 = 2,
+        AVX512 = 3,
+    };
+
+    /**
+     * @brief Per band constants of equation 18.
+     */
+    struct Coefficients {
+        float deltaTime;
+        float advectionSpeed;
+        glm::vec2 direction; // \hat{k}
+        float delta;         // spatial diffusion
+        float gamma;         // angular diffusion
+    };
+
+    /**
+     * @brief The rows a kernel reads from and writes to. All rows are indexed by x.
+     */
+    struct Rows {
+        const float *center;
+        const float *yPrev;
+        const float *yNext;
+        const float *thetaPrev;
+        const float *thetaNext;
+        float *out;
+    };
+
+    /**
+     * @brief Update out[x] for x in [begin, end). center[begin - 1] and center[end] must be readable.
+     */
+    using RowKernel = void (*)(const Coefficients &coefficients, const Rows &rows, unsigned int begin, unsigned int end);
+
+    void diffuseRowScalar(const Coefficients &coefficients, const Rows &rows, unsigned int begin, unsigned int end);
+    void diffuseRowSSE4(const Coefficients &coefficients, const Rows &rows, unsigned int begin, unsigned int end);
+    void diffuseRowAVX2(const Coefficients &coefficients, const Rows &rows, unsigned int begin, unsigned int end);
+    void diffuseRowAVX512(const Coefficients &coefficients, const Rows &rows, unsigned int begin, unsigned int end);
+
+    /**
+     * @brief The widest instruction set supported by both the build and the cpu we run on.
+     */
+    Isa detectIsa();
+
+    /**
+     * @brief The row kernel for an instruction set. Falls back to narrower variants if isa
+     * is not available.
+     */
+    RowKernel rowKernel(Isa isa = detectIsa());
+
+    const char *isaName(Isa isa);
+
+    /*
+     * Batched solvers for the implicit diffusion, one backward euler step of a second
+     * difference along one axis. batch independent systems of n unknowns are solved in
+     * lockstep, unknown i of system b being at [i * batch + b], so that the innermost loops run
+     * over contiguous memory and vectorize for any instruction set.
+     */
+
+    /**
+     * @brief Solves -r x[i - 1] + (1 + 2r) x[i] - r x[i + 1] = d[i] where free[i], and x[i] = d[i]
+     * where not. The first and last unknown of every system must not be free.
+     *
+     * @param d the right hand sides, replaced by the solutions.
+     * @param scratch n * batch floats.
+     */
+    void solveDiffusion(float r, const std::uint8_t *free, float *d, float *scratch, unsigned int n, unsigned int batch);
+
+    /**
+     * @brief Solves -r x[i - 1] + (1 + 2r) x[i] - r x[i + 1] = d[i] with the indices wrapping
+     * around, for every unknown. All the systems share their matrix, so it is factored once.
+     *
+     * @param d the right hand sides, replaced by the solutions.
+     * @param scratch 2 * n floats.
+     */
+    void solvePeriodicDiffusion(float r, float *d, float *scratch, unsigned int n, unsigned int batch);
+
+    /**
+     * @brief The exact solution of dx/dt = r (x[i - 1] - 2 x[i] + x[i + 1]) over a unit of time,
+     * with the indices wrapping around. Every Fourier mode m decays by exp(-r (2 - 2 cos(2 pi m / n))),
+     * so the step is exact for any r.
+     *
+     * Built once for n and r and applied to batches laid out like the solvers above. Two systems
+     * go through the fft together as the real and the imaginary part, which the real decay keeps
+     * apart. n that are not a power of two apply the equivalent circulant matrix instead.
+     */
+    class SpectralDecay {
+    public:
+        SpectralDecay(unsigned int n, float r);
+
+        /**
+         * @param d the systems, replaced by their decayed values.
+         * @param scratch n * (batch + 1) floats.
+         */
+        void apply(float *d, float *scratch, unsigned int batch) const;
+
+    private:
+        unsigned int m_n;
+        // per mode, divided by n for the inverse transform
+        std::vector<float> m_decay;
+        // e^(-2 pi i k / n) for k < n / 2, and the bit reversed order of the n unknowns
+        std::vector<float> m_cos, m_sin;
+        std::vector<unsigned int> m_reversed;
+        // the first row of the circulant matrix, if n is not a power of two
+        std::vector<float> m_circulant;
+
+        void fft(float *re, float *im, unsigned int lanes, bool inverse) const;
+    };
+}
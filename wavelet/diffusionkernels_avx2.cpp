@@ -0,0 +1,28 @@
+#include "diffusionkernels.h"
+
+// compiled with AVX2 enabled when the build supports it, see CMakeLists.txt
+#ifdef __AVX2__
+#include "diffusionkernels_impl.h"
+#include <immintrin.h>
+
+namespace {
+    struct AVX2Vector {
+        using T = __m256;
+        static constexpr unsigned int width = 8;
+        static T load(const float *p) { return _mm256_loadu_ps(p); }
+        static void store(float *p, T v) { _mm256_storeu_ps(p, v); }
+        static T set1(float v) { return _mm256_set1_ps(v); }
+        static T add(T a, T b) { return _mm256_add_ps(a, b); }
+        static T sub(T a, T b) { return _mm256_sub_ps(a, b); }
+        static T mul(T a, T b) { return _mm256_mul_ps(a, b); }
+    };
+}
+
+void DiffusionKernels::diffuseRowAVX2(const Coefficients &coefficients, const Rows &rows, unsigned int begin, unsigned int end) {
+    diffuseRow<AVX2Vector>(coefficients, rows, begin, end);
+}
+#else
+void DiffusionKernels::diffuseRowAVX2(const Coefficients &coefficients, const Rows &rows, unsigned int begin, unsigned int end) {
+    diffuseRowScalar(coefficients, rows, begin, end);
+}
+#endif
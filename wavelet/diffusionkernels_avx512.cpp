@@ -0,0 +1,28 @@
+#include "diffusionkernels.h"
+
+// compiled with AVX-512F enabled when the build supports it, see CMakeLists.txt
+#ifdef __AVX512F__
+#include "diffusionkernels_impl.h"
+#include <immintrin.h>
+
+namespace {
+    struct AVX512Vector {
+        using T = __m512;
+        static constexpr unsigned int width = 16;
+        static T load(const float *p) { return _mm512_loadu_ps(p); }
+        static void store(float *p, T v) { _mm512_storeu_ps(p, v); }
+        static T set1(float v) { return _mm512_set1_ps(v); }
+        static T add(T a, T b) { return _mm512_add_ps(a, b); }
+        static T sub(T a, T b) { return _mm512_sub_ps(a, b); }
+        static T mul(T a, T b) { return _mm512_mul_ps(a, b); }
+    };
+}
+
+void DiffusionKernels::diffuseRowAVX512(const Coefficients &coefficients, const Rows &rows, unsigned int begin, unsigned int end) {
+    diffuseRow<AVX512Vector>(coefficients, rows, begin, end);
+}
+#else
+void DiffusionKernels::diffuseRowAVX512(const Coefficients &coefficients, const Rows &rows, unsigned int begin, unsigned int end) {
+    diffuseRowScalar(coefficients, rows, begin, end);
+}
+#endif
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "diffusionkernels.h"
+
+// Body shared by the DiffusionKernels row kernels. Every ISA specific translation unit
+// includes this and instantiates diffuseRow with its own vector type, so everything here
+// has internal linkage to keep the differently compiled copies apart.
+namespace DiffusionKernels {
+namespace {
+
+    // equation 18 for a single cell, in the same order of operations as the vector path
+    inline float diffuseCell(const Coefficients &c, const Rows &rows, unsigned int x) {
+        float amplitude = rows.center[x];
+        float xNext = rows.center[x + 1];
+        float xPrev = *(rows.center + x - 1); // x - 1 would wrap around for x = 0
+        float yNext = rows.yNext[x];
+        float yPrev = rows.yPrev[x];
+
+        float secondPartialDerivativeWRTtheta = rows.thetaNext[x] + rows.thetaPrev[x] - 2 * amplitude;
+
+        float partialDerivativeWRTX = (xNext - xPrev) * 0.5f;
+        float partialDerivativeWRTY = (yNext - yPrev) * 0.5f;
+        float directionalDerivativeWRTK = c.direction.x * partialDerivativeWRTX + c.direction.y * partialDerivativeWRTY;
+
+        float secondPartialDerivativeWRTX = xNext + xPrev - 2 * amplitude;
+        float secondPartialDerivativeWRTY = yNext + yPrev - 2 * amplitude;
+        float secondDirectionalDerivativeWRTK = (c.direction.x * c.direction.x) * secondPartialDerivativeWRTX +
+            (c.direction.y * c.direction.y) * secondPartialDerivativeWRTY;
+
+        float derivativeWRTt = -c.advectionSpeed * directionalDerivativeWRTK + c.delta * secondDirectionalDerivativeWRTK +
+            c.gamma * secondPartialDerivativeWRTtheta;
+
+        return amplitude + derivativeWRTt * c.deltaTime;
+    }
+
+    /**
+     * V provides a vector type T of width floats with load, store, set1, add, sub and mul.
+     */
+    template <class V>
+    inline void diffuseRow(const Coefficients &c, const Rows &rows, unsigned int begin, unsigned int end) {
+        using T = typename V::T;
+        const T two = V::set1(2.0f);
+        const T half = V::set1(0.5f);
+        const T directionX = V::set1(c.direction.x);
+        const T directionY = V::set1(c.direction.y);
+        const T directionX2 = V::set1(c.direction.x * c.direction.x);
+        const T directionY2 = V::set1(c.direction.y * c.direction.y);
+        const T negativeAdvectionSpeed = V::set1(-c.advectionSpeed);
+        const T delta = V::set1(c.delta);
+        const T gamma = V::set1(c.gamma);
+        const T deltaTime = V::set1(c.deltaTime);
+
+        unsigned int x = begin;
+        for (; x + V::width <= end; x += V::width) {
+            T amplitude = V::load(rows.center + x);
+            T xNext = V::load(rows.center + x + 1);
+            T xPrev = V::load(rows.center + x - 1);
+            T yNext = V::load(rows.yNext + x);
+            T yPrev = V::load(rows.yPrev + x);
+            T twiceAmplitude = V::mul(two, amplitude);
+
+            T secondTheta = V::sub(V::add(V::load(rows.thetaNext + x), V::load(rows.thetaPrev + x)), twiceAmplitude);
+
+            T partialX = V::mul(V::sub(xNext, xPrev), half);
+            T partialY = V::mul(V::sub(yNext, yPrev), half);
+            T directional = V::add(V::mul(directionX, partialX), V::mul(directionY, partialY));
+
+            T secondX = V::sub(V::add(xNext, xPrev), twiceAmplitude);
+            T secondY = V::sub(V::add(yNext, yPrev), twiceAmplitude);
+            T secondDirectional = V::add(V::mul(directionX2, secondX), V::mul(directionY2, secondY));
+
+            T derivativeWRTt = V::add(V::add(V::mul(negativeAdvectionSpeed, directional), V::mul(delta, secondDirectional)),
+                    V::mul(gamma, secondTheta));
+
+            V::store(rows.out + x, V::add(amplitude, V::mul(derivativeWRTt, deltaTime)));
+        }
+
+        for (; x < end; x++)
+            rows.out[x] = diffuseCell(c, rows, x);
+    }
+}
+}
@@ -0,0 +1,28 @@
+#include "diffusionkernels.h"
+
+// compiled with SSE4.1 enabled when the build supports it, see CMakeLists.txt
+#ifdef __SSE4_1__
+#include "diffusionkernels_impl.h"
+#include <immintrin.h>
+
+namespace {
+    struct SSE4Vector {
+        using T = __m128;
+        static constexpr unsigned int width = 4;
+        static T load(const float *p) { return _mm_loadu_ps(p); }
+        static void store(float *p, T v) { _mm_storeu_ps(p, v); }
+        static T set1(float v) { return _mm_set1_ps(v); }
+        static T add(T a, T b) { return _mm_add_ps(a, b); }
+        static T sub(T a, T b) { return _mm_sub_ps(a, b); }
+        static T mul(T a, T b) { return _mm_mul_ps(a, b); }
+    };
+}
+
+void DiffusionKernels::diffuseRowSSE4(const Coefficients &coefficients, const Rows &rows, unsigned int begin, unsigned int end) {
+    diffuseRow<SSE4Vector>(coefficients, rows, begin, end);
+}
+#else
+void DiffusionKernels::diffuseRowSSE4(const Coefficients &coefficients, const Rows &rows, unsigned int begin, unsigned int end) {
+    diffuseRowScalar(coefficients, rows, begin, end);
+}
+#endif
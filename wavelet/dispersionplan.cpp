@@ -0,0 +1,157 @@
+#include "dispersionplan.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+#include <limits>
+
+DispersionPlan::DispersionPlan(const Setting &setting, glm::uvec4 resolution, float spatialResolution,
+        std::vector<float> wavenumbers, std::vector<float> thetas)
+    : DispersionPlan(setting, resolution, std::vector<float>(resolution[3], spatialResolution), std::move(wavenumbers),
+            std::move(thetas))
+{
+}
+
+DispersionPlan::DispersionPlan(const Setting &setting, glm::uvec4 resolution, std::vector<float> spatialResolutions,
+        std::vector<float> wavenumbers, std::vector<float> thetas)
+    : m_setting(setting), m_resolution(resolution), m_spatialResolutions(std::move(spatialResolutions)),
+      m_wavenumbers(std::move(wavenumbers)), m_thetas(std::move(thetas))
+{
+    assert(m_wavenumbers.size() == resolution[3]);
+    assert(m_spatialResolutions.size() == resolution[3]);
+    assert(m_thetas.size() == resolution[2]);
+
+    const float gravity = setting.gravity;
+    const float surfaceTension = setting.surfaceTension;
+    const float viscosity = setting.waterViscosity;
+    const float thetaResolution = setting.tau / resolution[2];
+
+    for (unsigned int i_k = 0; i_k < resolution[3]; i_k++) {
+        const float wavenumber = m_wavenumbers[i_k];
+        const float spatialResolution = m_spatialResolutions[i_k];
+        float omega = std::sqrt(wavenumber * gravity + surfaceTension * wavenumber * wavenumber * wavenumber);
+
+        float advectionSpeed = (gravity + 3 * surfaceTension * wavenumber * wavenumber) / (2 * omega);
+
+        // courtesy of wolfram alpha
+        // https://www.wolframalpha.com/input?i=d%5E2%2Fdx%5E2%28sqrt%28ax%2Bbx%5E3%29%29
+        float numerator =
+            (-2 * gravity + 6 * gravity * surfaceTension * wavenumber * wavenumber +
+             3 * surfaceTension * surfaceTension * wavenumber * wavenumber * wavenumber * wavenumber);
+        float denom = 4 * std::pow(wavenumber * (gravity + surfaceTension * wavenumber * wavenumber), 1.5f);
+        float dispersionSpeed = numerator / denom;
+
+        // found on bottom of page 6
+        float delta = 1e-4 * spatialResolution * spatialResolution * setting.spatialDiffusionMultiplier *
+            std::abs(dispersionSpeed);
+        float gamma = setting.angularDiffusionMultiplier * advectionSpeed * thetaResolution * thetaResolution /
+            spatialResolution;
+
+        // the fraction lost every viscosityReferenceStep, the fixed step the simulation was tuned
+        // with. As a rate, any split of an interval into steps loses the same amplitude
+        float decay = std::clamp(2 * viscosity * wavenumber * wavenumber +
+                0.5f * viscosity * std::sqrt(omega / (2 * viscosity)) * wavenumber, 0.0f, 1.0f);
+        float viscosityRate = -std::log(std::max(1 - decay, std::numeric_limits<float>::min())) /
+            viscosityReferenceStep;
+
+        m_angularFrequencies.push_back(omega);
+        m_advectionSpeeds.push_back(advectionSpeed);
+        m_dispersionSpeeds.push_back(dispersionSpeed);
+        m_spatialDiffusions.push_back(delta);
+        m_angularDiffusions.push_back(gamma);
+        m_viscosityRates.push_back(viscosityRate);
+    }
+
+    for (float theta : m_thetas)
+        m_waveDirections.push_back(glm::vec2(std::cos(theta), std::sin(theta)));
+
+    m_groupVelocities.resize(resolution[2] * resolution[3]);
+    m_ambientAmplitudes.resize(resolution[2] * resolution[3]);
+    for (unsigned int i_k = 0; i_k < resolution[3]; i_k++) {
+        for (unsigned int i_theta = 0; i_theta < resolution[2]; i_theta++) {
+            glm::vec2 waveDirection = m_waveDirections[i_theta];
+            float cosTheta = glm::dot(waveDirection, glm::normalize(setting.windDirection));
+            float ambientCoef = cosTheta < 0 ? 0 : cosTheta * cosTheta * 4.00f / setting.tau;
+
+            m_groupVelocities[i_k * resolution[2] + i_theta] = waveDirection * m_advectionSpeeds[i_k];
+            m_ambientAmplitudes[i_k * resolution[2] + i_theta] = 5 * ambientCoef;
+        }
+    }
+}
+
+bool DispersionPlan::isBuiltFor(const Setting &setting, glm::uvec4 resolution, float spatialResolution) const {
+    return isBuiltFor(setting, resolution, std::vector<float>(resolution[3], spatialResolution));
+}
+
+bool DispersionPlan::isBuiltFor(const Setting &setting, glm::uvec4 resolution,
+        const std::vector<float> &spatialResolutions) const {
+    return m_resolution == resolution &&
+        m_spatialResolutions == spatialResolutions &&
+        m_setting.gravity == setting.gravity &&
+        m_setting.surfaceTension == setting.surfaceTension &&
+        m_setting.waterViscosity == setting.waterViscosity &&
+        m_setting.size == setting.size &&
+        m_setting.kValues == setting.kValues &&
+        m_setting.windDirection == setting.windDirection &&
+        m_setting.spatialDiffusionMultiplier == setting.spatialDiffusionMultiplier &&
+        m_setting.angularDiffusionMultiplier == setting.angularDiffusionMultiplier;
+}
+
+float DispersionPlan::maxAdvectionSpeed() const {
+    return *std::max_element(m_advectionSpeeds.begin(), m_advectionSpeeds.end());
+}
+
+float DispersionPlan::maxStableTimeStep(float cflNumber, bool stableSpatial, bool stableAngular) const {
+    float deltaTime = std::numeric_limits<float>::infinity();
+    for (unsigned int i_k = 0; i_k < m_resolution[3]; i_k++)
+        deltaTime = std::min(deltaTime, bandMaxStableTimeStep(i_k, cflNumber, stableSpatial, stableAngular));
+    return deltaTime;
+}
+
+float DispersionPlan::bandMaxStableTimeStep(int i_k, float cflNumber, bool stableSpatial, bool stableAngular) const {
+    const float h = m_spatialResolutions[i_k];
+    const float thetaResolution = m_setting.tau / m_resolution[2];
+
+    float deltaTime = std::numeric_limits<float>::infinity();
+    // the semi-lagrangian advection is stable for any step, but the interpolation error
+    // grows with the distance traced back
+    if (m_advectionSpeeds[i_k] > 0)
+        deltaTime = std::min(deltaTime, cflNumber * h / m_advectionSpeeds[i_k]);
+    // forward euler on a second difference needs g = coefficient * dt / spacing^2 <= 1/2
+    if (!stableSpatial && m_spatialDiffusions[i_k] > 0)
+        deltaTime = std::min(deltaTime, h * h / (2 * m_spatialDiffusions[i_k]));
+    if (!stableAngular && m_angularDiffusions[i_k] > 0)
+        deltaTime = std::min(deltaTime, thetaResolution * thetaResolution / (2 * m_angularDiffusions[i_k]));
+    return deltaTime;
+}
+
+StepSchedule DispersionPlan::schedule(float interval, float cflNumber, int maxSubsteps, bool stableSpatial,
+        bool stableAngular) const {
+    return splitInterval(interval, maxStableTimeStep(cflNumber, stableSpatial, stableAngular), maxSubsteps);
+}
+
+StepSchedule DispersionPlan::bandSchedule(int i_k, float interval, float cflNumber, bool stableSpatial,
+        bool stableAngular) const {
+    return splitBandInterval(interval, bandMaxStableTimeStep(i_k, cflNumber, stableSpatial, stableAngular));
+}
+
+StepSchedule DispersionPlan::splitInterval(float interval, float maxDeltaTime, int maxSubsteps) {
+    StepSchedule schedule;
+    schedule.substeps = std::clamp<float>(std::ceil(interval / maxDeltaTime), 1, std::max(1, maxSubsteps));
+    schedule.deltaTime = std::min(interval / schedule.substeps, maxDeltaTime);
+    return schedule;
+}
+
+StepSchedule DispersionPlan::splitBandInterval(float interval, float maxDeltaTime) {
+    StepSchedule schedule;
+    schedule.substeps = std::max<float>(std::ceil(interval / maxDeltaTime), 1);
+    schedule.deltaTime = interval / schedule.substeps;
+    return schedule;
+}
+
+glm::vec4 DispersionPlan::pack(const std::vector<float> &table) {
+    glm::vec4 packed(0);
+    for (int i = 0; i < std::min<int>(4, table.size()); i++)
+        packed[i] = table[i];
+    return packed;
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "wavelet/setting.h"
+
+#include <cmath>
+#include <glm/glm.hpp>
+#include <vector>
+
+/**
+ * @brief An interval of simulated time split into equal substeps.
+ */
+struct StepSchedule {
+    int substeps;
+    float deltaTime; // length of each substep
+};
+
+/**
+ * @brief Immutable per-(theta,k) coefficient tables derived from the dispersion relation.
+ *
+ * Both the CPU wavelet grid and the GPU simulator read their physical coefficients from
+ * a plan instead of recomputing them per cell. A plan is built once per (Setting, resolution)
+ * and only needs to be rebuilt when isBuiltFor returns false.
+ */
+class DispersionPlan {
+public:
+    // the step the viscosity decay of the paper was tuned with, see viscosityRate
+    static constexpr float viscosityReferenceStep = 0.01f;
+
+    /**
+     * @brief Build the tables.
+     *
+     * @param setting the physical and diffusion parameters.
+     * @param resolution the x,y,theta,k resolution of the grid using the plan.
+     * @param spatialResolution the size of one grid cell.
+     * @param wavenumbers the wavenumber sampled by each k band, resolution[K] entries.
+     * @param thetas the direction sampled by each theta, resolution[THETA] entries.
+     */
+    DispersionPlan(const Setting &setting, glm::uvec4 resolution, float spatialResolution,
+            std::vector<float> wavenumbers, std::vector<float> thetas);
+
+    /**
+     * @brief Build the tables for a grid where every k band has its own cell size.
+     *
+     * @param spatialResolutions the size of one grid cell of each k band, resolution[K] entries.
+     */
+    DispersionPlan(const Setting &setting, glm::uvec4 resolution, std::vector<float> spatialResolutions,
+            std::vector<float> wavenumbers, std::vector<float> thetas);
+
+    /**
+     * @brief Whether this plan was built for the specified setting, resolution and cell sizes,
+     * i.e. whether it can be reused as is.
+     */
+    bool isBuiltFor(const Setting &setting, glm::uvec4 resolution, float spatialResolution) const;
+    bool isBuiltFor(const Setting &setting, glm::uvec4 resolution, const std::vector<float> &spatialResolutions) const;
+
+    unsigned int thetaResolution() const { return m_resolution[2]; }
+    unsigned int kResolution() const { return m_resolution[3]; }
+
+    float wavenumber(int i_k) const { return m_wavenumbers[i_k]; }
+    float spatialResolution(int i_k) const { return m_spatialResolutions[i_k]; }
+    float angularFrequency(int i_k) const { return m_angularFrequencies[i_k]; }
+    // group speed, the derivative of the angular frequency
+    float advectionSpeed(int i_k) const { return m_advectionSpeeds[i_k]; }
+    // derivative of the group speed
+    float dispersionSpeed(int i_k) const { return m_dispersionSpeeds[i_k]; }
+    // delta, see bottom of page 6 of the paper
+    float spatialDiffusion(int i_k) const { return m_spatialDiffusions[i_k]; }
+    // gamma, see bottom of page 6 of the paper
+    float angularDiffusion(int i_k) const { return m_angularDiffusions[i_k]; }
+    // rate at which viscosity damps the amplitude, per second
+    float viscosityRate(int i_k) const { return m_viscosityRates[i_k]; }
+    // fraction of the amplitude lost to viscosity over a step of deltaTime
+    float viscosityDecay(int i_k, float deltaTime) const { return 1 - std::exp(-m_viscosityRates[i_k] * deltaTime); }
+
+    float theta(int i_theta) const { return m_thetas[i_theta]; }
+    glm::vec2 waveDirection(int i_theta) const { return m_waveDirections[i_theta]; }
+    // wave direction scaled by the group speed of the band
+    glm::vec2 groupVelocity(int i_theta, int i_k) const { return m_groupVelocities[i_k * thetaResolution() + i_theta]; }
+    float ambientAmplitude(int i_theta, int i_k) const { return m_ambientAmplitudes[i_k * thetaResolution() + i_theta]; }
+
+    float maxAdvectionSpeed() const;
+
+    /**
+     * @brief The largest time step for which the explicit spatial and angular diffusion
+     * stencils are stable and no band travels more than cflNumber cells. The spatial or the
+     * angular diffusion don't limit the step if they are integrated in a way that is stable
+     * for any step.
+     */
+    float maxStableTimeStep(float cflNumber, bool stableSpatial = false, bool stableAngular = false) const;
+    // the same, for band i_k only
+    float bandMaxStableTimeStep(int i_k, float cflNumber, bool stableSpatial = false, bool stableAngular = false) const;
+
+    /**
+     * @brief Splits interval into the fewest equal substeps that are at most maxStableTimeStep
+     * long. If that takes more than maxSubsteps, only maxSubsteps stable substeps are taken
+     * and the rest of the interval is dropped.
+     */
+    StepSchedule schedule(float interval, float cflNumber, int maxSubsteps, bool stableSpatial = false,
+            bool stableAngular = false) const;
+
+    /**
+     * @brief Splits interval into the fewest equal substeps that are stable for band i_k,
+     * for integrating every band at its own rate.
+     */
+    StepSchedule bandSchedule(int i_k, float interval, float cflNumber, bool stableSpatial = false,
+            bool stableAngular = false) const;
+
+    /**
+     * @brief Splits interval like schedule and bandSchedule do, for a maxDeltaTime computed by
+     * a grid whose stencils have limits of their own.
+     */
+    static StepSchedule splitInterval(float interval, float maxDeltaTime, int maxSubsteps);
+    static StepSchedule splitBandInterval(float interval, float maxDeltaTime);
+
+    /**
+     * @brief Packs the first four k bands of a table into a vec4, the layout used by the shaders.
+     */
+    static glm::vec4 pack(const std::vector<float> &table);
+
+    const std::vector<float> &angularFrequencies() const { return m_angularFrequencies; }
+    const std::vector<float> &advectionSpeeds() const { return m_advectionSpeeds; }
+    const std::vector<float> &dispersionSpeeds() const { return m_dispersionSpeeds; }
+    const std::vector<float> &spatialDiffusions() const { return m_spatialDiffusions; }
+    const std::vector<float> &angularDiffusions() const { return m_angularDiffusions; }
+    const std::vector<float> &viscosityRates() const { return m_viscosityRates; }
+    const std::vector<float> &thetas() const { return m_thetas; }
+
+private:
+    Setting m_setting;
+    glm::uvec4 m_resolution;
+    std::vector<float> m_spatialResolutions;
+
+    std::vector<float> m_wavenumbers;
+    std::vector<float> m_angularFrequencies;
+    std::vector<float> m_advectionSpeeds;
+    std::vector<float> m_dispersionSpeeds;
+    std::vector<float> m_spatialDiffusions;
+    std::vector<float> m_angularDiffusions;
+    std::vector<float> m_viscosityRates;
+
+    std::vector<float> m_thetas;
+    std::vector<glm::vec2> m_waveDirections;
+    std::vector<glm::vec2> m_groupVelocities;
+    std::vector<float> m_ambientAmplitudes;
+};
@@ -0,0 +1,190 @@
+#include "distributedgrid.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+DistributedGrid::DistributedGrid(Transport &transport, glm::vec4 minParam, glm::vec4 maxParam, glm::uvec4 resolution,
+        Setting setting, float maxDeltaTime)
+    : m_transport(transport), m_resolution(resolution)
+{
+    // a grid over no rows holds no amplitudes, but it knows how far a step reaches and how
+    // the bands of a strip have to line up
+    m_grid = std::make_unique<WaveletGrid>(minParam, maxParam, resolution, setting,
+            Subdomain{glm::uvec2(0), glm::uvec2(resolution[Parameter::X], 0)});
+    m_maxDeltaTime = maxDeltaTime > 0 ? maxDeltaTime : m_grid->maxStableTimeStep();
+    m_ghostRows = m_grid->haloRows(m_maxDeltaTime);
+    const unsigned int alignment = m_grid->subdomainAlignment().y;
+
+    // the same number of aligned blocks of rows for every rank, give or take one
+    const unsigned int ranks = transport.size();
+    const unsigned int rows = resolution[Parameter::Y];
+    const unsigned int blocks = (rows + alignment - 1) / alignment;
+    for (unsigned int rank = 0; rank <= ranks; rank++)
+        m_owned.push_back(std::min(rows, (unsigned int) ((size_t) blocks * rank / ranks) * alignment));
+
+    // the ghost rows of a rank have to come from its neighbours alone
+    for (unsigned int rank = 0; rank < ranks; rank++)
+        if (m_owned[rank + 1] - m_owned[rank] < (ranks > 1 ? m_ghostRows : 1))
+            throw std::runtime_error("DistributedGrid: " + std::to_string(rows) + " rows are too few for " +
+                    std::to_string(ranks) + " ranks with " + std::to_string(m_ghostRows) + " ghost rows each");
+
+    m_localBegin = ownedBegin() - std::min(ownedBegin(), m_ghostRows);
+    m_localEnd = std::min(rows, ownedEnd() + m_ghostRows);
+    m_grid->setSubdomain(Subdomain{glm::uvec2(0, m_localBegin),
+            glm::uvec2(resolution[Parameter::X], m_localEnd - m_localBegin)});
+}
+
+void DistributedGrid::takeStep(float dt){
+    if (dt > m_maxDeltaTime)
+        throw std::runtime_error("DistributedGrid: a step of " + std::to_string(dt) + " is longer than the " +
+                std::to_string(m_maxDeltaTime) + " the ghost rows were sized for");
+    exchangeGhostRows();
+    m_grid->takeStep(dt);
+}
+
+StepSchedule DistributedGrid::advance(float interval){
+    StepSchedule schedule = m_grid->stepSchedule(interval);
+    if (schedule.deltaTime > m_maxDeltaTime) {
+        // the ghost rows are narrower than a stable step needs
+        schedule.substeps = std::ceil(interval / m_maxDeltaTime);
+        schedule.deltaTime = std::min(interval / schedule.substeps, m_maxDeltaTime);
+    }
+    for (int i = 0; i < schedule.substeps; i++)
+        takeStep(schedule.deltaTime);
+    return schedule;
+}
+
+void DistributedGrid::setActiveRegion(std::shared_ptr<const ActiveRegion> region){
+    assert(region->getResolution() == glm::uvec2(m_resolution[Parameter::X], m_resolution[Parameter::Y]));
+    m_grid->setActiveRegion(std::make_shared<const ActiveRegion>(region->cropped(glm::uvec2(0, m_localBegin),
+            glm::uvec2(m_resolution[Parameter::X], m_localEnd))));
+}
+
+void DistributedGrid::setReflectionTable(std::shared_ptr<const ReflectionTable> table){
+    if (!table) {
+        m_grid->setReflectionTable(nullptr);
+        return;
+    }
+    assert(table->getResolution() == glm::uvec2(m_resolution[Parameter::X], m_resolution[Parameter::Y]));
+    m_grid->setReflectionTable(std::make_shared<const ReflectionTable>(table->cropped(glm::uvec2(0, m_localBegin),
+            glm::uvec2(m_resolution[Parameter::X], m_localEnd))));
+}
+
+glm::uvec2 DistributedGrid::getBandResolution(unsigned int i_k) const {
+    return glm::uvec2(m_resolution[Parameter::X], m_resolution[Parameter::Y]) / m_grid->getBandDownsampling(i_k);
+}
+
+void DistributedGrid::writeBandRows(unsigned int i_k, unsigned int begin, unsigned int end, const float *in){
+    const unsigned int downsampling = m_grid->getBandDownsampling(i_k);
+    const unsigned int resolutionX = getBandResolution(i_k).x;
+    const unsigned int resolutionTheta = m_resolution[Parameter::THETA];
+    const unsigned int localBegin = m_localBegin / downsampling;
+    const unsigned int overlapBegin = std::max(begin, localBegin);
+    const unsigned int overlapEnd = std::min(end, m_localEnd / downsampling);
+    if (overlapBegin >= overlapEnd) return;
+
+    const unsigned int overlapRows = overlapEnd - overlapBegin;
+    std::vector<float> rows((size_t) resolutionTheta * overlapRows * resolutionX);
+    for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++) {
+        const float *source = in + ((size_t) i_theta * (end - begin) + (overlapBegin - begin)) * resolutionX;
+        std::copy(source, source + (size_t) overlapRows * resolutionX,
+                rows.data() + (size_t) i_theta * overlapRows * resolutionX);
+    }
+    m_grid->writeBandRows(i_k, overlapBegin - localBegin, overlapEnd - localBegin, rows.data());
+}
+
+void DistributedGrid::gather(unsigned int i_k, float *out, int root){
+    const unsigned int downsampling = m_grid->getBandDownsampling(i_k);
+    const glm::uvec2 resolution = getBandResolution(i_k);
+    const unsigned int resolutionTheta = m_resolution[Parameter::THETA];
+    const unsigned int localBegin = m_localBegin / downsampling;
+    const int rank = m_transport.rank();
+
+    std::vector<float> rows;
+    if (rank != root) {
+        const unsigned int begin = ownedBegin() / downsampling, end = ownedEnd() / downsampling;
+        rows.resize((size_t) resolutionTheta * (end - begin) * resolution.x);
+        m_grid->readBandRows(i_k, begin - localBegin, end - localBegin, rows.data());
+        m_transport.send(root, rows.data(), rows.size() * sizeof(float));
+        return;
+    }
+
+    for (int source = 0; source < m_transport.size(); source++) {
+        const unsigned int begin = m_owned[source] / downsampling, end = m_owned[source + 1] / downsampling;
+        const size_t thetaSize = (size_t) (end - begin) * resolution.x;
+        rows.resize(resolutionTheta * thetaSize);
+        if (source == rank) m_grid->readBandRows(i_k, begin - localBegin, end - localBegin, rows.data());
+        else m_transport.receive(source, rows.data(), rows.size() * sizeof(float));
+
+        for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++)
+            std::copy(rows.data() + i_theta * thetaSize, rows.data() + (i_theta + 1) * thetaSize,
+                    out + ((size_t) i_theta * resolution.y + begin) * resolution.x);
+    }
+}
+
+void DistributedGrid::exchangeGhostRows(){
+    const auto start = std::chrono::steady_clock::now();
+    const int rank = m_transport.rank();
+
+    // even ranks exchange with the rank after them first and odd ranks with the one before,
+    // then the other way around, so that both sides of every exchange come at the same time
+    for (int phase = 0; phase < 2; phase++) {
+        const bool next = (rank % 2 == 0) == (phase == 0);
+        const int peer = next ? rank + 1 : rank - 1;
+        if (peer < 0 || peer >= m_transport.size()) continue;
+
+        unsigned int receiveBegin, receiveEnd;
+        if (next) {
+            packRows(ownedEnd() - m_ghostRows, ownedEnd(), m_sendBuffer);
+            receiveBegin = ownedEnd();
+            receiveEnd = m_localEnd;
+        } else {
+            packRows(ownedBegin(), ownedBegin() + m_ghostRows, m_sendBuffer);
+            receiveBegin = m_localBegin;
+            receiveEnd = ownedBegin();
+        }
+        m_receiveBuffer.resize(packedSize(receiveBegin, receiveEnd));
+        m_transport.exchange(peer, m_sendBuffer.data(), m_sendBuffer.size() * sizeof(float),
+                m_receiveBuffer.data(), m_receiveBuffer.size() * sizeof(float));
+        unpackRows(receiveBegin, receiveEnd, m_receiveBuffer);
+    }
+
+    m_exchangeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+size_t DistributedGrid::packedSize(unsigned int begin, unsigned int end) const {
+    size_t size = 0;
+    for (unsigned int i_k = 0; i_k < m_resolution[Parameter::K]; i_k++) {
+        const unsigned int downsampling = m_grid->getBandDownsampling(i_k);
+        size += (size_t) m_resolution[Parameter::THETA] * ((end - begin) / downsampling) * getBandResolution(i_k).x;
+    }
+    return size;
+}
+
+void DistributedGrid::packRows(unsigned int begin, unsigned int end, std::vector<float> &out) const {
+    out.resize(packedSize(begin, end));
+    float *band = out.data();
+    for (unsigned int i_k = 0; i_k < m_resolution[Parameter::K]; i_k++) {
+        // every edge of a strip is a multiple of the downsampling of every band
+        const unsigned int downsampling = m_grid->getBandDownsampling(i_k);
+        const unsigned int bandBegin = (begin - m_localBegin) / downsampling;
+        const unsigned int bandEnd = (end - m_localBegin) / downsampling;
+        m_grid->readBandRows(i_k, bandBegin, bandEnd, band);
+        band += (size_t) m_resolution[Parameter::THETA] * (bandEnd - bandBegin) * getBandResolution(i_k).x;
+    }
+}
+
+void DistributedGrid::unpackRows(unsigned int begin, unsigned int end, const std::vector<float> &in){
+    const float *band = in.data();
+    for (unsigned int i_k = 0; i_k < m_resolution[Parameter::K]; i_k++) {
+        const unsigned int downsampling = m_grid->getBandDownsampling(i_k);
+        const unsigned int bandBegin = (begin - m_localBegin) / downsampling;
+        const unsigned int bandEnd = (end - m_localBegin) / downsampling;
+        m_grid->writeBandRows(i_k, bandBegin, bandEnd, band);
+        band += (size_t) m_resolution[Parameter::THETA] * (bandEnd - bandBegin) * getBandResolution(i_k).x;
+    }
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "transport.h"
+#include "waveletgrid.h"
+
+#include <memory>
+#include <vector>
+
+/**
+ * @brief A WaveletGrid split along y into strips, one per rank of a Transport, for domains that
+ * don't fit in the memory of one machine.
+ *
+ * Every rank owns a strip of rows and simulates it with a WaveletGrid over the strip and
+ * haloRows ghost rows on either side. Before each step the ranks send the owned rows next to
+ * their edges to their neighbours, for all the (theta,k) bands, which overwrite their ghost
+ * rows with them. The ghost rows are wide enough for everything a step computes in the owned
+ * rows to only depend on rows that hold the amplitudes of the whole grid, so the owned rows
+ * end up exactly as a single WaveletGrid over the whole domain would compute them.
+ *
+ * Every rank has to make the same calls in the same order, they all talk to their neighbours.
+ */
+class DistributedGrid {
+public:
+    /**
+     * @brief Splits the grid described by minParam, maxParam and resolution over the ranks of
+     * transport, which must outlive the grid.
+     *
+     * @param maxDeltaTime the longest step the ghost rows are sized for, 0 for the stable one.
+     */
+    DistributedGrid(Transport &transport, glm::vec4 minParam, glm::vec4 maxParam, glm::uvec4 resolution,
+            Setting setting = Setting(), float maxDeltaTime = 0);
+
+    /**
+     * @brief Exchanges the ghost rows, then takes a step of dt, which can't be longer than the
+     * maxDeltaTime the grid was built for.
+     */
+    void takeStep(float dt);
+
+    /**
+     * @brief Advances the simulation by interval in substeps of the same length for every band,
+     * each one a takeStep. Unlike WaveletGrid::advance the bands don't take their own number of
+     * substeps, since every substep needs the ghost rows of its band to be up to date.
+     */
+    StepSchedule advance(float interval);
+
+    /**
+     * @brief Restricts every rank to the part of region, which covers the whole grid, it
+     * simulates. See WaveletGrid::setActiveRegion.
+     */
+    void setActiveRegion(std::shared_ptr<const ActiveRegion> region);
+
+    /**
+     * @brief Gives every rank the part of table, which covers the whole grid, it simulates. See
+     * WaveletGrid::setReflectionTable. Reflection doesn't move amplitudes between cells, so the
+     * ghost rows stay as wide as they are.
+     */
+    void setReflectionTable(std::shared_ptr<const ReflectionTable> table);
+
+    /**
+     * @brief The x,y resolution of band i_k over the whole grid.
+     */
+    glm::uvec2 getBandResolution(unsigned int i_k) const;
+
+    /**
+     * @brief Writes the rows [begin, end) of band i_k of the whole grid, indexed by
+     * [theta][y - begin][x] as in WaveletGrid::writeBandRows. Every rank takes the rows it
+     * simulates, ghost rows included, and ignores the rest.
+     */
+    void writeBandRows(unsigned int i_k, unsigned int begin, unsigned int end, const float *in);
+
+    /**
+     * @brief Collects band i_k of the whole grid on rank root, into out indexed by [theta][y][x].
+     * out is only written on root and can be null elsewhere.
+     */
+    void gather(unsigned int i_k, float *out, int root = 0);
+
+    /**
+     * @brief The full resolution rows [begin, end) this rank owns.
+     */
+    unsigned int ownedBegin() const { return m_owned[m_transport.rank()]; }
+    unsigned int ownedEnd() const { return m_owned[m_transport.rank() + 1]; }
+    unsigned int ghostRows() const { return m_ghostRows; }
+
+    /**
+     * @brief The grid of this rank. Its storage, layout, scheduler and threads can be changed
+     * freely, anything that changes the amplitudes has to be done on every rank.
+     */
+    WaveletGrid &localGrid() { return *m_grid; }
+    const WaveletGrid &localGrid() const { return *m_grid; }
+
+    /**
+     * @brief Time spent in exchangeGhostRows since the grid was built.
+     */
+    double exchangeSeconds() const { return m_exchangeSeconds; }
+
+private:
+    /**
+     * @brief Sends the owned rows next to the edges of this rank to its neighbours and
+     * replaces the ghost rows with theirs.
+     */
+    void exchangeGhostRows();
+
+    /**
+     * @brief Packs the full resolution rows [begin, end) of every band into out, or unpacks
+     * them from in. The rows are in cells of the whole grid and must be simulated here.
+     */
+    void packRows(unsigned int begin, unsigned int end, std::vector<float> &out) const;
+    void unpackRows(unsigned int begin, unsigned int end, const std::vector<float> &in);
+    size_t packedSize(unsigned int begin, unsigned int end) const;
+
+    Transport &m_transport;
+    std::unique_ptr<WaveletGrid> m_grid;
+    glm::uvec4 m_resolution;
+    float m_maxDeltaTime;
+    unsigned int m_ghostRows;
+    // rank r owns the rows [m_owned[r], m_owned[r + 1])
+    std::vector<unsigned int> m_owned;
+    // the rows the local grid simulates, ghost rows included
+    unsigned int m_localBegin, m_localEnd;
+
+    std::vector<float> m_sendBuffer, m_receiveBuffer;
+    double m_exchangeSeconds = 0;
+};
@@ -1,10 +1,12 @@
 #pragma once
 
-#include "External/stb/stb_image.h"
 #include "GLWrapper/texture.h"
 #include "glm/glm.hpp"
 #include "glm/vec2.hpp"
+#include "wavelet/activeregion.h"
+#include "wavelet/reflectiontable.h"
 #include "wavelet/setting.h"
+#include "wavelet/terrain.h"
 #include <glad/glad.h>
 #include <iostream>
 #include <vector>
@@ -28,27 +30,38 @@ public:
     // slope
     glm::vec2 levelSetGradient(glm::vec2 pos) const;
 
+    /**
+     * @brief The cells of a simulation grid covering the heightmap that are below the water height.
+     */
+    ActiveRegion activeRegion(glm::uvec2 resolution, unsigned int tileSize = 32) const;
+
+    /**
+     * @brief The shoreline cells of a simulation grid covering the heightmap and where they
+     * reflect each of the directions thetas to. The geometry never changes, so this is built
+     * once instead of in every step.
+     */
+    ReflectionTable reflectionTable(glm::uvec2 resolution, const std::vector<float> &thetas) const;
+
     void draw(glm::mat4 projection, glm::mat4 view);
 
     void visualize(glm::ivec2 viewport);
 
+    /**
+     * @brief The heightmap and the maps derived from it, which the textures hold as well.
+     */
+    std::shared_ptr<const Terrain> getTerrain() const { return terrain; }
+
     float waterHeight; // where we should simulate water
     // get private set please
     std::shared_ptr<Texture> heightMap, boundaryMap, gradientMap;
 private:
     int toVisualize = 0;
     int vaoSize;
-    int width, height;
     GLuint terrainShader;
     GLuint visualizationShader;
     GLuint vao, vbo;
 
-    std::vector<float> heights; // we load both in cpu
-    std::vector<glm::ivec2> closestOnBoundary;
-    std::vector<glm::vec3> heightWithSampleLocationInDomain;
-    std::vector<float> closeToBoundary; // in domain map in case needed
-    std::vector<glm::vec2> gradients;
-    std::vector<float> gradientTheta;
+    std::shared_ptr<const Terrain> terrain; // we load it in cpu as well
 
     void getObjData(std::string filename);
 };
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include "storage.h"
+
+/**
+ * Monotone cubic interpolation kernels, see https://dl.acm.org/doi/pdf/10.1145/383259.383260
+ *
+ * Everything here is a template or inline so that the sample lookups inline into the caller,
+ * which matters since these sit in the innermost loop of the advection.
+ */
+namespace Math {
+
+    /**
+     * @brief Monotone cubic through v1 and v2, using v0 and v3 for the slopes.
+     *
+     * @param s the fractional position between v1 (s = 0) and v2 (s = 1).
+     */
+    inline float monotoneCubic(float v0, float v1, float v2, float v3, float s) {
+        float dk = (v2 - v0) / 2;
+        float dkp1 = (v3 - v1) / 2;
+        float deltaK = v2 - v1;
+
+        // if delta is 0 or the signed bit of dk, dkp1, and deltaK differs
+        // this is used to force monotonicity of f(t) on the interval [tk, tk+1]
+        // so that the interpolation is more stable and is less prone to overshooting
+        bool signedBitDK = std::signbit(dk);
+        bool monotone = deltaK != 0 && std::signbit(dkp1) == signedBitDK && std::signbit(deltaK) == signedBitDK;
+        dk = monotone ? dk : 0;
+        dkp1 = monotone ? dkp1 : 0;
+        deltaK = monotone ? deltaK : 0;
+
+        float a1 = dk;
+        float a2 = 3 * deltaK - 2 * dk - dkp1;
+        float a3 = dk + dkp1 - 2 * deltaK;
+
+        return ((a3 * s + a2) * s + a1) * s + v1;
+    }
+
+    /**
+     * @brief The monotone cubic of the gpu simulation step, see guaranteeMonotonicInterpolate in
+     * Shaders/waveletgrid_simulationStep.frag. Instead of flattening every non monotone segment
+     * it only zeroes the slopes at sign changes, limits them to three times the secants and
+     * clamps the result to [v1, v2].
+     */
+    inline float limitedMonotoneCubic(float v0, float v1, float v2, float v3, float s) {
+        float sMinus1 = v1 - v0;
+        float s0 = v2 - v1;
+        float s1 = v3 - v2;
+
+        // central differences
+        float m0 = (sMinus1 + s0) * 0.5f;
+        float m1 = (s0 + s1) * 0.5f;
+
+        if (std::abs(v1 - v2) < 0.0001f) {
+            m0 = 0;
+            m1 = 0;
+        } else {
+            if (std::abs(v0 - v1) < 0.0001f || (sMinus1 < 0 && s0 >= 0) || (sMinus1 > 0 && s0 <= 0))
+                m0 = 0;
+            else
+                m0 *= std::min(std::min(3 * sMinus1 / m0, 3 * s0 / m0), 1.0f);
+
+            if (std::abs(v2 - v3) < 0.0001f || (s0 < 0 && s1 >= 0) || (s0 > 0 && s1 <= 0))
+                m1 = 0;
+            else
+                m1 *= std::min(std::min(3 * s0 / m1, 3 * s1 / m1), 1.0f);
+        }
+
+        float result = ((((m0 + m1 - 2 * s0) * s) + (3 * s0 - 2 * m0 - m1)) * s + m0) * s + v1;
+        // the curve is monotone, but rounding can still leave [v1, v2]
+        return std::clamp(result, std::min(v1, v2), std::max(v1, v2));
+    }
+
+    /**
+     * @brief Interpolate a function defined on integer coordinates using monotone cubic interpolation.
+     *
+     * @param t the coordinate of the function to evaluate.
+     * @param f callable as f(int) -> float.
+     * @return interpolated f(t).
+     */
+    template <class F>
+    inline float interpolate(float t, F &&f) {
+        float floorT = std::floor(t);
+        int tk = floorT;
+        // if t lies on an integral point
+        if (t == floorT) return f(tk);
+
+        // cache these values to prevent calling f too many times, in case it's expensive
+        return monotoneCubic(f(tk - 1), f(tk), f(tk + 1), f(tk + 2), t - floorT);
+    }
+
+    /**
+     * @brief Interpolate a function defined on 2D integer coordinates, x first then y.
+     *
+     * @param f callable as f(int, int) -> float. It is called at most 16 times.
+     */
+    template <class F>
+    inline float interpolate2D(float x, float y, F &&f) {
+        return interpolate(x, [&](int i_x) -> float {
+            return interpolate(y, [&](int i_y) -> float { return f(i_x, i_y); });
+        });
+    }
+
+    /**
+     * @brief Interpolate a strided array along Dims dimensions, the first dimension outermost.
+     *
+     * @param data the sample at integer coordinate 0 in every dimension, in any of the Storage
+     * element types. The samples are converted to fp32 as they are read.
+     * @param strides the distance between consecutive samples in every dimension.
+     * @param t the coordinates to evaluate. Every sample within [floor(t) - 1, floor(t) + 2] must be
+     * readable, there are no bounds checks.
+     */
+    template <int Dims, class T>
+    inline float interpolateStrided(const T *data, const std::ptrdiff_t *strides, const float *t) {
+        if constexpr (Dims == 0) {
+            return Storage::toFloat(*data);
+        } else {
+            return interpolate(t[0], [&](int i) -> float {
+                return interpolateStrided<Dims - 1>(data + i * strides[0], strides + 1, t + 1);
+            });
+        }
+    }
+
+    inline float interpolate(const float *data, std::ptrdiff_t stride, float t) {
+        return interpolateStrided<1>(data, &stride, &t);
+    }
+
+    template <class T>
+    inline float interpolate2D(const T *data, std::ptrdiff_t strideX, std::ptrdiff_t strideY, float x, float y) {
+        const std::ptrdiff_t strides[2] = {strideX, strideY};
+        const float t[2] = {x, y};
+        return interpolateStrided<2>(data, strides, t);
+    }
+
+    inline float interpolate4D(const float *data, const std::ptrdiff_t strides[4], const float t[4]) {
+        return interpolateStrided<4>(data, strides, t);
+    }
+
+    /**
+     * @brief Batched interpolate2D over a strided array: out[i] = interpolate2D(data, ..., x[i], y[i]).
+     *
+     * The samples are independent and the kernel has no data dependent branches besides the
+     * integral fast path, so the loop is friendly to the vectorizer. Unlike the single sample
+     * version, the full 4x4 neighbourhood of every sample must be readable.
+     */
+    inline void interpolate2D(const float *data, std::ptrdiff_t strideX, std::ptrdiff_t strideY,
+            const float *x, const float *y, float *out, std::size_t n) {
+        for (std::size_t i = 0; i < n; i++) {
+            float floorX = std::floor(x[i]);
+            float floorY = std::floor(y[i]);
+            float sx = x[i] - floorX;
+            float sy = y[i] - floorY;
+            const float *origin = data + (std::ptrdiff_t) floorX * strideX + (std::ptrdiff_t) floorY * strideY;
+
+            float column[4];
+            for (int ix = 0; ix < 4; ix++) {
+                const float *p = origin + (ix - 1) * strideX;
+                column[ix] = sy == 0 ? p[0] : monotoneCubic(p[-strideY], p[0], p[strideY], p[2 * strideY], sy);
+            }
+            out[i] = sx == 0 ? column[1] : monotoneCubic(column[0], column[1], column[2], column[3], sx);
+        }
+    }
+}
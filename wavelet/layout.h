@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <glm/vec2.hpp>
+
+/**
+ * Memory layouts of one k band of an Amplitude, which has its own x,y resolution and all the
+ * thetas. Amplitude picks a policy at runtime and instantiates its index math once per policy
+ * through dispatch, the same way it handles Storage types.
+ *
+ * A policy provides
+ *  - size: the number of samples a band occupies, padding included.
+ *  - index: the position of sample (x, y, theta) within the band.
+ *  - runEnd: the end of the run of samples starting at x that are contiguous in memory and
+ *    in increasing x, clamped to end. Row helpers copy whole runs at a time.
+ *  - forEachRowSpan: calls f(index, count) for the contiguous spans that together hold the rows
+ *    [begin, end) of every theta, padding included.
+ */
+namespace Layout {
+
+    enum class Type {
+        // x fastest, then y, then theta. Every x row is contiguous
+        XMajor = 0,
+        // blocks of blockSize x cells, with all the thetas of a block next to each other
+        ThetaBlocked = 1,
+        // tiles of tileSize x tileSize cells in Z order, the tiles row by row, then theta
+        Morton = 2,
+    };
+
+    struct XMajor {
+        static std::size_t size(glm::uvec2 resolution, unsigned int thetaResolution) {
+            return (std::size_t) resolution.x * resolution.y * thetaResolution;
+        }
+
+        static std::size_t index(unsigned int x, unsigned int y, unsigned int theta, glm::uvec2 resolution,
+                unsigned int /* thetaResolution */) {
+            return x + (std::size_t) y * resolution.x + (std::size_t) theta * resolution.x * resolution.y;
+        }
+
+        static unsigned int runEnd(unsigned int /* x */, unsigned int end) { return end; }
+
+        template <class F>
+        static void forEachRowSpan(unsigned int begin, unsigned int end, glm::uvec2 resolution,
+                unsigned int thetaResolution, F &&f) {
+            for (unsigned int theta = 0; theta < thetaResolution; theta++)
+                f(index(0, begin, theta, resolution, thetaResolution), (std::size_t) (end - begin) * resolution.x);
+        }
+    };
+
+    /**
+     * @brief Array of structures of arrays: [y][x / blockSize][theta][x % blockSize]. The theta
+     * neighbours of a cell are blockSize samples apart instead of a whole band slice, and a
+     * block of every theta fits in a few cache lines.
+     */
+    struct ThetaBlocked {
+        static constexpr unsigned int blockSize = 8;
+
+        static unsigned int blocks(unsigned int resolutionX) { return (resolutionX + blockSize - 1) / blockSize; }
+
+        static std::size_t size(glm::uvec2 resolution, unsigned int thetaResolution) {
+            return (std::size_t) blocks(resolution.x) * blockSize * resolution.y * thetaResolution;
+        }
+
+        static std::size_t index(unsigned int x, unsigned int y, unsigned int theta, glm::uvec2 resolution,
+                unsigned int thetaResolution) {
+            return (((std::size_t) y * blocks(resolution.x) + x / blockSize) * thetaResolution + theta) * blockSize +
+                x % blockSize;
+        }
+
+        static unsigned int runEnd(unsigned int x, unsigned int end) {
+            return std::min(end, (x / blockSize + 1) * blockSize);
+        }
+
+        template <class F>
+        static void forEachRowSpan(unsigned int begin, unsigned int end, glm::uvec2 resolution,
+                unsigned int thetaResolution, F &&f) {
+            f(index(0, begin, 0, resolution, thetaResolution),
+                    (std::size_t) (end - begin) * blocks(resolution.x) * blockSize * thetaResolution);
+        }
+    };
+
+    /**
+     * @brief Z order curve within square tiles: [theta][y / tileSize][x / tileSize][morton(x, y)].
+     * The cells around a point lie close together whichever way it moves, so a semi-Lagrangian
+     * lookup that travels along y touches as few cache lines and pages as one along x. The
+     * tiles keep the padding of the power of two curve to less than a tile per row and column.
+     */
+    struct Morton {
+        static constexpr unsigned int tileBits = 4;
+        static constexpr unsigned int tileSize = 1u << tileBits;
+        static constexpr unsigned int tileCells = tileSize * tileSize;
+        // the bits of a code that hold x and y
+        static constexpr std::uint32_t xBits = 0x55555555u & (tileCells - 1);
+        static constexpr std::uint32_t yBits = 0xaaaaaaaau & (tileCells - 1);
+
+        // the bits of v spread to the even bits
+        static constexpr std::uint32_t spread(std::uint32_t v) {
+            v &= 0xffff;
+            v = (v | (v << 8)) & 0x00ff00ff;
+            v = (v | (v << 4)) & 0x0f0f0f0f;
+            v = (v | (v << 2)) & 0x33333333;
+            v = (v | (v << 1)) & 0x55555555;
+            return v;
+        }
+
+        // the even bits of v packed together, the inverse of spread
+        static constexpr std::uint32_t compact(std::uint32_t v) {
+            v &= 0x55555555;
+            v = (v | (v >> 1)) & 0x33333333;
+            v = (v | (v >> 2)) & 0x0f0f0f0f;
+            v = (v | (v >> 4)) & 0x00ff00ff;
+            v = (v | (v >> 8)) & 0x0000ffff;
+            return v;
+        }
+
+        /**
+         * @brief The morton code of (x, y), x in the even bits. x and y must be below 2^16.
+         */
+        static constexpr std::uint32_t encode(unsigned int x, unsigned int y) { return spread(x) | spread(y) << 1; }
+        static constexpr glm::uvec2 decode(std::uint32_t code) { return { compact(code), compact(code >> 1) }; }
+
+        static unsigned int tiles(unsigned int resolution) { return (resolution + tileSize - 1) >> tileBits; }
+
+        // the samples of one theta, the last row and column of tiles padded
+        static std::size_t sliceSize(glm::uvec2 resolution) {
+            return (std::size_t) tiles(resolution.x) * tiles(resolution.y) * tileCells;
+        }
+
+        static std::size_t size(glm::uvec2 resolution, unsigned int thetaResolution) {
+            return sliceSize(resolution) * thetaResolution;
+        }
+
+        /**
+         * @brief The parts of index that depend on x and on y alone, index being
+         * theta * sliceSize + xOffset(x) + yOffset(y). The 4x4 taps of an interpolation need
+         * 4 of each rather than 16 codes.
+         */
+        static std::size_t xOffset(unsigned int x) {
+            return (std::size_t) (x >> tileBits) * tileCells + spread(x & (tileSize - 1));
+        }
+        static std::size_t yOffset(unsigned int y, glm::uvec2 resolution) {
+            return (std::size_t) (y >> tileBits) * tiles(resolution.x) * tileCells + (spread(y & (tileSize - 1)) << 1);
+        }
+
+        static std::size_t index(unsigned int x, unsigned int y, unsigned int theta, glm::uvec2 resolution,
+                unsigned int /* thetaResolution */) {
+            return (std::size_t) theta * sliceSize(resolution) + xOffset(x) + yOffset(y, resolution);
+        }
+
+        // x and x + 1 are neighbours for even x
+        static unsigned int runEnd(unsigned int x, unsigned int end) { return std::min(end, (x | 1) + 1); }
+
+        /**
+         * @brief Walks a row in increasing x. The x bits of the code are incremented in place,
+         * the carry skipping over the y bits, and a wrap to x = 0 moves on to the next tile.
+         */
+        class RowIterator {
+        public:
+            // at index, the sample of the padded band at (x, y)
+            RowIterator(std::size_t index, unsigned int x, unsigned int y)
+                : code(encode(x & (tileSize - 1), y & (tileSize - 1))), tile(index - code) {}
+
+            std::size_t operator*() const { return tile + code; }
+
+            RowIterator &operator++() {
+                code = (((code | yBits) + 1) & xBits) | (code & yBits);
+                if (!(code & xBits)) tile += tileCells;
+                return *this;
+            }
+
+        private:
+            std::uint32_t code;
+            std::size_t tile;
+        };
+
+        static RowIterator row(unsigned int x, unsigned int y, unsigned int theta, glm::uvec2 resolution,
+                unsigned int thetaResolution) {
+            return RowIterator(index(x, y, theta, resolution, thetaResolution), x, y);
+        }
+
+        /**
+         * @brief Whole rows of tiles where [begin, end) covers them, pairs of cells elsewhere.
+         * end at the resolution covers the padding of the last row of tiles as well.
+         */
+        template <class F>
+        static void forEachRowSpan(unsigned int begin, unsigned int end, glm::uvec2 resolution,
+                unsigned int thetaResolution, F &&f) {
+            const unsigned int paddedX = tiles(resolution.x) * tileSize;
+            if (end == resolution.y) end = tiles(resolution.y) * tileSize;
+            for (unsigned int theta = 0; theta < thetaResolution; theta++) {
+                for (unsigned int y = begin; y < end;) {
+                    if (y % tileSize == 0 && y + tileSize <= end) {
+                        f(index(0, y, theta, resolution, thetaResolution), (std::size_t) paddedX * tileSize);
+                        y += tileSize;
+                        continue;
+                    }
+                    for (unsigned int x = 0; x < paddedX; x += 2)
+                        f(index(x, y, theta, resolution, thetaResolution), 2);
+                    y++;
+                }
+            }
+        }
+    };
+
+    /**
+     * @brief Calls f with a value of the policy of type.
+     */
+    template <class F>
+    inline decltype(auto) dispatch(Type type, F &&f) {
+        switch (type) {
+            case Type::ThetaBlocked: return f(ThetaBlocked{});
+            case Type::Morton: return f(Morton{});
+            default: return f(XMajor{});
+        }
+    }
+
+    inline const char *name(Type type) {
+        switch (type) {
+            case Type::ThetaBlocked: return "theta blocked";
+            case Type::Morton: return "morton";
+            default: return "x major";
+        }
+    }
+}
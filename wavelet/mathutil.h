@@ -1,26 +1,10 @@
 #pragma once
 
 #include "wavelet/environment.h"
+#include "wavelet/interpolation.h"
 #include <functional>
 
 namespace Math {
-    /**
-     * @brief Interpolate a function defined on integer coordiantes using cubic interpolation.
-     *
-     * @param t the coordinate of the function to evaluate.
-     * @param f the function to evaluate.
-     * @return interpolated f(t).
-     */
-    float interpolate(float t, std::function<float(int)> f);
-    /**
-     * @brief Interpolate a function defined on integer coordiantes using cubic interpolation.
-     *
-     * @param t the coordinate of the function to evaluate.
-     * @param f the function to evaluate.
-     * @return interpolated f(t).
-     */
-    float interpolate2D(float x, float y, std::function<float(int, int)> f);
-
     /**
      * @brief Interpolate a function defined over a 4D integer coordinate grid.
      *
@@ -0,0 +1,78 @@
+#include "memory.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace {
+    std::atomic<Memory::HugePages> hugePages{Memory::HugePages::Transparent};
+
+    // in the cache line in front of every block
+    struct Header {
+        std::size_t mapped; // the bytes mmap'd for the block, 0 if it came from aligned_alloc
+    };
+
+    void *place(void *base, std::size_t mapped) {
+        static_cast<Header *>(base)->mapped = mapped;
+        return static_cast<char *>(base) + Memory::cacheLine;
+    }
+}
+
+void Memory::setHugePages(HugePages pages){
+    hugePages = pages;
+}
+
+Memory::HugePages Memory::getHugePages(){
+    return hugePages;
+}
+
+void *Memory::allocate(std::size_t bytes){
+    const std::size_t total = bytes + cacheLine;
+    const bool large = total >= hugePageSize;
+    const HugePages pages = large ? getHugePages() : HugePages::None;
+
+#ifdef __linux__
+    if (large) {
+        const std::size_t mapped = (total + hugePageSize - 1) / hugePageSize * hugePageSize;
+        if (pages == HugePages::Explicit) {
+            void *base = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (base != MAP_FAILED) return place(base, mapped);
+        }
+
+        // a fresh mapping rather than memory the heap may have handed out and touched before,
+        // over allocated by a huge page and trimmed so that it starts on one
+        void *reserved = mmap(nullptr, mapped + hugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (reserved == MAP_FAILED) throw std::bad_alloc();
+        char *begin = static_cast<char *>(reserved);
+        char *base = begin + (hugePageSize - reinterpret_cast<std::uintptr_t>(begin) % hugePageSize) % hugePageSize;
+        if (base > begin) munmap(begin, base - begin);
+        munmap(base + mapped, begin + hugePageSize - base);
+        // only advice, the block works the same if the kernel has no huge page to spare
+        if (pages != HugePages::None) madvise(base, mapped, MADV_HUGEPAGE);
+        return place(base, mapped);
+    }
+#endif
+
+    // huge pages are only used for whole, aligned huge pages of a block
+    const std::size_t alignment = pages == HugePages::None ? cacheLine : hugePageSize;
+    const std::size_t rounded = (total + alignment - 1) / alignment * alignment;
+    void *base = std::aligned_alloc(alignment, rounded);
+    if (!base) throw std::bad_alloc();
+    return place(base, 0);
+}
+
+void Memory::deallocate(void *block){
+    if (!block) return;
+    void *base = static_cast<char *>(block) - cacheLine;
+#ifdef __linux__
+    if (const std::size_t mapped = static_cast<Header *>(base)->mapped) {
+        munmap(base, mapped);
+        return;
+    }
+#endif
+    std::free(base);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * Allocation of the large sample arrays. Every block starts on a cache line, and blocks of at
+ * least a huge page can be backed by huge pages, so that a sweep over a grid of several
+ * gigabytes needs a few thousand TLB entries instead of a million.
+ *
+ * Blocks of at least a huge page are fresh anonymous mappings, and a Vector doesn't write the
+ * elements resize adds. Nothing touches their pages before the caller does, so on a NUMA system
+ * every page lands on the node of the thread that writes it first.
+ */
+namespace Memory {
+
+    constexpr std::size_t cacheLine = 64;
+    constexpr std::size_t hugePageSize = 2 << 20;
+
+    enum class HugePages {
+        // regular pages only
+        None = 0,
+        // ask the kernel to back the block with transparent huge pages, madvise(MADV_HUGEPAGE)
+        Transparent = 1,
+        // map the block from the reserved huge page pool, MAP_HUGETLB. Falls back to
+        // Transparent if the pool has too few pages left
+        Explicit = 2,
+    };
+
+    /**
+     * @brief How the blocks allocated from now on are backed, Transparent by default. Blocks
+     * smaller than a huge page always get regular pages, and systems without huge pages ignore
+     * this.
+     */
+    void setHugePages(HugePages hugePages);
+    HugePages getHugePages();
+
+    /**
+     * @brief bytes aligned to cacheLine, with unspecified contents. Throws std::bad_alloc if
+     * there is not enough memory.
+     */
+    void *allocate(std::size_t bytes);
+    void deallocate(void *block);
+
+    template <class T>
+    struct Allocator {
+        using value_type = T;
+
+        Allocator() = default;
+        template <class U>
+        Allocator(const Allocator<U> &) {}
+
+        T *allocate(std::size_t n) { return static_cast<T *>(Memory::allocate(n * sizeof(T))); }
+        void deallocate(T *block, std::size_t) { Memory::deallocate(block); }
+
+        // default initialization, so that resize leaves the new elements of trivial types unwritten
+        template <class U>
+        void construct(U *element) { ::new ((void *) element) U; }
+        template <class U, class... Args>
+        void construct(U *element, Args &&...args) { ::new ((void *) element) U(std::forward<Args>(args)...); }
+
+        template <class U>
+        bool operator==(const Allocator<U> &) const { return true; }
+        template <class U>
+        bool operator!=(const Allocator<U> &) const { return false; }
+    };
+
+    template <class T>
+    using Vector = std::vector<T, Allocator<T>>;
+}
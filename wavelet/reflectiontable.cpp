@@ -0,0 +1,127 @@
+#include "reflectiontable.h"
+
+#include <algorithm>
+#include <cmath>
+
+ReflectionTable::ReflectionTable(glm::uvec2 resolution, unsigned int thetaResolution)
+    : m_resolution(resolution), m_thetaResolution(thetaResolution)
+{
+    computeRowOffsets();
+}
+
+ReflectionTable::ReflectionTable(const std::vector<float> &heights, const std::vector<glm::vec2> &gradients,
+        int width, int height, float waterHeight, glm::uvec2 resolution, const std::vector<float> &thetas)
+    : m_resolution(resolution), m_thetaResolution(thetas.size())
+{
+    constexpr float tau = 6.28318530718f;
+    const unsigned int thetaResolution = m_thetaResolution;
+    const float thetaSpacing = tau / thetaResolution;
+
+    // nearest texel of the cell center, the same thing the shader samples
+    auto texel = [&](int x, int y) {
+        x = std::clamp<int>(x, 0, resolution.x - 1);
+        y = std::clamp<int>(y, 0, resolution.y - 1);
+        int i = std::min<int>((x + 0.5f) / resolution.x * width, width - 1);
+        int j = std::min<int>((y + 0.5f) / resolution.y * height, height - 1);
+        return i + j * width;
+    };
+
+    std::vector<glm::vec2> directions;
+    for (float theta : thetas)
+        directions.push_back(glm::vec2(std::cos(theta), std::sin(theta)));
+
+    for (unsigned int y = 0; y < resolution.y; y++) {
+        for (unsigned int x = 0; x < resolution.x; x++) {
+            if (heights[texel(x, y)] > waterHeight) continue;
+
+            bool onShoreline = false;
+            for (int dy = -1; dy <= 1; dy++)
+                for (int dx = -1; dx <= 1; dx++)
+                    onShoreline |= heights[texel(x + dx, y + dy)] > waterHeight;
+            // a flat shore has no direction to reflect about
+            glm::vec2 gradient = gradients[texel(x, y)];
+            if (!onShoreline || gradient == glm::vec2(0)) continue;
+            glm::vec2 normal = glm::normalize(gradient);
+
+            for (unsigned int i_theta = 0; i_theta < thetaResolution; i_theta++) {
+                // only the directions running up the slope hit the shore
+                if (glm::dot(directions[i_theta], normal) < 0) continue;
+
+                glm::vec2 reflected = glm::reflect(directions[i_theta], normal);
+                float angle = std::atan2(reflected.y, reflected.x);
+                // in bins, with bin i centered on thetas[i]
+                float bin = (angle - thetas[0]) / thetaSpacing;
+                bin -= std::floor(bin / thetaResolution) * thetaResolution;
+                unsigned int lower = std::min<unsigned int>(bin, thetaResolution - 1);
+                float t = std::clamp(bin - lower, 0.0f, 1.0f);
+
+                Entry entry;
+                entry.cell = glm::uvec2(x, y);
+                entry.theta = i_theta;
+                entry.targets[0] = lower;
+                entry.targets[1] = (lower + 1) % thetaResolution;
+                entry.weights[0] = 1 - t;
+                entry.weights[1] = t;
+                m_entries.push_back(entry);
+            }
+        }
+    }
+    computeRowOffsets();
+}
+
+ReflectionTable ReflectionTable::downsampled(unsigned int factor) const {
+    ReflectionTable table(glm::uvec2(0), m_thetaResolution);
+    table.m_resolution = (m_resolution + factor - 1u) / factor;
+
+    // the first entry of the fine cell each coarse cell of a row takes its entries from
+    std::vector<const Entry *> first(table.m_resolution.x);
+    for (unsigned int y = 0; y < table.m_resolution.y; y++) {
+        std::fill(first.begin(), first.end(), nullptr);
+        for (unsigned int fineY = y * factor; fineY < std::min(m_resolution.y, (y + 1) * factor); fineY++)
+            for (const Entry *entry = entriesBegin(fineY); entry != entriesEnd(fineY); entry++)
+                if (!first[entry->cell.x / factor]) first[entry->cell.x / factor] = entry;
+
+        for (unsigned int x = 0; x < table.m_resolution.x; x++) {
+            if (!first[x]) continue;
+            const glm::uvec2 cell = first[x]->cell;
+            for (const Entry *entry = first[x]; entry != entriesEnd(cell.y) && entry->cell == cell; entry++) {
+                Entry coarse = *entry;
+                coarse.cell = glm::uvec2(x, y);
+                table.m_entries.push_back(coarse);
+            }
+        }
+    }
+    table.computeRowOffsets();
+    return table;
+}
+
+ReflectionTable ReflectionTable::cropped(glm::uvec2 begin, glm::uvec2 end) const {
+    ReflectionTable table(glm::uvec2(0), m_thetaResolution);
+    table.m_resolution = end - begin;
+
+    for (unsigned int y = begin.y; y < end.y; y++) {
+        for (const Entry *entry = entriesBegin(y); entry != entriesEnd(y); entry++) {
+            if (entry->cell.x < begin.x || entry->cell.x >= end.x) continue;
+            Entry cropped = *entry;
+            cropped.cell -= begin;
+            table.m_entries.push_back(cropped);
+        }
+    }
+    table.computeRowOffsets();
+    return table;
+}
+
+size_t ReflectionTable::cells() const {
+    size_t cells = 0;
+    for (size_t i = 0; i < m_entries.size(); i++)
+        if (i == 0 || m_entries[i].cell != m_entries[i - 1].cell) cells++;
+    return cells;
+}
+
+void ReflectionTable::computeRowOffsets() {
+    m_rowOffsets.assign(m_resolution.y + 1, 0);
+    for (const Entry &entry : m_entries)
+        m_rowOffsets[entry.cell.y + 1]++;
+    for (unsigned int y = 0; y < m_resolution.y; y++)
+        m_rowOffsets[y + 1] += m_rowOffsets[y];
+}
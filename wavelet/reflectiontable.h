@@ -0,0 +1,86 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+/**
+ * @brief Where a simulation grid meets the shore, and what happens to the waves that run into it,
+ * precomputed so that a step only has to scatter amplitudes over the shoreline cells.
+ *
+ * A wet cell with a dry cell among its 8 neighbours is on the shoreline. Every direction theta
+ * of such a cell that heads up the slope of the terrain is reflected about the gradient of the
+ * heightmap, and the mirrored direction falls between two theta bins, which share the amplitude
+ * by linear interpolation.
+ *
+ * The entries are sorted by y, then x, then theta, so the entries of a cell and of a row are
+ * contiguous.
+ */
+class ReflectionTable {
+public:
+    struct Entry {
+        glm::uvec2 cell;
+        unsigned int theta;      // the incident direction, its amplitude leaves it
+        unsigned int targets[2]; // the theta bins on either side of the mirrored direction
+        float weights[2];        // the share of the amplitude each target gets, they sum to one
+    };
+
+    /**
+     * @brief A table without a shoreline, nothing is reflected.
+     */
+    ReflectionTable(glm::uvec2 resolution = glm::uvec2(0), unsigned int thetaResolution = 0);
+
+    /**
+     * @brief Builds the table from a heightmap covering the whole grid.
+     *
+     * @param heights the heightmap, indexed by i + j * width.
+     * @param gradients the gradient of the heightmap, indexed the same way.
+     * @param waterHeight cells whose height is at most this are wet.
+     * @param resolution the x,y resolution of the grid. The heightmap is sampled at the nearest
+     * texel, as in ActiveRegion.
+     * @param thetas the direction at the center of every theta bin of the grid, see
+     * DispersionPlan::thetas. They are evenly spaced around the circle, the angular diffusion
+     * wraps around as well.
+     */
+    ReflectionTable(const std::vector<float> &heights, const std::vector<glm::vec2> &gradients, int width, int height,
+            float waterHeight, glm::uvec2 resolution, const std::vector<float> &thetas);
+
+    /**
+     * @brief The same table on a grid that is factor times coarser. A coarse cell takes the entries
+     * of the first shoreline cell it covers, in row major order.
+     */
+    ReflectionTable downsampled(unsigned int factor) const;
+
+    /**
+     * @brief The entries of the cells [begin, end), as a table of their own.
+     */
+    ReflectionTable cropped(glm::uvec2 begin, glm::uvec2 end) const;
+
+    glm::uvec2 getResolution() const { return m_resolution; }
+    unsigned int getThetaResolution() const { return m_thetaResolution; }
+
+    const std::vector<Entry> &getEntries() const { return m_entries; }
+    bool empty() const { return m_entries.empty(); }
+
+    /**
+     * @brief The entries of row y, in increasing x.
+     */
+    const Entry *entriesBegin(unsigned int y) const { return m_entries.data() + m_rowOffsets[y]; }
+    const Entry *entriesEnd(unsigned int y) const { return m_entries.data() + m_rowOffsets[y + 1]; }
+
+    /**
+     * @brief The number of shoreline cells.
+     */
+    size_t cells() const;
+
+private:
+    /**
+     * @brief Fills m_rowOffsets from m_entries, which must be sorted.
+     */
+    void computeRowOffsets();
+
+    glm::uvec2 m_resolution;
+    unsigned int m_thetaResolution;
+
+    std::vector<Entry> m_entries;
+    std::vector<unsigned int> m_rowOffsets; // row y owns m_entries[m_rowOffsets[y], m_rowOffsets[y+1])
+};
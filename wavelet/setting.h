@@ -34,6 +34,11 @@ struct Setting {
     float spatialDiffusionMultiplier = 126.5625;
     float angularDiffusionMultiplier = 0.025;
 
+    // adaptive time stepping, the most cells a wave may travel in one substep
+    float cflNumber = 0.9;
+    // the most substeps per frame, longer frames are simulated in slow motion
+    int maxSubsteps = 16;
+
     // for height field evaluation
     int heightField_resolution = 400;
 
@@ -24,6 +24,8 @@ Simulator::Simulator(Setting setting, std::shared_ptr<Environment> environment)
     amplitude[1] = setup3DAmplitude();
 
     fullScreenQuad = std::make_shared<FullscreenQuad>();
+    recomputeActiveTiles();
+    recomputeReflectionTable();
 
     recomputeFramebuffer();
     Debug::checkGLError();
@@ -53,12 +55,59 @@ Simulator::Simulator(Setting setting, std::shared_ptr<Environment> environment)
 Simulator::~Simulator() {
     if (simulationShader) glDeleteProgram(simulationShader);
     if (visualizationShader) glDeleteProgram(visualizationShader);
+    if (activeTilesVbo) glDeleteBuffers(1, &activeTilesVbo);
+    if (activeTilesVao) glDeleteVertexArrays(1, &activeTilesVao);
 }
 
-void Simulator::takeStep(float dt) {
-    if (!dt) dt = 0.0001;
+void Simulator::advance(float interval) {
     ImGui::SliderFloat("angular diffusion scale", &setting.angularDiffusionMultiplier, 0.0f, 0.1f);
     ImGui::SliderFloat("spacial diffusion scale", &setting.spatialDiffusionMultiplier, 0.0f, 400.0f);
+    ImGui::SliderFloat("cfl number", &setting.cflNumber, 0.1f, 4.0f);
+    if (!plan->isBuiltFor(setting, planResolution(), unitParam.x)) {
+        computeParameters();
+        loadShadersWithData(simulationShader);
+    }
+
+    // the most restricted band decides how much of the interval fits in maxSubsteps
+    StepSchedule schedule = plan->schedule(interval, setting.cflNumber, setting.maxSubsteps);
+    interval = schedule.substeps * schedule.deltaTime;
+
+    // the bands share texels, so a pass steps every band that is due and leaves the others as is
+    glm::ivec4 substeps;
+    glm::vec4 deltaTime;
+    for (int i_k = 0; i_k < 4; i_k++) {
+        StepSchedule bandSchedule = plan->bandSchedule(i_k, interval, setting.cflNumber);
+        substeps[i_k] = bandSchedule.substeps;
+        deltaTime[i_k] = bandSchedule.deltaTime;
+    }
+    lastBandSubsteps = substeps;
+
+    // spread the steps of every band evenly over the passes, so they all end together
+    const int passes = std::max(std::max(substeps[0], substeps[1]), std::max(substeps[2], substeps[3]));
+    for (int pass = 0; pass < passes; pass++) {
+        glm::vec4 bandMask;
+        for (int i_k = 0; i_k < 4; i_k++)
+            bandMask[i_k] = (pass + 1) * substeps[i_k] / passes > pass * substeps[i_k] / passes;
+        takeStep(deltaTime, bandMask);
+    }
+    timeElapsed += interval;
+}
+
+float Simulator::maxStableTimeStep() const {
+    return plan->maxStableTimeStep(setting.cflNumber);
+}
+
+void Simulator::takeStep(float dt) {
+    if (!dt) dt = 0.0001;
+    takeStep(glm::vec4(dt), glm::vec4(1));
+    timeElapsed += dt;
+}
+
+void Simulator::takeStep(glm::vec4 dt, glm::vec4 bandMask) {
+    if (!plan->isBuiltFor(setting, planResolution(), unitParam.x)) {
+        computeParameters();
+        loadShadersWithData(simulationShader);
+    }
 
     glDisable(GL_BLEND);
     glDisable(GL_DEPTH_TEST);
@@ -81,20 +130,23 @@ void Simulator::takeStep(float dt) {
     // advection step
     glUseProgram(simulationShader);
     glUniform1f(glGetUniformLocation(simulationShader, "time"), timeElapsed);
-    glUniform1f(glGetUniformLocation(simulationShader, "deltaTime"), dt);
-    glUniform1f(glGetUniformLocation(simulationShader, "angularDiffusionMultiplier"), setting.angularDiffusionMultiplier);
-    glUniform1f(glGetUniformLocation(simulationShader, "spatialDiffusionMultiplier"), setting.spatialDiffusionMultiplier);
+    glUniform4fv(glGetUniformLocation(simulationShader, "deltaTime"), 1, glm::value_ptr(dt));
+    glUniform4fv(glGetUniformLocation(simulationShader, "bandMask"), 1, glm::value_ptr(bandMask));
     simulationFBO[whichPass]->bind();
-    fullScreenQuad->bind();
+    glBindVertexArray(activeTilesVao);
     for (int i = 0; i < thetaResolution; i++)
         amplitude[whichPass][i]->bind(attachments[i]);
     environment->heightMap->bind(GL_TEXTURE8);
     environment->gradientMap->bind(GL_TEXTURE9);
     environment->boundaryMap->bind(GL_TEXTURE10);
+    reflectionIndexMap->bind(GL_TEXTURE11);
+    reflectionEntryMap->bind(GL_TEXTURE12);
 
+    // dry tiles are never drawn, so they stay cleared to 0
     glClearColor(0, 0, 0, 0);
     glClear(GL_COLOR_BUFFER_BIT);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glDrawArrays(GL_TRIANGLES, 0, activeTilesVertexCount);
+    glBindVertexArray(0);
 
     for (int i = 0; i < thetaResolution; i++)
         amplitude[whichPass][i]->unbind(attachments[i]);
@@ -102,12 +154,13 @@ void Simulator::takeStep(float dt) {
     environment->heightMap->unbind(GL_TEXTURE8);
     environment->gradientMap->unbind(GL_TEXTURE9);
     environment->boundaryMap->unbind(GL_TEXTURE10);
+    reflectionIndexMap->unbind(GL_TEXTURE11);
+    reflectionEntryMap->unbind(GL_TEXTURE12);
 
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_BLEND);
     glUseProgram(0);
 
-    timeElapsed += dt;
     whichPass ^= 1;
 }
 
@@ -181,6 +234,77 @@ void Simulator::recomputeFramebuffer() {
     reset();
 }
 
+void Simulator::recomputeActiveTiles() {
+    glm::uvec2 resolution(setting.simulationResolution[0], setting.simulationResolution[1]);
+    activeRegion = environment->activeRegion(resolution);
+
+    // the tiles as quads in normalized device coordinates, the same layout as the fullscreen quad
+    std::vector<GLfloat> data;
+    for (glm::uvec2 tile : activeRegion.getTiles()) {
+        glm::uvec2 tileEnd = glm::min(tile + glm::uvec2(activeRegion.getTileSize()), resolution);
+        glm::vec2 lower = glm::vec2(tile) / glm::vec2(resolution) * 2.0f - 1.0f;
+        glm::vec2 upper = glm::vec2(tileEnd) / glm::vec2(resolution) * 2.0f - 1.0f;
+
+        GLfloat quad[18] = {
+            lower.x, lower.y, 0,
+            upper.x, lower.y, 0,
+            upper.x, upper.y, 0,
+            upper.x, upper.y, 0,
+            lower.x, upper.y, 0,
+            lower.x, lower.y, 0
+        };
+        data.insert(data.end(), quad, quad + 18);
+    }
+    activeTilesVertexCount = data.size() / 3;
+
+    if (!activeTilesVbo) glGenBuffers(1, &activeTilesVbo);
+    if (!activeTilesVao) glGenVertexArrays(1, &activeTilesVao);
+    glBindBuffer(GL_ARRAY_BUFFER, activeTilesVbo);
+    glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(GLfloat), data.data(), GL_STATIC_DRAW);
+    glBindVertexArray(activeTilesVao);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), reinterpret_cast<GLvoid*>(0));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+void Simulator::recomputeReflectionTable() {
+    glm::uvec2 resolution(setting.simulationResolution[0], setting.simulationResolution[1]);
+    ReflectionTable table = environment->reflectionTable(resolution, plan->thetas());
+    const std::vector<ReflectionTable::Entry> &entries = table.getEntries();
+
+    // the entries of a cell are contiguous, so a cell only needs where they start and how many
+    std::vector<GLfloat> index(2 * resolution.x * resolution.y, 0);
+    for (size_t i = 0; i < entries.size(); i++) {
+        GLfloat *cell = index.data() + 2 * (entries[i].cell.x + entries[i].cell.y * resolution.x);
+        if (cell[1] == 0) cell[0] = i;
+        cell[1]++;
+    }
+
+    // the weights of an entry sum to one, so the second one is left out
+    const int entryWidth = std::max<int>(1, std::min<int>(entries.size(), 4096));
+    const int entryHeight = std::max<int>(1, (entries.size() + entryWidth - 1) / entryWidth);
+    std::vector<GLfloat> data(4 * entryWidth * entryHeight, 0);
+    for (size_t i = 0; i < entries.size(); i++) {
+        data[4 * i + 0] = entries[i].theta;
+        data[4 * i + 1] = entries[i].targets[0];
+        data[4 * i + 2] = entries[i].targets[1];
+        data[4 * i + 3] = entries[i].weights[0];
+    }
+
+    reflectionIndexMap = std::make_shared<Texture>();
+    reflectionIndexMap->setInterpolation(GL_NEAREST);
+    reflectionIndexMap->setWrapping(GL_CLAMP_TO_EDGE);
+    reflectionIndexMap->initialize2D(resolution.x, resolution.y, GL_RG32F, GL_RG, GL_FLOAT, index.data());
+    Debug::checkGLError();
+
+    reflectionEntryMap = std::make_shared<Texture>();
+    reflectionEntryMap->setInterpolation(GL_NEAREST);
+    reflectionEntryMap->setWrapping(GL_CLAMP_TO_EDGE);
+    reflectionEntryMap->initialize2D(entryWidth, entryHeight, GL_RGBA32F, GL_RGBA, GL_FLOAT, data.data());
+    Debug::checkGLError();
+}
+
 void Simulator::reset() {
     /* GLuint clearColor[4] = {0, 0, 0, 0}; */
     glClearColor(0.0, 0.0, 0.0, 0.0);
@@ -213,21 +337,34 @@ void Simulator::loadShadersWithData(GLuint shader) {
         std::string prop = "_Amplitude[" + std::to_string(i) + "]";
         glad_glUniform1i(glGetUniformLocation(shader, prop.c_str()), i);
         std::string prop2 = "waveDirections[" + std::to_string(i) + "]";
-        glad_glUniform2fv(glGetUniformLocation(shader, prop2.c_str()), 1, glm::value_ptr(waveDirections[i]));
+        glm::vec2 waveDirection = plan->waveDirection(i);
+        glad_glUniform2fv(glGetUniformLocation(shader, prop2.c_str()), 1, glm::value_ptr(waveDirection));
         std::string prop3 = "ambient[" + std::to_string(i) + "]";
-        glad_glUniform4fv(glGetUniformLocation(shader, prop3.c_str()), 1, glm::value_ptr(ambientAmplitude[i]));
+        glm::vec4 ambient = ambientAmplitude(i);
+        glad_glUniform4fv(glGetUniformLocation(shader, prop3.c_str()), 1, glm::value_ptr(ambient));
     }
 
+    glm::vec4 angularFrequencies = DispersionPlan::pack(plan->angularFrequencies());
+    glm::vec4 advectionSpeeds = DispersionPlan::pack(plan->advectionSpeeds());
+    glm::vec4 dispersionSpeeds = DispersionPlan::pack(plan->dispersionSpeeds());
+    glm::vec4 spatialDiffusions = DispersionPlan::pack(plan->spatialDiffusions());
+    glm::vec4 angularDiffusions = DispersionPlan::pack(plan->angularDiffusions());
+    glm::vec4 viscosityRates = DispersionPlan::pack(plan->viscosityRates());
+
     glad_glUniform4fv(glGetUniformLocation(shader, "wavenumberValues"), 1, glm::value_ptr(setting.kValues));
     glad_glUniform4fv(glGetUniformLocation(shader, "angularFrequency"), 1, glm::value_ptr(angularFrequencies));
     glad_glUniform4fv(glGetUniformLocation(shader, "advectionSpeed"), 1, glm::value_ptr(advectionSpeeds));
     glad_glUniform4fv(glGetUniformLocation(shader, "dispersionSpeed"), 1, glm::value_ptr(dispersionSpeeds));
+    glad_glUniform4fv(glGetUniformLocation(shader, "spatialDiffusion"), 1, glm::value_ptr(spatialDiffusions));
+    glad_glUniform4fv(glGetUniformLocation(shader, "angularDiffusion"), 1, glm::value_ptr(angularDiffusions));
+    glad_glUniform4fv(glGetUniformLocation(shader, "viscosityRate"), 1, glm::value_ptr(viscosityRates));
     glad_glUniform2fv(glGetUniformLocation(shader, "windDirection"), 1, glm::value_ptr(setting.windDirection));
-    glad_glUniform1f(glGetUniformLocation(shader, "waterViscosity"), setting.waterViscosity);
 
     glad_glUniform1i(glGetUniformLocation(shader, "_Height"), 8);
     glad_glUniform1i(glGetUniformLocation(shader, "_Gradient"), 9);
     glad_glUniform1i(glGetUniformLocation(shader, "_CloseToBoundary"), 10);
+    glad_glUniform1i(glGetUniformLocation(shader, "_ReflectionIndex"), 11);
+    glad_glUniform1i(glGetUniformLocation(shader, "_Reflections"), 12);
     glad_glUniform1f(glGetUniformLocation(shader, "waterLevel"), environment->waterHeight);
 
     glad_glUniform4fv(glGetUniformLocation(shader, "minParam"), 1, glm::value_ptr(minParam));
@@ -237,46 +374,25 @@ void Simulator::loadShadersWithData(GLuint shader) {
 }
 
 void Simulator::computeParameters() {
-    auto angularFrequency = [this](glm::vec4 wavenumber) -> glm::vec4 {
-        return glm::pow(wavenumber * setting.gravity + setting.surfaceTension * wavenumber * wavenumber * wavenumber,
-                glm::vec4(0.5));
-    };
-
-    auto advectionSpeed = [this, &angularFrequency](glm::vec4 wavenumber) -> glm::vec4 {
-        glm::vec4 numerator = (setting.gravity + 3 * setting.surfaceTension * wavenumber * wavenumber);
-        glm::vec4 denominator = 2.0f * angularFrequency(wavenumber);
-        return numerator / denominator;
-    };
-
-    auto dispersionSpeed = [this, &angularFrequency, &advectionSpeed](glm::vec4 wavenumber) -> glm::vec4 {
-        // courtesy of wolfram alpha
-        // https://www.wolframalpha.com/input?i=d%5E2%2Fdx%5E2%28sqrt%28ax%2Bbx%5E3%29%29
-        glm::vec4 numerator =
-            (-2 * setting.gravity + 6 * setting.gravity * setting.surfaceTension * wavenumber * wavenumber +
-            3 * setting.surfaceTension * setting.surfaceTension * wavenumber * wavenumber * wavenumber * wavenumber);
-        glm::vec4 denom = 4.0f * glm::pow(wavenumber * (setting.gravity + setting.surfaceTension * wavenumber * wavenumber), 
-                glm::vec4(3 / 2.0));
-        return numerator / denom;
-    };
-
-    angularFrequencies = angularFrequency(setting.kValues);
-    advectionSpeeds = advectionSpeed(setting.kValues);
-    dispersionSpeeds = dispersionSpeed(setting.kValues);
-
-    waveDirections = std::vector<glm::vec2>(setting.simulationResolution[2]);
-    ambientAmplitude = std::vector<glm::vec4>(setting.simulationResolution[2]);
-
-    for (int i = 0; i < setting.simulationResolution[2]; i++) {
-        float theta = (i + 0.5f) * setting.tau / setting.simulationResolution[2];
-        glm::vec2 waveDirection(std::cos(theta), std::sin(theta));
-
-        float cosTheta = glm::dot(waveDirection, glm::normalize(setting.windDirection));
+    // the shaders pack the k bands in the channels of a vec4
+    std::vector<float> wavenumbers = {setting.kValues.x, setting.kValues.y, setting.kValues.z, setting.kValues.w};
+    // the directions at the centers of the theta cells, as in WaveletGrid
+    std::vector<float> thetas(setting.simulationResolution[2]);
+    for (size_t i_theta = 0; i_theta < thetas.size(); i_theta++)
+        thetas[i_theta] = minParam.z + (i_theta + 0.5f) * unitParam.z;
+    plan = std::make_shared<const DispersionPlan>(setting, planResolution(), unitParam.x, wavenumbers, thetas);
+}
 
-        float ambientCoef = cosTheta < 0 ? 0 : cosTheta * cosTheta * 4.00f / setting.tau;
+glm::uvec4 Simulator::planResolution() const {
+    return glm::uvec4(setting.simulationResolution[0], setting.simulationResolution[1],
+            setting.simulationResolution[2], 4);
+}
 
-        waveDirections[i] = waveDirection;
-        ambientAmplitude[i] = glm::vec4(5 * ambientCoef);
-    }
+glm::vec4 Simulator::ambientAmplitude(int i_theta) const {
+    glm::vec4 ambient;
+    for (int i_k = 0; i_k < 4; i_k++)
+        ambient[i_k] = plan->ambientAmplitude(i_theta, i_k);
+    return ambient;
 }
 
 std::vector<std::shared_ptr<Texture>> Simulator::setup3DAmplitude() {
@@ -290,7 +406,7 @@ std::vector<std::shared_ptr<Texture>> Simulator::setup3DAmplitude() {
                 GL_RGBA32F, GL_RGBA, GL_FLOAT);
         textures[i]->setInterpolation(GL_LINEAR);
         textures[i]->setWrapping(GL_CLAMP_TO_BORDER);
-        textures[i]->setBorderColor(ambientAmplitude[i] * setting.ambientStrength);
+        textures[i]->setBorderColor(ambientAmplitude(i) * setting.ambientStrength);
         /* std::cout << i << " " << glm::to_string(ambientAmplitude[i]) << std::endl; */
     }
 
@@ -2,6 +2,7 @@
 
 #include "GLWrapper/framebuffer.h"
 #include "fullscreenquad.h"
+#include "wavelet/dispersionplan.h"
 #include "wavelet/environment.h"
 #include "wavelet/setting.h"
 #include "wavelet/waveletgrid.h"
@@ -14,6 +15,13 @@ public:
     ~Simulator();
 
     void takeStep(float dt);
+    // advances by interval, every k band in as few steps as are stable for that band
+    void advance(float interval);
+    float maxStableTimeStep() const;
+    // the substeps every k band took in the last advance
+    glm::ivec4 bandSubsteps() const { return lastBandSubsteps; }
+    // the tiles with wet cells, the only ones a step draws
+    size_t activeTileCount() const { return activeRegion.getTiles().size(); }
     void visualize(glm::ivec2 viewportSize);
     void reset();
     std::vector<std::shared_ptr<Texture>> getAmplitudeTextures() { return amplitude[whichPass]; }
@@ -26,6 +34,7 @@ private:
                        // This points to the "real" one.
 
     float timeElapsed = 0;
+    glm::ivec4 lastBandSubsteps = glm::ivec4(0);
     GLuint visualizationShader;
     GLuint simulationShader;
 
@@ -36,23 +45,34 @@ private:
 
     std::shared_ptr<FullscreenQuad> fullScreenQuad;
 
+    // one quad per tile of the grid that has wet cells, the simulation step only draws these
+    ActiveRegion activeRegion;
+    GLuint activeTilesVao = 0, activeTilesVbo = 0;
+    int activeTilesVertexCount = 0;
+
+    // the shoreline, see ReflectionTable. reflectionIndexMap holds the first entry and the number
+    // of entries of every cell, reflectionEntryMap the entries as (theta, target 0, target 1, weight 0)
+    std::shared_ptr<Texture> reflectionIndexMap, reflectionEntryMap;
+
     Setting setting;
     int visualization_thetaIndex = 0;
     // derived from resolution and simulation area
     glm::vec4 minParam, maxParam, unitParam;
 
-    // all precomputed data on the cpu to be loaded onto the cpu. 
-    // This only happens once, so hopefully it's not too expensive.
-    std::vector<glm::vec2> waveDirections;
-    std::vector<glm::vec4> ambientAmplitude;
-    glm::vec4 angularFrequencies;
-    glm::vec4 advectionSpeeds;
-    glm::vec4 dispersionSpeeds;
+    // all precomputed data on the cpu to be loaded onto the gpu.
+    // This is only rebuilt when the settings change.
+    std::shared_ptr<const DispersionPlan> plan;
 
     // to recompute minParam, maxParam, unitParam
     void computeParameters();
+    // steps the k bands where bandMask is 1, each by its own deltaTime
+    void takeStep(glm::vec4 deltaTime, glm::vec4 bandMask);
+    glm::uvec4 planResolution() const;
+    glm::vec4 ambientAmplitude(int i_theta) const;
     void recomputeRanges();
     void recomputeFramebuffer();
+    void recomputeActiveTiles();
+    void recomputeReflectionTable();
     void loadShadersWithData(GLuint shader);
     std::vector<std::shared_ptr<Texture>> setup3DAmplitude();
 };
@@ -0,0 +1,4 @@
+// The stb_image implementation for wavelet_core, which loads the heightmap of Terrain without the
+// application. The application defines its own in cubemap.cpp and doesn't compile this file.
+#define STB_IMAGE_IMPLEMENTATION
+#include "External/stb/stb_image.h"
@@ -0,0 +1,54 @@
+#include "storage.h"
+
+namespace Storage {
+
+    std::size_t elementSize(Type type) {
+        return type == Type::Float32 ? sizeof(float) : sizeof(std::uint16_t);
+    }
+
+    const char *name(Type type) {
+        switch (type) {
+            case Type::Float16: return "fp16";
+            case Type::BFloat16: return "bf16";
+            default: return "fp32";
+        }
+    }
+
+    bool hasF16C() {
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)) && defined(WAVELET_HAS_F16C)
+        static const bool f16c = []() {
+            __builtin_cpu_init();
+            return (bool) __builtin_cpu_supports("f16c");
+        }();
+        return f16c;
+#else
+        return false;
+#endif
+    }
+
+    void decode(Type type, const void *in, float *out, std::size_t n) {
+        if (type == Type::Float16 && hasF16C()) {
+            decodeHalfF16C(static_cast<const Half *>(in), out, n);
+            return;
+        }
+        dispatch(type, [&](auto element) {
+            using T = decltype(element);
+            const T *elements = static_cast<const T *>(in);
+            for (std::size_t i = 0; i < n; i++)
+                out[i] = toFloat(elements[i]);
+        });
+    }
+
+    void encode(Type type, const float *in, void *out, std::size_t n) {
+        if (type == Type::Float16 && hasF16C()) {
+            encodeHalfF16C(in, static_cast<Half *>(out), n);
+            return;
+        }
+        dispatch(type, [&](auto element) {
+            using T = decltype(element);
+            T *elements = static_cast<T *>(out);
+            for (std::size_t i = 0; i < n; i++)
+                elements[i] = fromFloat<T>(in[i]);
+        });
+    }
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * Element types Amplitude can store its samples in. The grid always computes in fp32, reduced
+ * precision samples are converted when a kernel loads them and rounded when it stores them.
+ *
+ * The single element conversions are inline so that they fold into the stencils that read
+ * the samples directly. Whole rows go through decode and encode, which use F16C if the cpu
+ * has it.
+ */
+namespace Storage {
+
+    enum class Type {
+        Float32 = 0,
+        Float16 = 1,
+        BFloat16 = 2,
+    };
+
+    // IEEE 754 binary16
+    struct Half {
+        std::uint16_t bits;
+    };
+
+    // the upper 16 bits of an fp32, same range with an 8 bit mantissa
+    struct BFloat16 {
+        std::uint16_t bits;
+    };
+
+    inline float toFloat(float value) { return value; }
+
+    inline float toFloat(Half value) {
+        const std::uint32_t sign = (std::uint32_t) (value.bits & 0x8000) << 16;
+        const std::uint32_t exponent = (value.bits >> 10) & 0x1f;
+        const std::uint32_t mantissa = value.bits & 0x3ff;
+
+        std::uint32_t bits;
+        if (exponent == 0x1f) {
+            // infinity or nan
+            bits = sign | 0x7f800000 | (mantissa << 13);
+        } else if (exponent != 0) {
+            bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+        } else {
+            // zero or subnormal, mantissa * 2^-24
+            float magnitude = mantissa * 5.9604644775390625e-8f;
+            return sign ? -magnitude : magnitude;
+        }
+
+        float result;
+        std::memcpy(&result, &bits, sizeof(result));
+        return result;
+    }
+
+    inline float toFloat(BFloat16 value) {
+        const std::uint32_t bits = (std::uint32_t) value.bits << 16;
+        float result;
+        std::memcpy(&result, &bits, sizeof(result));
+        return result;
+    }
+
+    /**
+     * @brief Round value to the nearest T, ties to even.
+     */
+    template <class T>
+    T fromFloat(float value);
+
+    template <>
+    inline float fromFloat<float>(float value) { return value; }
+
+    template <>
+    inline Half fromFloat<Half>(float value) {
+        std::uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        const std::uint16_t sign = (bits >> 16) & 0x8000;
+        bits &= 0x7fffffff;
+
+        // infinity, nan, and everything that rounds to infinity
+        if (bits >= 0x47800000)
+            return Half{(std::uint16_t) (sign | (bits > 0x7f800000 ? 0x7e00 : 0x7c00))};
+
+        // below the smallest normal half, let the fp32 adder round the subnormal mantissa
+        if (bits < 0x38800000) {
+            float magnitude;
+            std::memcpy(&magnitude, &bits, sizeof(magnitude));
+            magnitude += 0.5f;
+            std::memcpy(&bits, &magnitude, sizeof(bits));
+            return Half{(std::uint16_t) (sign | (bits - 0x3f000000))};
+        }
+
+        // rebias the exponent and round the 13 dropped mantissa bits, carrying into the exponent
+        const std::uint32_t mantissaOdd = (bits >> 13) & 1;
+        bits += 0xc8000fff + mantissaOdd;
+        return Half{(std::uint16_t) (sign | (bits >> 13))};
+    }
+
+    template <>
+    inline BFloat16 fromFloat<BFloat16>(float value) {
+        std::uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        // keep nans quiet instead of rounding them to infinity
+        if ((bits & 0x7fffffff) > 0x7f800000) return BFloat16{(std::uint16_t) ((bits >> 16) | 0x40)};
+        bits += 0x7fff + ((bits >> 16) & 1);
+        return BFloat16{(std::uint16_t) (bits >> 16)};
+    }
+
+    /**
+     * @brief Calls f with a value of the element type of type, so that generic lambdas can be
+     * instantiated once per storage type.
+     */
+    template <class F>
+    inline decltype(auto) dispatch(Type type, F &&f) {
+        switch (type) {
+            case Type::Float16: return f(Half{});
+            case Type::BFloat16: return f(BFloat16{});
+            default: return f(float{});
+        }
+    }
+
+    std::size_t elementSize(Type type);
+    const char *name(Type type);
+
+    /**
+     * @brief out[i] = toFloat(in[i]) for n elements of type.
+     */
+    void decode(Type type, const void *in, float *out, std::size_t n);
+
+    /**
+     * @brief out[i] = fromFloat(in[i]) for n elements of type.
+     */
+    void encode(Type type, const float *in, void *out, std::size_t n);
+
+    /**
+     * @brief Whether decode and encode use the F16C instructions for Float16.
+     */
+    bool hasF16C();
+
+    void decodeHalfF16C(const Half *in, float *out, std::size_t n);
+    void encodeHalfF16C(const float *in, Half *out, std::size_t n);
+}
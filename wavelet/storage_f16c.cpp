@@ -0,0 +1,33 @@
+#include "storage.h"
+
+// compiled with F16C enabled when the build supports it, see CMakeLists.txt
+#ifdef __F16C__
+#include <immintrin.h>
+
+void Storage::decodeHalfF16C(const Half *in, float *out, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i))));
+    for (; i < n; i++)
+        out[i] = _cvtsh_ss(in[i].bits);
+}
+
+void Storage::encodeHalfF16C(const float *in, Half *out, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+    for (; i < n; i++)
+        out[i].bits = _cvtss_sh(in[i], _MM_FROUND_TO_NEAREST_INT);
+}
+#else
+void Storage::decodeHalfF16C(const Half *in, float *out, std::size_t n) {
+    for (std::size_t i = 0; i < n; i++)
+        out[i] = toFloat(in[i]);
+}
+
+void Storage::encodeHalfF16C(const float *in, Half *out, std::size_t n) {
+    for (std::size_t i = 0; i < n; i++)
+        out[i] = fromFloat<Half>(in[i]);
+}
+#endif
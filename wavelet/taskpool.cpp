@@ -0,0 +1,202 @@
+#include "taskpool.h"
+#include "topology.h"
+
+#include <cassert>
+#include <chrono>
+
+namespace {
+    thread_local int s_worker = -1;
+
+    uint64_t nanosecondsSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+TaskGraph::TaskId TaskGraph::add(std::function<void()> work, const std::vector<TaskId> &dependencies){
+    const TaskId id = m_nodes.size();
+    m_nodes.emplace_back();
+    m_nodes.back().work = std::move(work);
+    for (TaskId dependency : dependencies)
+        addDependency(dependency, id);
+    return id;
+}
+
+void TaskGraph::addDependency(TaskId before, TaskId after){
+    assert(before < after && after < m_nodes.size());
+    m_nodes[before].successors.push_back(after);
+    m_nodes[after].dependencies++;
+}
+
+TaskPool::TaskPool(unsigned int workerCount){
+    if (workerCount == 0) workerCount = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned int i = 0; i < workerCount; i++)
+        m_workers.push_back(std::make_unique<Worker>());
+    // worker 0 is whichever thread calls run
+    for (unsigned int i = 1; i < workerCount; i++)
+        m_workers[i]->thread = std::thread(&TaskPool::workerLoop, this, i);
+}
+
+void TaskPool::pinWorkers(const std::vector<int> &cpus){
+    if (cpus.empty()) return;
+    for (unsigned int i = 1; i < m_workers.size(); i++)
+        Topology::pinThread(m_workers[i]->thread, cpus[i % cpus.size()]);
+}
+
+TaskPool::~TaskPool(){
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (std::unique_ptr<Worker> &worker : m_workers)
+        if (worker->thread.joinable()) worker->thread.join();
+}
+
+void TaskPool::run(TaskGraph &graph){
+    if (graph.empty()) return;
+    assert(s_worker < 0);
+
+    std::lock_guard<std::mutex> runLock(m_runMutex);
+    const auto start = std::chrono::steady_clock::now();
+
+    for (TaskGraph::Node &node : graph.m_nodes)
+        node.remaining = node.dependencies;
+    m_unfinished = graph.size();
+    m_graph = &graph;
+
+    // spread the tasks that can start right away over all workers
+    unsigned int roots = 0;
+    for (TaskGraph::TaskId task = 0; task < graph.size(); task++) {
+        if (graph.m_nodes[task].dependencies > 0) continue;
+        Worker &worker = *m_workers[roots++ % m_workers.size()];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.queue.push_back(task);
+    }
+    m_queued += roots;
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+    }
+    m_wake.notify_all();
+
+    s_worker = 0;
+    while (m_unfinished > 0) {
+        TaskGraph::TaskId task;
+        if (findTask(0, task)) {
+            execute(0, task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_wake.wait(lock, [this]() { return m_queued > 0 || m_unfinished == 0; });
+    }
+    s_worker = -1;
+
+    m_graph = nullptr;
+    m_runNanoseconds += nanosecondsSince(start);
+}
+
+void TaskPool::workerLoop(unsigned int index){
+    s_worker = index;
+    while (true) {
+        TaskGraph::TaskId task;
+        if (findTask(index, task)) {
+            execute(index, task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_wake.wait(lock, [this]() { return m_stop || m_queued > 0; });
+        if (m_stop) return;
+    }
+}
+
+bool TaskPool::findTask(unsigned int index, TaskGraph::TaskId &task){
+    if (m_queued <= 0) return false;
+
+    // the newest task of our own queue
+    {
+        Worker &worker = *m_workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.queue.empty()) {
+            task = worker.queue.back();
+            worker.queue.pop_back();
+            m_queued--;
+            return true;
+        }
+    }
+
+    // the oldest task of someone else's
+    for (unsigned int i = 1; i < m_workers.size(); i++) {
+        Worker &victim = *m_workers[(index + i) % m_workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.queue.empty()) {
+            task = victim.queue.front();
+            victim.queue.pop_front();
+            m_queued--;
+            m_workers[index]->steals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskPool::execute(unsigned int index, TaskGraph::TaskId task){
+    Worker &worker = *m_workers[index];
+    TaskGraph::Node &node = m_graph->m_nodes[task];
+
+    const auto start = std::chrono::steady_clock::now();
+    node.work();
+    worker.busyNanoseconds += nanosecondsSince(start);
+    worker.tasks++;
+
+    for (TaskGraph::TaskId successor : node.successors)
+        if (m_graph->m_nodes[successor].remaining.fetch_sub(1) == 1)
+            push(index, successor);
+
+    // the graph may be gone once the last task is done
+    if (m_unfinished.fetch_sub(1) == 1) {
+        {
+            std::lock_guard<std::mutex> lock(m_sleepMutex);
+        }
+        m_wake.notify_all();
+    }
+}
+
+void TaskPool::push(unsigned int index, TaskGraph::TaskId task){
+    {
+        Worker &worker = *m_workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.queue.push_back(task);
+    }
+    m_queued++;
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+    }
+    m_wake.notify_one();
+}
+
+std::vector<TaskPool::WorkerStats> TaskPool::stats() const {
+    const double runSeconds = m_runNanoseconds * 1e-9;
+    std::vector<WorkerStats> stats;
+    for (const std::unique_ptr<Worker> &worker : m_workers) {
+        WorkerStats workerStats;
+        workerStats.tasks = worker->tasks;
+        workerStats.steals = worker->steals;
+        workerStats.busySeconds = worker->busyNanoseconds * 1e-9;
+        workerStats.utilization = runSeconds > 0 ? workerStats.busySeconds / runSeconds : 0;
+        stats.push_back(workerStats);
+    }
+    return stats;
+}
+
+void TaskPool::resetStats(){
+    for (std::unique_ptr<Worker> &worker : m_workers) {
+        worker->tasks = 0;
+        worker->steals = 0;
+        worker->busyNanoseconds = 0;
+    }
+    m_runNanoseconds = 0;
+}
+
+int TaskPool::currentWorker(){
+    return s_worker;
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief A set of tasks and the order they have to run in. A task starts once every task it
+ * depends on has finished, independent tasks run in any order and in parallel.
+ *
+ * A graph can be run any number of times, but only by one TaskPool at a time.
+ */
+class TaskGraph {
+public:
+    using TaskId = unsigned int;
+
+    /**
+     * @brief Adds a task that runs after every task in dependencies, which must already be in
+     * the graph.
+     */
+    TaskId add(std::function<void()> work, const std::vector<TaskId> &dependencies = {});
+
+    /**
+     * @brief Makes after wait for before as well. before must have been added first, so the
+     * graph can't have cycles.
+     */
+    void addDependency(TaskId before, TaskId after);
+
+    size_t size() const { return m_nodes.size(); }
+    bool empty() const { return m_nodes.empty(); }
+    void clear() { m_nodes.clear(); }
+
+private:
+    friend class TaskPool;
+
+    struct Node {
+        std::function<void()> work;
+        std::vector<TaskId> successors;
+        unsigned int dependencies = 0;
+        // dependencies that have not finished yet in the current run
+        std::atomic<unsigned int> remaining = 0;
+    };
+
+    // a deque so that nodes stay put, atomics can't be moved
+    std::deque<Node> m_nodes;
+};
+
+/**
+ * @brief A fixed set of worker threads that run TaskGraphs.
+ *
+ * Every worker owns a queue of ready tasks. It runs the newest task of its own queue first, which
+ * is usually the one that reads what the worker just wrote, and when its queue is empty it steals
+ * the oldest task of another worker. Tasks that become ready go to the queue of the worker that
+ * finished their last dependency.
+ *
+ * The thread calling run works as worker 0 until the graph is done, so a pool of n workers
+ * starts n - 1 threads.
+ */
+class TaskPool {
+public:
+    struct WorkerStats {
+        uint64_t tasks = 0;
+        // tasks taken from the queue of another worker
+        uint64_t steals = 0;
+        // time spent running tasks
+        double busySeconds = 0;
+        // busySeconds over the time spent in run
+        float utilization = 0;
+    };
+
+    /**
+     * @param workerCount the number of workers, 0 for one per hardware thread.
+     */
+    explicit TaskPool(unsigned int workerCount = 0);
+    ~TaskPool();
+
+    TaskPool(const TaskPool &) = delete;
+    TaskPool &operator=(const TaskPool &) = delete;
+
+    unsigned int workerCount() const { return m_workers.size(); }
+
+    /**
+     * @brief Pins worker i to cpus[i % cpus.size()], see Topology. Worker 0 is whichever thread
+     * calls run, so it is left to the caller.
+     */
+    void pinWorkers(const std::vector<int> &cpus);
+
+    /**
+     * @brief Runs every task of graph and returns once all of them finished. Runs don't nest,
+     * tasks must not call run on any pool.
+     */
+    void run(TaskGraph &graph);
+
+    /**
+     * @brief Calls f(begin, end) for consecutive chunks of [begin, end) of at most grain
+     * elements, in parallel.
+     */
+    template <class F>
+    void parallelFor(unsigned int begin, unsigned int end, unsigned int grain, F &&f) {
+        TaskGraph graph;
+        for (unsigned int chunk = begin; chunk < end; chunk += grain) {
+            const unsigned int chunkEnd = chunk + std::min(grain, end - chunk);
+            graph.add([&f, chunk, chunkEnd]() { f(chunk, chunkEnd); });
+        }
+        run(graph);
+    }
+
+    /**
+     * @brief The counters of every worker since the pool was created or resetStats was called.
+     */
+    std::vector<WorkerStats> stats() const;
+    void resetStats();
+
+    /**
+     * @brief The index of the worker running the calling thread's task, or -1 outside of a task.
+     */
+    static int currentWorker();
+
+private:
+    struct alignas(64) Worker {
+        std::mutex mutex;
+        std::deque<TaskGraph::TaskId> queue;
+        std::thread thread;
+
+        std::atomic<uint64_t> tasks = 0;
+        std::atomic<uint64_t> steals = 0;
+        std::atomic<uint64_t> busyNanoseconds = 0;
+    };
+
+    void workerLoop(unsigned int index);
+
+    /**
+     * @brief Pops a ready task, from the queue of worker index first. Returns false if every
+     * queue is empty.
+     */
+    bool findTask(unsigned int index, TaskGraph::TaskId &task);
+    void execute(unsigned int index, TaskGraph::TaskId task);
+    void push(unsigned int index, TaskGraph::TaskId task);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    TaskGraph *m_graph = nullptr;
+    std::mutex m_runMutex;
+    // ready tasks in all queues and tasks of the current graph that have not finished
+    std::atomic<int> m_queued = 0;
+    std::atomic<int> m_unfinished = 0;
+
+    // idle workers and the thread in run sleep here
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wake;
+    bool m_stop = false;
+
+    std::atomic<uint64_t> m_runNanoseconds = 0;
+};
@@ -0,0 +1,144 @@
+#include "terrain.h"
+
+#include "External/stb/stb_image.h"
+#include "wavelet/taskpool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <queue>
+
+Terrain::Terrain(const std::string &heightMapFilename, const Setting &setting)
+    : waterHeight(setting.waterHeight) {
+    int n;
+    unsigned char *data = stbi_load(heightMapFilename.c_str(), &width, &height, &n, 0);
+    if (data == NULL) {
+        std::cout << "Error loading image:" << stbi_failure_reason() << std::endl;
+        exit(1);
+    }
+    heights.resize(width * height);
+    gradients.resize(width * height);
+    gradientTheta.resize(width * height);
+    closeToBoundary.resize(width * height);
+    closestOnBoundary.resize(width * height);
+    heightWithSampleLocationInDomain.resize(width * height);
+
+    for (int i = 0; i < width; i++) {
+        for (int j = 0; j < height; j++) {
+            int index = (i + j * width) * n;
+            float r = data[index] / 255.0f;
+            float g = data[index + 1] / 255.0f;
+            float b = data[index + 2] / 255.0f;
+            float heightVal = (r + g + b) / 3.0f;
+            heights[(width - 1 - i) + width * (height - 1 - j)] = heightVal;
+            gradients[(width - 1 - i) + width * (height - 1 - j)] = glm::vec2(0, 0);
+        }
+    }
+    auto sample = [&](int i, int j) {
+        i = std::clamp(i, 0, width-1);
+        j = std::clamp(j, 0, height-1);
+        return heights[i + j * width];
+    };
+    glm::vec2 unitDistance(setting.size / width, setting.size / height);
+    glm::vec2 inverseTwiceUnitDistance(2.0f/unitDistance.x, 2.0f/unitDistance.y);
+
+    float kernel[3][3] = {
+        {-1, -2, -1},
+        {0, 0, 0},
+        {1, 2, 1},
+    };
+
+    /* float kernel[3][3] = { */
+    /*     {1, 0, 0}, */
+    /*     {0, 1, 0}, */
+    /*     {0, 0, 1} */
+    /* }; */
+
+    // every texel only reads the heightmap, so the columns are independent
+    TaskPool pool;
+    pool.parallelFor(0, width, 16, [&](int columnBegin, int columnEnd) {
+        for (int i = columnBegin; i < columnEnd; i++) {
+            for (int j = 0; j < height; j++) {
+                int index = i + j * width;
+
+                long double gx = 0, gy = 0;
+
+                for (int dx = -1; dx <= 1; dx++) {
+                    for (int dy = -1; dy <= 1; dy++) {
+                        gy += kernel[dy+1][dx+1] * sample(dx + i, dy + j);
+                        gx += kernel[dx+1][dy+1] * sample(dx + i, dy + j);
+                    }
+                }
+
+                /* glm::vec2 grad = glm::normalize(glm::vec2(gx, gy)); */
+                /* glm::vec2 grad = glm::normalize(glm::vec2(0,1)); */
+                glm::vec2 grad = glm::vec2(gx, gy);
+                gradients[index] = grad;
+                if (gx || gy)       gradientTheta[index] = std::atan2(gy, gx);
+                else                gradientTheta[index] = 0;
+                gradientTheta[index] /= setting.tau;
+                if (gradientTheta[index] < 0) gradientTheta[index]++;
+
+                closeToBoundary[index] = 0;
+                int range = 1;
+                for (int dx = -range; dx <= range; dx++)
+                    for (int dy = -range; dy <= range; dy++) {
+                        float close = sample(i + dx, j + dy) > waterHeight;
+                        closeToBoundary[index] = std::max(close, closeToBoundary[index]);
+                    }
+            }
+        }
+    });
+
+    { // compute closest to boundary
+        std::fill(closestOnBoundary.begin(), closestOnBoundary.end(), glm::ivec2(-1,-1));
+        // we shall bfs
+        std::queue<glm::ivec2> candidatePositions;
+
+        for (int i = 0; i < width; i++) {
+            for (int j = 0; j < height; j++) {
+                if (sample(i,j) <= waterHeight) {
+                    candidatePositions.push(glm::ivec2(i,j));
+                    closestOnBoundary[i + j*width] = glm::ivec2(i,j);
+                }
+            }
+        }
+
+        int di[] = {-1, 1, 0, 0};
+        int dj[] = {0, 0, -1, 1};
+
+        while (candidatePositions.size()) {
+            glm::ivec2 canPosition = candidatePositions.front();
+            candidatePositions.pop();
+            int i = canPosition.x,  j = canPosition.y;
+
+            for (int k = 0; k < 4; k++) {
+                int ni = canPosition.x + di[k], nj = canPosition.y + dj[k];
+                if (ni >= 0 && ni < width && nj >= 0 && nj < height 
+                        && closestOnBoundary[ni + nj * width] == glm::ivec2(-1,-1)) {
+
+                    closestOnBoundary[ni + nj * width] = closestOnBoundary[i + j * width];
+                    candidatePositions.push(glm::ivec2(ni,nj));
+                }
+            }
+        }
+
+        for (int i = 0; i < width * height; i++) {
+            heightWithSampleLocationInDomain[i] = glm::vec3(
+                heights[i],
+                (closestOnBoundary[i].x + 0.5f) / width,
+                (closestOnBoundary[i].y + 0.5f) / height
+            );
+        }
+    }
+
+    stbi_image_free(data);
+}
+
+ActiveRegion Terrain::activeRegion(glm::uvec2 resolution, unsigned int tileSize) const {
+    return ActiveRegion(heights, width, height, waterHeight, resolution, tileSize);
+}
+
+ReflectionTable Terrain::reflectionTable(glm::uvec2 resolution, const std::vector<float> &thetas) const {
+    return ReflectionTable(heights, gradients, width, height, waterHeight, resolution, thetas);
+}
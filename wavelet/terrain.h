@@ -0,0 +1,56 @@
+#pragma once
+
+#include "wavelet/activeregion.h"
+#include "wavelet/reflectiontable.h"
+#include "wavelet/setting.h"
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The heightmap the waves run over and the maps derived from it, all on the cpu.
+ *
+ * Nothing here needs a gl context, so the terrain can be loaded on a machine without a gpu
+ * and simulated with CpuSimulator. Environment uploads the maps to the textures the shaders
+ * sample. Every map has the size of the heightmap and is indexed by i + j * width.
+ */
+class Terrain {
+public:
+    /**
+     * @brief Loads the heightmap from an image, the mean of its rgb channels being the height.
+     */
+    Terrain(const std::string &heightMapFilename, const Setting &setting);
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    float getWaterHeight() const { return waterHeight; }
+
+    const std::vector<float> &getHeights() const { return heights; }
+    // sobel gradient of the heights
+    const std::vector<glm::vec2> &getGradients() const { return gradients; }
+    // 1 next to a dry texel, 0 elsewhere
+    const std::vector<float> &getCloseToBoundary() const { return closeToBoundary; }
+    // the height, and the uv of the closest wet texel, where a dry texel takes its amplitude from
+    const std::vector<glm::vec3> &getHeightWithSampleLocationInDomain() const { return heightWithSampleLocationInDomain; }
+
+    /**
+     * @brief The cells of a simulation grid covering the heightmap that are below the water height.
+     */
+    ActiveRegion activeRegion(glm::uvec2 resolution, unsigned int tileSize = 32) const;
+
+    /**
+     * @brief The shoreline cells of a simulation grid covering the heightmap, see ReflectionTable.
+     */
+    ReflectionTable reflectionTable(glm::uvec2 resolution, const std::vector<float> &thetas) const;
+
+private:
+    int width, height;
+    float waterHeight;
+
+    std::vector<float> heights;
+    std::vector<glm::vec2> gradients;
+    std::vector<float> gradientTheta;
+    std::vector<float> closeToBoundary;
+    std::vector<glm::ivec2> closestOnBoundary;
+    std::vector<glm::vec3> heightWithSampleLocationInDomain;
+};
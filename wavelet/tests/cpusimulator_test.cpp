@@ -0,0 +1,229 @@
+// Checks that CpuSimulator steps the same as Shaders/waveletgrid_simulationStep.frag: both start
+// from the same amplitudes over the terrain of the application, take the same steps, and the wet
+// cells have to agree within tolerance of the largest amplitude of every band. The longest stable
+// steps move the long waves by about a cell, but the viscosity takes out the shortest band in one
+// of them, so that band is checked with short steps.
+//
+// The shader runs in the Simulator of the application, in a GL context without a window from
+// EGL. Where there is none, the cpu is compared with a readback of the shader saved by
+//     cpusimulator_test wavelet/tests/data/cpusimulator_readback.bin --save
+// run from the repository root on a machine with GL, which has to be redone when the step changes.
+
+#include "wavelet/cpusimulator.h"
+#include "wavelet/terrain.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef WAVELET_HAS_EGL
+#include "wavelet/environment.h"
+#include "wavelet/simulator.h"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+namespace {
+    constexpr int resolution = 64, thetaResolution = 8;
+    constexpr int steps = 8;
+    const char *const heightMapFilename = "Blender/geometryHeight.png";
+    const char *const meshFilename = "Blender/geometry.obj";
+
+    // The gpu filters with 8 bits of the texel fraction where the cpu interpolates in fp32, so every
+    // sample may be off by up to 2^-9 of the difference between its texels, and the monotone cubic
+    // switches to flat where the two land on different sides of its 0.0001 threshold
+    constexpr float tolerance = 0.01f;
+
+    // 0 for the longest stable step
+    const float stepSizes[] = {0, 0.002f};
+
+    Setting makeSetting() {
+        Setting setting;
+        setting.simulationResolution = {resolution, resolution, thetaResolution, 4};
+        return setting;
+    }
+
+    // a bump in the open water on top of the ambient waves, different for every direction and band
+    std::vector<glm::vec4> initialAmplitudes(int i_theta) {
+        std::vector<glm::vec4> amplitudes((size_t) resolution * resolution);
+        for (int y = 0; y < resolution; y++)
+            for (int x = 0; x < resolution; x++) {
+                const float u = (x + 0.5f) / resolution - 0.3f, v = (y + 0.5f) / resolution - 0.3f;
+                const float bump = std::exp(-(u * u + v * v) / 0.01f);
+                for (int i_k = 0; i_k < 4; i_k++)
+                    amplitudes[x + (size_t) y * resolution][i_k] =
+                        0.1f + bump * (1 + 0.5f * std::sin(0.7f * i_theta + 1.3f * i_k));
+            }
+        return amplitudes;
+    }
+
+    using Readback = std::vector<std::vector<glm::vec4>>;
+
+    Readback cpuStep(std::shared_ptr<const Terrain> terrain, float deltaTime) {
+        CpuSimulator simulator(makeSetting(), terrain);
+        simulator.setThreadCount(1);
+        for (int i_theta = 0; i_theta < thetaResolution; i_theta++)
+            simulator.setAmplitudes(i_theta, initialAmplitudes(i_theta));
+        for (int step = 0; step < steps; step++) simulator.takeStep(deltaTime);
+
+        Readback amplitudes(thetaResolution);
+        for (int i_theta = 0; i_theta < thetaResolution; i_theta++)
+            amplitudes[i_theta] = simulator.getAmplitudes(i_theta);
+        return amplitudes;
+    }
+
+#ifdef WAVELET_HAS_EGL
+    // a core 3.3 context without a surface, the version the shaders are written for
+    bool makeHeadlessContext() {
+        auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+        EGLDisplay display = getPlatformDisplay
+            ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr)
+            : eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr)) return false;
+        if (!eglBindAPI(EGL_OPENGL_API)) return false;
+
+        const EGLint attributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 3,
+            EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE,
+        };
+        EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+        if (context == EGL_NO_CONTEXT) return false;
+        if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) return false;
+        if (!gladLoadGLLoader((GLADloadproc) eglGetProcAddress)) return false;
+        std::printf("stepping the shader on %s\n", glGetString(GL_RENDERER));
+        return true;
+    }
+
+    Readback gpuStep(std::shared_ptr<Environment> environment, float deltaTime) {
+        Simulator simulator(makeSetting(), environment);
+
+        std::vector<std::shared_ptr<Texture>> textures = simulator.getAmplitudeTextures();
+        for (int i_theta = 0; i_theta < thetaResolution; i_theta++) {
+            glBindTexture(GL_TEXTURE_2D, textures[i_theta]->getHandle());
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, resolution, resolution, GL_RGBA, GL_FLOAT,
+                    initialAmplitudes(i_theta).data());
+        }
+        for (int step = 0; step < steps; step++) simulator.takeStep(deltaTime);
+
+        Readback amplitudes(thetaResolution, std::vector<glm::vec4>((size_t) resolution * resolution));
+        textures = simulator.getAmplitudeTextures();
+        for (int i_theta = 0; i_theta < thetaResolution; i_theta++) {
+            glBindTexture(GL_TEXTURE_2D, textures[i_theta]->getHandle());
+            glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, amplitudes[i_theta].data());
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return amplitudes;
+    }
+#endif
+
+    // the readbacks of every step size one after the other, the images of every theta as fp32 rgba
+    bool load(const std::string &filename, std::vector<Readback> &readbacks) {
+        std::ifstream file(filename, std::ios::binary);
+        readbacks.assign(std::size(stepSizes),
+                Readback(thetaResolution, std::vector<glm::vec4>((size_t) resolution * resolution)));
+        for (Readback &amplitudes : readbacks)
+            for (std::vector<glm::vec4> &image : amplitudes)
+                file.read(reinterpret_cast<char *>(image.data()), image.size() * sizeof(glm::vec4));
+        return file.good() && file.peek() == std::ifstream::traits_type::eof();
+    }
+
+    bool save(const std::string &filename, const std::vector<Readback> &readbacks) {
+        std::ofstream file(filename, std::ios::binary);
+        for (const Readback &amplitudes : readbacks)
+            for (const std::vector<glm::vec4> &image : amplitudes)
+                file.write(reinterpret_cast<const char *>(image.data()), image.size() * sizeof(glm::vec4));
+        return file.good();
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::printf("usage: %s <reference readback> [--save]\n", argv[0]);
+        return 1;
+    }
+    const std::string referenceFilename = argv[1];
+    const bool saveReference = argc > 2 && !std::strcmp(argv[2], "--save");
+
+    const Setting setting = makeSetting();
+    auto terrain = std::make_shared<const Terrain>(heightMapFilename, setting);
+    std::vector<float> deltaTimes;
+    for (float stepSize : stepSizes)
+        deltaTimes.push_back(stepSize ? stepSize : CpuSimulator(setting, terrain).maxStableTimeStep());
+
+    std::vector<Readback> gpu;
+#ifdef WAVELET_HAS_EGL
+    if (makeHeadlessContext()) {
+        auto environment = std::make_shared<Environment>(heightMapFilename, meshFilename, setting);
+        for (float deltaTime : deltaTimes) gpu.push_back(gpuStep(environment, deltaTime));
+    }
+#endif
+    const bool stepped = !gpu.empty();
+    if (saveReference) {
+        if (!stepped || !save(referenceFilename, gpu)) {
+            std::printf("no shader readback to save to %s\n", referenceFilename.c_str());
+            return 1;
+        }
+        std::printf("saved the shader readback to %s\n", referenceFilename.c_str());
+        return 0;
+    }
+    if (!stepped) {
+        if (!load(referenceFilename, gpu)) {
+            std::printf("no gl context, and no readback in %s\n", referenceFilename.c_str());
+            return 1;
+        }
+        std::printf("no gl context, comparing with the readback in %s\n", referenceFilename.c_str());
+    }
+
+    // the gpu leaves the dry cells of the wet tiles unwritten, so only the water is compared
+    const std::vector<glm::vec3> &heights = terrain->getHeightWithSampleLocationInDomain();
+    auto wet = [&](int x, int y) {
+        const int i = std::min<int>((x + 0.5f) / resolution * terrain->getWidth(), terrain->getWidth() - 1);
+        const int j = std::min<int>((y + 0.5f) / resolution * terrain->getHeight(), terrain->getHeight() - 1);
+        return heights[i + (size_t) j * terrain->getWidth()].r <= terrain->getWaterHeight();
+    };
+
+    int failures = 0;
+    for (size_t run = 0; run < deltaTimes.size(); run++) {
+        const Readback cpu = cpuStep(terrain, deltaTimes[run]);
+        for (int i_k = 0; i_k < 4; i_k++) {
+            float maxAmplitude = 0, maxDifference = 0, maxChange = 0;
+            for (int i_theta = 0; i_theta < thetaResolution; i_theta++) {
+                const std::vector<glm::vec4> initial = initialAmplitudes(i_theta);
+                for (int y = 0; y < resolution; y++)
+                    for (int x = 0; x < resolution; x++) {
+                        if (!wet(x, y)) continue;
+                        const size_t cell = x + (size_t) y * resolution;
+                        const float amplitude = cpu[i_theta][cell][i_k];
+                        maxAmplitude = std::max(maxAmplitude, std::abs(amplitude));
+                        maxDifference = std::max(maxDifference, std::abs(amplitude - gpu[run][i_theta][cell][i_k]));
+                        maxChange = std::max(maxChange, std::abs(amplitude - initial[cell][i_k]));
+                    }
+            }
+
+            std::printf("band %d, %d steps of %g: the cpu and the shader differ by %.3g of %.3g, the steps moved "
+                    "the amplitudes by %.3g\n", i_k, steps, deltaTimes[run], maxDifference, maxAmplitude, maxChange);
+            if (!(maxDifference <= tolerance * maxAmplitude)) {
+                std::printf("band %d, steps of %g: off by %g, more than %g of the largest amplitude\n", i_k,
+                        deltaTimes[run], maxDifference / maxAmplitude, tolerance);
+                failures++;
+            }
+            // a step that does nothing would agree as well
+            if (!(maxChange > 10 * tolerance * maxAmplitude)) {
+                std::printf("band %d, steps of %g: the steps only moved the amplitudes by %g\n", i_k,
+                        deltaTimes[run], maxChange);
+                failures++;
+            }
+        }
+    }
+
+    if (failures) std::printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
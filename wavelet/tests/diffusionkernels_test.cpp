@@ -0,0 +1,291 @@
+// Checks every row kernel that the cpu can run against diffuseRowScalar. The variants are all
+// built with -ffp-contract=off and evaluate the same float operations in the same order, so they
+// have to match bit for bit: the allowed error is 0 ulps.
+//
+// Also checks the batched implicit solvers against a dense solve of the same systems in double,
+// and SpectralDecay against the decay integrated in fine steps.
+
+#include "wavelet/diffusionkernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace {
+    constexpr unsigned int maxUlps = 0;
+    // the largest error of the solvers relative to the largest solution: a few roundings of fp32
+    // times the condition number of the systems, which is up to 1 + 4r. The periodic systems get
+    // there, their mean is all that is left of the right hand side for large r
+    double maxSolveError(float r) {
+        return 8 * 0x1p-24 * (1 + 4 * (double) r);
+    }
+
+    // distance in units in the last place, for finite floats of the same sign
+    unsigned int ulps(float a, float b) {
+        std::int32_t ia, ib;
+        std::memcpy(&ia, &a, sizeof(a));
+        std::memcpy(&ib, &b, sizeof(b));
+        return ia > ib ? ia - ib : ib - ia;
+    }
+
+    struct Row {
+        // the rows of the stencil, every one with a sample to spare on either side
+        std::vector<float> center, yPrev, yNext, thetaPrev, thetaNext;
+
+        Row(unsigned int length, std::mt19937 &random) {
+            std::uniform_real_distribution<float> amplitude(0.0f, 2.0f);
+            for (std::vector<float> *row : {&center, &yPrev, &yNext, &thetaPrev, &thetaNext}) {
+                row->resize(length + 2);
+                for (float &value : *row) value = amplitude(random);
+            }
+        }
+
+        DiffusionKernels::Rows rows(float *out) const {
+            return {center.data() + 1, yPrev.data() + 1, yNext.data() + 1, thetaPrev.data() + 1, thetaNext.data() + 1,
+                out};
+        }
+    };
+
+    // the largest error of SpectralDecay relative to the largest value, a few roundings of fp32 for
+    // every stage of the fft and the transforms there and back. The worst case here is 1.7e-7
+    constexpr double maxDecayError = 1e-6;
+
+    // solves the n x n system a x = b by gaussian elimination with partial pivoting, a row major
+    std::vector<double> denseSolve(std::vector<double> a, std::vector<double> b, unsigned int n) {
+        for (unsigned int column = 0; column < n; column++) {
+            unsigned int pivot = column;
+            for (unsigned int row = column + 1; row < n; row++)
+                if (std::abs(a[row * n + column]) > std::abs(a[pivot * n + column])) pivot = row;
+            for (unsigned int i = 0; i < n; i++) std::swap(a[column * n + i], a[pivot * n + i]);
+            std::swap(b[column], b[pivot]);
+            for (unsigned int row = column + 1; row < n; row++) {
+                const double factor = a[row * n + column] / a[column * n + column];
+                for (unsigned int i = column; i < n; i++) a[row * n + i] -= factor * a[column * n + i];
+                b[row] -= factor * b[column];
+            }
+        }
+        for (unsigned int row = n; row-- > 0;) {
+            for (unsigned int i = row + 1; i < n; i++) b[row] -= a[row * n + i] * b[i];
+            b[row] /= a[row * n + row];
+        }
+        return b;
+    }
+
+    // the error of the batch of solutions d against the dense solve of every system, relative to
+    // the largest solution. matrix(b) is the matrix of system b
+    template <typename Matrix>
+    double solveError(const std::vector<float> &rhs, const std::vector<float> &d, unsigned int n, unsigned int batch,
+            Matrix matrix) {
+        double maxError = 0, maxSolution = 0;
+        for (unsigned int b = 0; b < batch; b++) {
+            std::vector<double> system(n);
+            for (unsigned int i = 0; i < n; i++) system[i] = rhs[(size_t) i * batch + b];
+            const std::vector<double> expected = denseSolve(matrix(b), system, n);
+            for (unsigned int i = 0; i < n; i++) {
+                maxError = std::max(maxError, std::abs(d[(size_t) i * batch + b] - expected[i]));
+                maxSolution = std::max(maxSolution, std::abs(expected[i]));
+            }
+        }
+        return maxSolution > 0 ? maxError / maxSolution : maxError;
+    }
+
+    // dx/dt = r (x[i - 1] - 2 x[i] + x[i + 1]) integrated over a unit of time with rk4 in double,
+    // in steps short enough that the error is far below fp32
+    std::vector<double> fineDecay(std::vector<double> x, unsigned int n, double r) {
+        const unsigned int steps = std::max(1000u, (unsigned int) std::ceil(200 * r));
+        const double h = 1.0 / steps;
+        auto derivative = [&](const std::vector<double> &x) {
+            std::vector<double> dx(n);
+            for (unsigned int i = 0; i < n; i++)
+                dx[i] = r * (x[(i + n - 1) % n] - 2 * x[i] + x[(i + 1) % n]);
+            return dx;
+        };
+        auto shifted = [&](const std::vector<double> &dx, double scale) {
+            std::vector<double> y = x;
+            for (unsigned int i = 0; i < n; i++) y[i] += scale * dx[i];
+            return y;
+        };
+        for (unsigned int step = 0; step < steps; step++) {
+            const std::vector<double> k1 = derivative(x);
+            const std::vector<double> k2 = derivative(shifted(k1, h / 2));
+            const std::vector<double> k3 = derivative(shifted(k2, h / 2));
+            const std::vector<double> k4 = derivative(shifted(k3, h));
+            for (unsigned int i = 0; i < n; i++) x[i] += h / 6 * (k1[i] + 2 * k2[i] + 2 * k3[i] + k4[i]);
+        }
+        return x;
+    }
+}
+
+int main() {
+    using namespace DiffusionKernels;
+
+    const Isa widest = detectIsa();
+    std::printf("widest instruction set: %s\n", isaName(widest));
+
+    int failures = 0;
+
+    // every variant up to the widest one is dispatched to its own kernel
+    const RowKernel kernels[] = {diffuseRowScalar, diffuseRowSSE4, diffuseRowAVX2, diffuseRowAVX512};
+    for (int isa = 0; isa <= (int) widest; isa++) {
+        if (rowKernel((Isa) isa) != kernels[isa]) {
+            std::printf("rowKernel(%s) is not the %s kernel\n", isaName((Isa) isa), isaName((Isa) isa));
+            failures++;
+        }
+    }
+    if (rowKernel(Isa::AVX512) != kernels[(int) widest]) {
+        std::printf("rowKernel(AVX-512) doesn't fall back to %s\n", isaName(widest));
+        failures++;
+    }
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    // lengths around every vector width, begin and end away from the row ends so that the
+    // vector loop starts unaligned and leaves a tail
+    const unsigned int lengths[] = {1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 47, 64, 65, 127, 130};
+    const unsigned int margins[] = {0, 1, 3, 5};
+
+    for (int isa = 1; isa <= (int) widest; isa++) {
+        const RowKernel kernel = rowKernel((Isa) isa);
+        int checked = 0;
+
+        for (unsigned int length : lengths) {
+            for (unsigned int beginMargin : margins) {
+                for (unsigned int endMargin : margins) {
+                    if (beginMargin + endMargin >= length) continue;
+                    const unsigned int begin = beginMargin, end = length - endMargin;
+
+                    Row row(length, random);
+                    const float angle = 3.14159265f * unit(random);
+                    Coefficients coefficients;
+                    coefficients.deltaTime = 0.05f + 0.05f * unit(random);
+                    coefficients.advectionSpeed = 2.0f + unit(random);
+                    coefficients.direction = glm::vec2(std::cos(angle), std::sin(angle));
+                    coefficients.delta = 0.1f + 0.1f * unit(random);
+                    coefficients.gamma = 0.2f + 0.2f * unit(random);
+
+                    // the samples outside [begin, end) have to stay as they are
+                    const float untouched = -1234.5f;
+                    std::vector<float> expected(length, untouched), actual(length, untouched);
+                    diffuseRowScalar(coefficients, row.rows(expected.data()), begin, end);
+                    kernel(coefficients, row.rows(actual.data()), begin, end);
+
+                    for (unsigned int x = 0; x < length; x++) {
+                        if (std::signbit(expected[x]) == std::signbit(actual[x]) && ulps(expected[x], actual[x]) <= maxUlps)
+                            continue;
+                        std::printf("%s: length %u, [%u, %u), x %u: %.9g instead of %.9g\n", isaName((Isa) isa), length,
+                                begin, end, x, actual[x], expected[x]);
+                        failures++;
+                        break;
+                    }
+                    checked++;
+                }
+            }
+        }
+        std::printf("%s: %d rows checked\n", isaName((Isa) isa), checked);
+    }
+
+    // the solvers against the dense solve, for diffusion from next to nothing to far past the
+    // stable explicit step
+    const float ratios[] = {0.001f, 0.1f, 0.5f, 4.0f, 100.0f, 10000.0f};
+    std::uniform_real_distribution<float> amplitude(0.0f, 2.0f);
+    int solved = 0;
+    for (unsigned int n : {3u, 4u, 5u, 16u, 33u}) {
+        for (unsigned int batch : {1u, 3u, 8u}) {
+            for (float r : ratios) {
+                std::vector<float> rhs((size_t) n * batch);
+                for (float &value : rhs) value = amplitude(random);
+                std::vector<float> d = rhs, scratch(2 * (size_t) n * batch);
+
+                // dry cells scattered through every system, the first and last unknown fixed
+                std::vector<std::uint8_t> free((size_t) n * batch);
+                for (unsigned int i = 0; i < n; i++)
+                    for (unsigned int b = 0; b < batch; b++)
+                        free[(size_t) i * batch + b] = i > 0 && i + 1 < n && unit(random) > -0.6f;
+                DiffusionKernels::solveDiffusion(r, free.data(), d.data(), scratch.data(), n, batch);
+                const double error = solveError(rhs, d, n, batch, [&](unsigned int b) {
+                    std::vector<double> a((size_t) n * n);
+                    for (unsigned int i = 0; i < n; i++) {
+                        if (!free[(size_t) i * batch + b]) {
+                            a[i * n + i] = 1;
+                            continue;
+                        }
+                        a[i * n + i] = 1 + 2 * (double) r;
+                        a[i * n + i - 1] = a[i * n + i + 1] = -r;
+                    }
+                    return a;
+                });
+                if (!(error <= maxSolveError(r))) {
+                    std::printf("solveDiffusion: n %u, batch %u, r %g: off by %g\n", n, batch, r, error);
+                    failures++;
+                }
+                solved++;
+            }
+        }
+    }
+    for (unsigned int n : {1u, 2u, 3u, 4u, 5u, 8u, 16u, 33u}) {
+        for (unsigned int batch : {1u, 3u, 8u}) {
+            for (float r : ratios) {
+                std::vector<float> rhs((size_t) n * batch);
+                for (float &value : rhs) value = amplitude(random);
+                std::vector<float> d = rhs, scratch(2 * (size_t) n);
+                DiffusionKernels::solvePeriodicDiffusion(r, d.data(), scratch.data(), n, batch);
+                // the neighbours wrap around, for n = 2 both are the other unknown and for n = 1
+                // the unknown itself
+                const double error = solveError(rhs, d, n, batch, [&](unsigned int) {
+                    std::vector<double> a((size_t) n * n);
+                    for (unsigned int i = 0; i < n; i++) {
+                        a[i * n + i] += 1 + 2 * (double) r;
+                        a[i * n + (i + n - 1) % n] -= r;
+                        a[i * n + (i + 1) % n] -= r;
+                    }
+                    return a;
+                });
+                if (!(error <= maxSolveError(r))) {
+                    std::printf("solvePeriodicDiffusion: n %u, batch %u, r %g: off by %g\n", n, batch, r, error);
+                    failures++;
+                }
+                solved++;
+            }
+        }
+    }
+    std::printf("solvers: %d batches checked against the dense solve\n", solved);
+
+    // the fft for powers of two and the circulant matrix for the others, with odd batches that
+    // leave a system without a partner for the imaginary part
+    int decayed = 0;
+    for (unsigned int n : {1u, 2u, 3u, 8u, 12u, 16u, 32u}) {
+        for (unsigned int batch : {1u, 2u, 5u}) {
+            for (float r : {0.001f, 0.1f, 1.0f, 10.0f}) {
+                std::vector<float> d((size_t) n * batch), scratch((size_t) n * (batch + 1));
+                for (float &value : d) value = amplitude(random);
+                const std::vector<float> initial = d;
+                DiffusionKernels::SpectralDecay(n, r).apply(d.data(), scratch.data(), batch);
+
+                double maxError = 0, maxValue = 0;
+                for (unsigned int b = 0; b < batch; b++) {
+                    std::vector<double> x(n);
+                    for (unsigned int i = 0; i < n; i++) x[i] = initial[(size_t) i * batch + b];
+                    const std::vector<double> expected = fineDecay(x, n, r);
+                    for (unsigned int i = 0; i < n; i++) {
+                        maxError = std::max(maxError, std::abs(d[(size_t) i * batch + b] - expected[i]));
+                        maxValue = std::max(maxValue, std::abs(expected[i]));
+                    }
+                }
+                if (!(maxError <= maxDecayError * maxValue)) {
+                    std::printf("SpectralDecay: n %u, batch %u, r %g: off by %g\n", n, batch, r, maxError / maxValue);
+                    failures++;
+                }
+                decayed++;
+            }
+        }
+    }
+    std::printf("SpectralDecay: %d batches checked against the fine steps\n", decayed);
+
+    if (failures) std::printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+// Checks that a DistributedGrid over 2 to 4 shared memory ranks steps to the same amplitudes as a
+// single WaveletGrid over the whole domain. The ghost rows are sized for everything a step reaches,
+// and with the explicit diffusion every cell is computed from the same rows in the same order, so
+// the gathered bands have to match bit for bit.
+
+#include "wavelet/distributedgrid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+namespace {
+    constexpr unsigned int resolutionX = 64, resolutionY = 256, thetaResolution = 8, kResolution = 4;
+    constexpr int steps = 3;
+    const glm::vec4 minParam(-50, -50, 0, 0), maxParam(50, 50, WaveletGrid::tau, 1);
+    const glm::uvec4 resolution(resolutionX, resolutionY, thetaResolution, kResolution);
+
+    struct Variant {
+        const char *name;
+        std::function<void(WaveletGrid &)> configure;
+    };
+
+    const Variant variants[] = {
+        {"fused", [](WaveletGrid &) {}},
+        {"two sweeps", [](WaveletGrid &grid) { grid.setFusedStep(false); }},
+        {"constant displacement", [](WaveletGrid &grid) {
+            grid.setAdvectionMode(AdvectionMode::ConstantDisplacement);
+        }},
+        {"in place", [](WaveletGrid &grid) { grid.setInPlaceStep(true); }},
+        {"quiescent tiles", [](WaveletGrid &grid) { grid.setSkipQuiescentTiles(true); }},
+    };
+
+    // a bump on top of the ambient amplitude, and ripples along y so that every strip differs
+    std::vector<float> band(unsigned int i_k, glm::uvec2 bandResolution) {
+        std::vector<float> rows((size_t) thetaResolution * bandResolution.x * bandResolution.y);
+        for (unsigned int i_theta = 0; i_theta < thetaResolution; i_theta++)
+            for (unsigned int i_y = 0; i_y < bandResolution.y; i_y++)
+                for (unsigned int i_x = 0; i_x < bandResolution.x; i_x++) {
+                    const float x = (i_x + 0.5f) / bandResolution.x, y = (i_y + 0.5f) / bandResolution.y;
+                    const float bump = std::exp(-40 * ((x - 0.5f) * (x - 0.5f) + (y - 0.4f) * (y - 0.4f)));
+                    rows[((size_t) i_theta * bandResolution.y + i_y) * bandResolution.x + i_x] =
+                        0.3f + 2 * bump * (1 + 0.3f * std::sin(17 * x + i_theta + i_k)) +
+                        0.2f * std::sin(31 * y * (i_k + 1) + i_x * 0.7f);
+                }
+        return rows;
+    }
+}
+
+int main() {
+    int failures = 0;
+    for (const Variant &variant : variants) {
+        // the single grid every rank count has to match
+        WaveletGrid reference(minParam, maxParam, resolution);
+        reference.setThreadCount(1);
+        variant.configure(reference);
+        const float deltaTime = reference.maxStableTimeStep();
+        for (unsigned int i_k = 0; i_k < kResolution; i_k++) {
+            const glm::uvec2 bandResolution = reference.getBandResolution(i_k);
+            reference.writeBandRows(i_k, 0, bandResolution.y, band(i_k, bandResolution).data());
+        }
+        for (int step = 0; step < steps; step++) reference.takeStep(deltaTime);
+
+        for (int ranks = 2; ranks <= 4; ranks++) {
+            std::vector<std::vector<float>> gathered(kResolution);
+            runSharedMemoryRanks(ranks, [&](Transport &transport) {
+                DistributedGrid grid(transport, minParam, maxParam, resolution);
+                grid.localGrid().setThreadCount(1);
+                variant.configure(grid.localGrid());
+                for (unsigned int i_k = 0; i_k < kResolution; i_k++) {
+                    const glm::uvec2 bandResolution = grid.getBandResolution(i_k);
+                    grid.writeBandRows(i_k, 0, bandResolution.y, band(i_k, bandResolution).data());
+                }
+                for (int step = 0; step < steps; step++) grid.takeStep(deltaTime);
+
+                for (unsigned int i_k = 0; i_k < kResolution; i_k++) {
+                    const glm::uvec2 bandResolution = grid.getBandResolution(i_k);
+                    if (transport.rank() == 0)
+                        gathered[i_k].resize((size_t) thetaResolution * bandResolution.x * bandResolution.y);
+                    grid.gather(i_k, gathered[i_k].data());
+                }
+            });
+
+            for (unsigned int i_k = 0; i_k < kResolution; i_k++) {
+                const glm::uvec2 bandResolution = reference.getBandResolution(i_k);
+                std::vector<float> expected((size_t) thetaResolution * bandResolution.x * bandResolution.y);
+                reference.readBandRows(i_k, 0, bandResolution.y, expected.data());
+                if (gathered[i_k].size() == expected.size() &&
+                        !std::memcmp(gathered[i_k].data(), expected.data(), expected.size() * sizeof(float)))
+                    continue;
+
+                float maxDifference = 0;
+                for (size_t i = 0; i < std::min(expected.size(), gathered[i_k].size()); i++)
+                    maxDifference = std::max(maxDifference, std::abs(gathered[i_k][i] - expected[i]));
+                std::printf("%s, %d ranks, band %u: off by up to %g\n", variant.name, ranks, i_k, maxDifference);
+                failures++;
+            }
+        }
+        std::printf("%s: 2 to 4 ranks checked\n", variant.name);
+    }
+
+    if (failures) std::printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,93 @@
+// Checks the error of 16-bit amplitude storage against the fp32 reference, see
+// WaveletGrid::amplitudeError: a Gaussian bump is stored with every storage type and stepped for
+// a second, and the difference to the fp32 run has to stay within what the rounding of every
+// store can explain. Also checks that 16-bit storage takes half the memory.
+
+#include "wavelet/waveletgrid.h"
+
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+namespace {
+    constexpr unsigned int resolution = 128, thetaResolution = 8, kResolution = 4;
+    constexpr float deltaTime = 0.05f;
+    constexpr int steps = 20;
+
+    struct Bound {
+        Storage::Type storage;
+        // the largest error of rounding once, relative to the largest amplitude
+        float stored;
+        // the largest error after steps steps, each of which rounds every amplitude again
+        float stepped;
+    };
+
+    // fp16 keeps 11 bits of the mantissa and bfloat16 8, so a store is off by at most 2^-11 and
+    // 2^-8 of the value. The steps average the rounding of their neighbours, so the error grows
+    // far slower than once per step
+    const Bound bounds[] = {
+        {Storage::Type::Float16, 0x1p-11f, 0.005f},
+        {Storage::Type::BFloat16, 0x1p-8f, 0.04f},
+    };
+
+    std::unique_ptr<WaveletGrid> makeGrid() {
+        // no ambient waves, which ring at the edges of the fp32 run with rounding noise that 16-bit
+        // storage flushes, so the error would measure the noise of the reference
+        Setting setting;
+        setting.ambientStrength = 0;
+        auto grid = std::make_unique<WaveletGrid>(glm::vec4(-50, -50, 0, 0), glm::vec4(50, 50, WaveletGrid::tau, 1),
+                glm::uvec4(resolution, resolution, thetaResolution, kResolution), setting);
+        std::vector<float> rows((size_t) resolution * resolution * thetaResolution);
+        for (unsigned int i_k = 0; i_k < kResolution; i_k++) {
+            for (unsigned int i_theta = 0; i_theta < thetaResolution; i_theta++)
+                for (unsigned int i_y = 0; i_y < resolution; i_y++)
+                    for (unsigned int i_x = 0; i_x < resolution; i_x++) {
+                        const float x = (i_x + 0.5f) / resolution - 0.5f, y = (i_y + 0.5f) / resolution - 0.5f;
+                        rows[(i_theta * resolution + i_y) * resolution + i_x] = std::exp(-(x * x + y * y) / 0.02f);
+                    }
+            grid->writeBandRows(i_k, 0, resolution, rows.data());
+        }
+        return grid;
+    }
+}
+
+int main() {
+    int failures = 0;
+
+    std::unique_ptr<WaveletGrid> reference = makeGrid();
+    const std::unique_ptr<WaveletGrid> initial = makeGrid();
+    for (int step = 0; step < steps; step++) reference->takeStep(deltaTime);
+
+    for (const Bound &bound : bounds) {
+        std::unique_ptr<WaveletGrid> grid = makeGrid();
+        grid->setStorage(bound.storage);
+
+        if (2 * grid->amplitudeBytes() != reference->amplitudeBytes()) {
+            std::printf("%s: %zu bytes instead of half of %zu\n", Storage::name(bound.storage), grid->amplitudeBytes(),
+                    reference->amplitudeBytes());
+            failures++;
+        }
+
+        const AmplitudeError stored = grid->amplitudeError(*initial);
+        for (int step = 0; step < steps; step++) grid->takeStep(deltaTime);
+        const AmplitudeError stepped = grid->amplitudeError(*reference);
+
+        std::printf("%s: stored max %.3g rms %.3g, after %d steps max %.3g rms %.3g of %.3g\n",
+                Storage::name(bound.storage), stored.maxRelative, stored.rms, steps, stepped.maxRelative, stepped.rms,
+                stepped.referenceMax);
+        if (stored.maxRelative > bound.stored) {
+            std::printf("%s: storing is off by %g, more than %g\n", Storage::name(bound.storage), stored.maxRelative,
+                    bound.stored);
+            failures++;
+        }
+        if (!(stepped.maxRelative <= bound.stepped)) {
+            std::printf("%s: stepping is off by %g, more than %g\n", Storage::name(bound.storage), stepped.maxRelative,
+                    bound.stepped);
+            failures++;
+        }
+    }
+
+    if (failures) std::printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,95 @@
+// Checks that the way the steps are spread over threads doesn't change what they compute: every
+// thread count, tile size and scheduler has to step a grid to the same amplitudes as one thread
+// with the default tiles, bit for bit, for both sweeps and the fused step and both advection modes.
+
+#include "wavelet/waveletgrid.h"
+
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace {
+    constexpr unsigned int resolution = 64, thetaResolution = 8, kResolution = 4;
+    constexpr float deltaTime = 0.05f;
+    constexpr int steps = 3;
+
+    struct Variant {
+        int threadCount;
+        Scheduler scheduler;
+        unsigned int tileRows, tileColumns;
+        bool inPlaceStep;
+    };
+
+    const Variant variants[] = {
+        {2, Scheduler::OpenMP, 16, 32, false},
+        {4, Scheduler::OpenMP, 16, 32, false},
+        {3, Scheduler::OpenMP, 1, 1, false},
+        {4, Scheduler::OpenMP, 7, 13, false},
+        {4, Scheduler::OpenMP, 64, 64, false},
+        {2, Scheduler::WorkStealing, 16, 32, false},
+        {4, Scheduler::WorkStealing, 5, 9, false},
+        {1, Scheduler::OpenMP, 16, 32, true},
+        {4, Scheduler::OpenMP, 4, 32, true},
+    };
+
+    struct Kernel {
+        const char *name;
+        AdvectionMode advectionMode;
+        bool fusedStep;
+    };
+
+    const Kernel kernels[] = {
+        {"interpolated", AdvectionMode::Interpolated, false},
+        {"constant displacement", AdvectionMode::ConstantDisplacement, false},
+        {"fused", AdvectionMode::Interpolated, true},
+    };
+
+    std::unique_ptr<WaveletGrid> makeGrid(const Kernel &kernel) {
+        auto grid = std::make_unique<WaveletGrid>(glm::vec4(-50, -50, 0, 0), glm::vec4(50, 50, WaveletGrid::tau, 1),
+                glm::uvec4(resolution, resolution, thetaResolution, kResolution));
+        grid->setSamplesPerWavelength(0);
+        grid->setSkipQuiescentTiles(false);
+        grid->setAdvectionMode(kernel.advectionMode);
+        grid->setFusedStep(kernel.fusedStep);
+
+        std::mt19937 random(1);
+        std::uniform_real_distribution<float> amplitude(0.0f, 1.0f);
+        for (unsigned int i_k = 0; i_k < kResolution; i_k++) {
+            std::vector<float> rows((size_t) resolution * resolution * thetaResolution);
+            for (float &value : rows) value = amplitude(random);
+            grid->writeBandRows(i_k, 0, resolution, rows.data());
+        }
+        return grid;
+    }
+}
+
+int main() {
+    int failures = 0;
+    for (const Kernel &kernel : kernels) {
+        std::unique_ptr<WaveletGrid> reference = makeGrid(kernel);
+        reference->setThreadCount(1);
+        for (int step = 0; step < steps; step++) reference->takeStep(deltaTime);
+
+        for (const Variant &variant : variants) {
+            std::unique_ptr<WaveletGrid> grid = makeGrid(kernel);
+            grid->setThreadCount(variant.threadCount);
+            grid->setScheduler(variant.scheduler);
+            grid->setTileSize(variant.tileRows, variant.tileColumns);
+            grid->setInPlaceStep(variant.inPlaceStep);
+            for (int step = 0; step < steps; step++) grid->takeStep(deltaTime);
+
+            const AmplitudeError error = grid->amplitudeError(*reference);
+            if (error.maxAbsolute == 0) continue;
+            std::printf("%s, %d threads, %s, %ux%u tiles%s: off by up to %g\n", kernel.name, variant.threadCount,
+                    variant.scheduler == Scheduler::WorkStealing ? "work stealing" : "openmp", variant.tileRows,
+                    variant.tileColumns, variant.inPlaceStep ? ", in place" : "", error.maxAbsolute);
+            failures++;
+        }
+        std::printf("%s: %zu variants checked\n", kernel.name, std::size(variants));
+    }
+
+    if (failures) std::printf("%d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,58 @@
+// Runs the simulation of the application without a window or a gpu, with CpuSimulator over the
+// terrain of Blender/geometryHeight.png, and prints how long every frame took to simulate.
+//
+//   wavelet_headless [resolution = 512] [frames = 60] [threads = 0] [output]
+//
+// Run from the repository root. Every frame advances by 1/60 s from still water, so the ambient
+// waves come in from the edges, and threads 0 is the OpenMP default. The amplitudes at the end
+// are written to output if given, the images of every theta one after the other as fp32 rgba,
+// indexed by x + y * resolution, the way the amplitude textures of Simulator hold them.
+
+#include "wavelet/cpusimulator.h"
+#include "wavelet/terrain.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+int main(int argc, char **argv) {
+    const int resolution = argc > 1 ? std::atoi(argv[1]) : 512;
+    const int frames = argc > 2 ? std::atoi(argv[2]) : 60;
+    const int threads = argc > 3 ? std::atoi(argv[3]) : 0;
+    const char *output = argc > 4 ? argv[4] : nullptr;
+    constexpr float frameInterval = 1.0f / 60;
+
+    Setting setting;
+    setting.simulationResolution = {resolution, resolution, 8, 4};
+    auto terrain = std::make_shared<const Terrain>("Blender/geometryHeight.png", setting);
+
+    CpuSimulator simulator(setting, terrain);
+    simulator.setThreadCount(threads);
+    simulator.reset();
+
+    double total = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        const auto start = std::chrono::steady_clock::now();
+        simulator.advance(frameInterval);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        total += seconds;
+        std::printf("frame %d: %.2f ms\n", frame, seconds * 1e3);
+    }
+    if (frames > 0) std::printf("%d frames of %dx%d: %.2f ms a frame\n", frames, resolution, resolution, total / frames * 1e3);
+
+    if (output) {
+        std::ofstream file(output, std::ios::binary);
+        for (int i_theta = 0; i_theta < setting.simulationResolution[2]; i_theta++) {
+            const std::vector<glm::vec4> &amplitudes = simulator.getAmplitudes(i_theta);
+            file.write(reinterpret_cast<const char *>(amplitudes.data()), amplitudes.size() * sizeof(glm::vec4));
+        }
+        if (!file) {
+            std::printf("could not write %s\n", output);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include "topology.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    // a cpulist such as "0-3,8-11"
+    std::vector<int> parseCpuList(const std::string &list) {
+        std::vector<int> cpus;
+        std::stringstream stream(list);
+        std::string range;
+        while (std::getline(stream, range, ',')) {
+            if (range.empty() || range == "\n") continue;
+            const size_t dash = range.find('-');
+            const int first = std::stoi(range.substr(0, dash));
+            const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++)
+                cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    std::vector<std::vector<int>> readNodes() {
+        std::vector<int> allowed;
+#ifdef __linux__
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                if (CPU_ISSET(cpu, &set)) allowed.push_back(cpu);
+        }
+#endif
+        if (allowed.empty()) {
+            for (unsigned int cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++)
+                allowed.push_back(cpu);
+        }
+
+        std::vector<std::vector<int>> nodes;
+        for (int node = 0;; node++) {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            std::string list;
+            // the nodes are numbered without gaps on every system seen so far
+            if (!file || !std::getline(file, list)) break;
+
+            std::vector<int> cpus;
+            for (int cpu : parseCpuList(list))
+                if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) cpus.push_back(cpu);
+            nodes.push_back(cpus);
+        }
+        if (nodes.empty()) nodes.push_back(allowed);
+        return nodes;
+    }
+}
+
+const std::vector<std::vector<int>> &Topology::nodes(){
+    static const std::vector<std::vector<int>> nodes = readNodes();
+    return nodes;
+}
+
+int Topology::nodeOf(int cpu){
+    const std::vector<std::vector<int>> &all = nodes();
+    for (size_t node = 0; node < all.size(); node++)
+        if (std::find(all[node].begin(), all[node].end(), cpu) != all[node].end()) return node;
+    return 0;
+}
+
+std::vector<int> Topology::threadCpus(Affinity affinity){
+    std::vector<int> cpus;
+    if (affinity == Affinity::None) return cpus;
+
+    std::vector<std::vector<int>> withCpus;
+    for (const std::vector<int> &node : nodes())
+        if (!node.empty()) withCpus.push_back(node);
+
+    if (affinity == Affinity::Compact) {
+        for (const std::vector<int> &node : withCpus)
+            cpus.insert(cpus.end(), node.begin(), node.end());
+    } else {
+        // round robin over the nodes, the i-th cpu of every node before the (i + 1)-th
+        for (size_t i = 0;; i++) {
+            bool any = false;
+            for (const std::vector<int> &node : withCpus) {
+                if (i >= node.size()) continue;
+                cpus.push_back(node[i]);
+                any = true;
+            }
+            if (!any) break;
+        }
+    }
+    return cpus;
+}
+
+bool Topology::pinThread(int cpu){
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+bool Topology::pinThread(std::thread &thread, int cpu){
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+std::vector<std::size_t> Topology::residentBytes(const void *block, std::size_t bytes){
+    std::vector<std::size_t> resident;
+#ifdef __linux__
+    const std::size_t pageSize = sysconf(_SC_PAGESIZE);
+    const std::uintptr_t begin = reinterpret_cast<std::uintptr_t>(block) / pageSize * pageSize;
+    const std::uintptr_t end = reinterpret_cast<std::uintptr_t>(block) + bytes;
+
+    // move_pages without target nodes only reports where the pages are, in batches
+    constexpr std::size_t batch = 4096;
+    std::vector<void *> pages;
+    std::vector<int> status;
+    for (std::uintptr_t page = begin; page < end;) {
+        pages.clear();
+        for (; page < end && pages.size() < batch; page += pageSize)
+            pages.push_back(reinterpret_cast<void *>(page));
+        status.assign(pages.size(), 0);
+        if (syscall(SYS_move_pages, 0, pages.size(), pages.data(), nullptr, status.data(), 0) != 0) return {};
+
+        for (size_t i = 0; i < pages.size(); i++) {
+            // negative for pages that are not resident
+            if (status[i] < 0) continue;
+            if ((size_t) status[i] >= resident.size()) resident.resize(status[i] + 1, 0);
+            const std::uintptr_t pageBegin = std::max(reinterpret_cast<std::uintptr_t>(pages[i]), reinterpret_cast<std::uintptr_t>(block));
+            const std::uintptr_t pageEnd = std::min(reinterpret_cast<std::uintptr_t>(pages[i]) + pageSize, end);
+            resident[status[i]] += pageEnd - pageBegin;
+        }
+    }
+#endif
+    return resident;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/**
+ * The NUMA nodes of the machine and the cpus they hold, read from /sys/devices/system/node.
+ * A machine without that information, or any other system than linux, has a single node with
+ * every cpu the process may run on.
+ *
+ * The step sweeps touch the same rows with the same thread every step, so once every thread is
+ * pinned and the rows are first written by the thread that steps them, every thread streams its
+ * rows from the memory of its own node.
+ */
+namespace Topology {
+
+    enum class Affinity {
+        // the threads run wherever the system puts them
+        None = 0,
+        // thread i on the i-th cpu, filling one node before the next
+        Compact = 1,
+        // thread i on node i % nodes, so that few threads share the bandwidth of a node
+        Scatter = 2,
+    };
+
+    /**
+     * @brief The cpus of every node that the process may run on, indexed by node. Nodes with
+     * none of them, e.g. memory only nodes, are empty.
+     */
+    const std::vector<std::vector<int>> &nodes();
+
+    /**
+     * @brief The node holding cpu, 0 if it is not known.
+     */
+    int nodeOf(int cpu);
+
+    /**
+     * @brief The cpus that threads 0, 1, ... are pinned to under affinity, the i-th thread on
+     * cpus[i % cpus.size()]. Empty for Affinity::None.
+     */
+    std::vector<int> threadCpus(Affinity affinity);
+
+    /**
+     * @brief Pins the calling thread, or thread, to cpu. Returns false if the system refused.
+     */
+    bool pinThread(int cpu);
+    bool pinThread(std::thread &thread, int cpu);
+
+    /**
+     * @brief The bytes of [block, block + bytes) that are resident on every node, indexed by node.
+     * Pages that were never touched count for no node. Empty if the system can't tell.
+     */
+    std::vector<std::size_t> residentBytes(const void *block, std::size_t bytes);
+}
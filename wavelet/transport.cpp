@@ -0,0 +1,316 @@
+#include "transport.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+/**
+ * @brief Throws a runtime_error about what failed, with the description of errno.
+ */
+[[noreturn]] static void fail(const std::string &what) {
+    throw std::runtime_error("TcpTransport: " + what + ": " + std::strerror(errno));
+}
+
+void Transport::barrier(){
+    // everyone checks in with rank 0, which lets them go once all did
+    char token = 0;
+    if (rank() == 0) {
+        for (int peer = 1; peer < size(); peer++) receive(peer, &token, 1);
+        for (int peer = 1; peer < size(); peer++) send(peer, &token, 1);
+    } else {
+        send(0, &token, 1);
+        receive(0, &token, 1);
+    }
+}
+
+// shared memory
+
+std::vector<std::unique_ptr<SharedMemoryTransport>> SharedMemoryTransport::createGroup(int size){
+    auto mailboxes = std::make_shared<Mailboxes>();
+    mailboxes->size = size;
+    mailboxes->messages.resize((size_t) size * size);
+
+    std::vector<std::unique_ptr<SharedMemoryTransport>> group;
+    for (int rank = 0; rank < size; rank++)
+        group.push_back(std::unique_ptr<SharedMemoryTransport>(new SharedMemoryTransport(rank, mailboxes)));
+    return group;
+}
+
+SharedMemoryTransport::SharedMemoryTransport(int rank, std::shared_ptr<Mailboxes> mailboxes)
+    : m_rank(rank), m_mailboxes(std::move(mailboxes))
+{
+}
+
+int SharedMemoryTransport::size() const {
+    return m_mailboxes->size;
+}
+
+void SharedMemoryTransport::send(int peer, const void *data, size_t bytes){
+    const char *begin = static_cast<const char *>(data);
+    std::vector<char> message(begin, begin + bytes);
+    {
+        std::lock_guard<std::mutex> lock(m_mailboxes->mutex);
+        m_mailboxes->messages[(size_t) m_rank * m_mailboxes->size + peer].push_back(std::move(message));
+    }
+    m_mailboxes->arrived.notify_all();
+}
+
+void SharedMemoryTransport::receive(int peer, void *data, size_t bytes){
+    std::unique_lock<std::mutex> lock(m_mailboxes->mutex);
+    std::deque<std::vector<char>> &messages = m_mailboxes->messages[(size_t) peer * m_mailboxes->size + m_rank];
+    m_mailboxes->arrived.wait(lock, [&]() { return !messages.empty() || m_mailboxes->aborted; });
+    if (m_mailboxes->aborted) throw std::runtime_error("SharedMemoryTransport: the group was aborted");
+
+    std::vector<char> message = std::move(messages.front());
+    messages.pop_front();
+    lock.unlock();
+
+    if (message.size() != bytes)
+        throw std::runtime_error("SharedMemoryTransport: expected " + std::to_string(bytes) + " bytes from rank " +
+                std::to_string(peer) + " but got " + std::to_string(message.size()));
+    std::memcpy(data, message.data(), bytes);
+}
+
+void SharedMemoryTransport::exchange(int peer, const void *sendData, size_t sendBytes, void *receiveData,
+        size_t receiveBytes){
+    send(peer, sendData, sendBytes);
+    receive(peer, receiveData, receiveBytes);
+}
+
+void SharedMemoryTransport::abort(){
+    {
+        std::lock_guard<std::mutex> lock(m_mailboxes->mutex);
+        m_mailboxes->aborted = true;
+    }
+    m_mailboxes->arrived.notify_all();
+}
+
+void runSharedMemoryRanks(int size, const std::function<void(Transport &)> &body){
+    std::vector<std::unique_ptr<SharedMemoryTransport>> group = SharedMemoryTransport::createGroup(size);
+    std::vector<std::exception_ptr> errors(size);
+
+    std::vector<std::thread> ranks;
+    for (int rank = 0; rank < size; rank++) {
+        ranks.emplace_back([&, rank]() {
+            try {
+                body(*group[rank]);
+            } catch (...) {
+                errors[rank] = std::current_exception();
+                // the other ranks may be waiting for this one
+                group[rank]->abort();
+            }
+        });
+    }
+    for (std::thread &rank : ranks)
+        rank.join();
+
+    for (std::exception_ptr &error : errors)
+        if (error) std::rethrow_exception(error);
+}
+
+// tcp
+
+TcpTransport::TcpTransport(int rank, int size, uint16_t basePort, float timeoutSeconds)
+    : m_rank(rank), m_sockets(size, -1)
+{
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point deadline = Clock::now() +
+        std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(timeoutSeconds));
+    auto address = [](uint16_t port) {
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return address;
+    };
+    auto configure = [](int socket) {
+        // ghost rows are latency bound, don't wait to fill a segment
+        int on = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    };
+
+    // listen first, ranks above this one may already be trying to connect
+    const int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) fail("socket");
+    int on = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in listenAddress = address(basePort + rank);
+    if (bind(listener, (sockaddr *) &listenAddress, sizeof(listenAddress)) < 0 || listen(listener, size) < 0) {
+        const int error = errno;
+        close(listener);
+        errno = error;
+        fail("listen on port " + std::to_string(basePort + rank));
+    }
+
+    try {
+        for (int peer = 0; peer < rank; peer++) {
+            sockaddr_in peerAddress = address(basePort + peer);
+            while (true) {
+                const int socket = ::socket(AF_INET, SOCK_STREAM, 0);
+                if (socket < 0) fail("socket");
+                if (connect(socket, (sockaddr *) &peerAddress, sizeof(peerAddress)) == 0) {
+                    m_sockets[peer] = socket;
+                    break;
+                }
+                const int error = errno;
+                close(socket);
+                errno = error;
+                // the peer has not started listening yet
+                if ((error != ECONNREFUSED && error != EINTR) || Clock::now() > deadline)
+                    fail("connect to rank " + std::to_string(peer));
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            configure(m_sockets[peer]);
+            const int32_t self = rank;
+            send(peer, &self, sizeof(self));
+        }
+
+        for (int accepted = rank + 1; accepted < size; accepted++) {
+            pollfd descriptor = {listener, POLLIN, 0};
+            const int remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            const int ready = poll(&descriptor, 1, std::max(0, remaining));
+            if (ready < 0 && errno == EINTR) {
+                accepted--;
+                continue;
+            }
+            if (ready <= 0) {
+                errno = ready == 0 ? ETIMEDOUT : errno;
+                fail("wait for the ranks above " + std::to_string(rank));
+            }
+
+            const int socket = accept(listener, nullptr, nullptr);
+            if (socket < 0) fail("accept");
+            int32_t peer = -1;
+            if (recv(socket, &peer, sizeof(peer), MSG_WAITALL) != sizeof(peer) || peer <= rank || peer >= size ||
+                    m_sockets[peer] >= 0) {
+                close(socket);
+                throw std::runtime_error("TcpTransport: unexpected connection on port " + std::to_string(basePort + rank));
+            }
+            configure(socket);
+            m_sockets[peer] = socket;
+        }
+    } catch (...) {
+        close(listener);
+        for (int &socket : m_sockets)
+            if (socket >= 0) close(socket);
+        throw;
+    }
+    close(listener);
+}
+
+TcpTransport::~TcpTransport(){
+    for (int socket : m_sockets)
+        if (socket >= 0) close(socket);
+}
+
+int TcpTransport::socket(int peer) const {
+    if (peer < 0 || peer >= (int) m_sockets.size() || m_sockets[peer] < 0)
+        throw std::runtime_error("TcpTransport: rank " + std::to_string(m_rank) + " has no connection to rank " +
+                std::to_string(peer));
+    return m_sockets[peer];
+}
+
+void TcpTransport::send(int peer, const void *data, size_t bytes){
+    exchange(peer, data, bytes, nullptr, 0);
+}
+
+void TcpTransport::receive(int peer, void *data, size_t bytes){
+    exchange(peer, nullptr, 0, data, bytes);
+}
+
+void TcpTransport::exchange(int peer, const void *sendData, size_t sendBytes, void *receiveData, size_t receiveBytes){
+    const int socket = this->socket(peer);
+    const char *sendBegin = static_cast<const char *>(sendData);
+    char *receiveBegin = static_cast<char *>(receiveData);
+    size_t sent = 0, received = 0;
+
+    // write and read whatever the socket takes, so that neither side fills its buffers and
+    // stops reading while the other one waits for it to
+    while (sent < sendBytes || received < receiveBytes) {
+        pollfd descriptor = {socket, 0, 0};
+        if (sent < sendBytes) descriptor.events |= POLLOUT;
+        if (received < receiveBytes) descriptor.events |= POLLIN;
+        if (poll(&descriptor, 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            fail("poll");
+        }
+        if (descriptor.revents & (POLLERR | POLLNVAL)) {
+            errno = ECONNRESET;
+            fail("connection to rank " + std::to_string(peer));
+        }
+
+        if (descriptor.revents & POLLOUT) {
+            const ssize_t count = ::send(socket, sendBegin + sent, sendBytes - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                fail("send to rank " + std::to_string(peer));
+            if (count > 0) sent += count;
+        }
+        // a hang up may still leave data to read
+        if (descriptor.revents & (POLLIN | POLLHUP)) {
+            const ssize_t count = recv(socket, receiveBegin + received, receiveBytes - received, MSG_DONTWAIT);
+            if (count == 0) {
+                errno = ECONNRESET;
+                fail("rank " + std::to_string(peer) + " closed the connection");
+            }
+            if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                fail("receive from rank " + std::to_string(peer));
+            if (count > 0) received += count;
+        }
+    }
+}
+
+void launchLocalRanks(int size, uint16_t basePort, const std::function<void(Transport &)> &body){
+    std::vector<pid_t> children;
+    for (int rank = 0; rank < size; rank++) {
+        const pid_t child = fork();
+        if (child < 0) {
+            const int error = errno;
+            for (pid_t started : children) {
+                kill(started, SIGTERM);
+                waitpid(started, nullptr, 0);
+            }
+            errno = error;
+            throw std::runtime_error(std::string("launchLocalRanks: fork: ") + std::strerror(errno));
+        }
+
+        if (child == 0) {
+            int status = 0;
+            try {
+                TcpTransport transport(rank, size, basePort);
+                body(transport);
+            } catch (const std::exception &e) {
+                std::fprintf(stderr, "rank %d: %s\n", rank, e.what());
+                status = 1;
+            }
+            // skip the exit handlers of the parent, but keep what the rank printed
+            std::fflush(nullptr);
+            _exit(status);
+        }
+        children.push_back(child);
+    }
+
+    std::string failed;
+    for (int rank = 0; rank < size; rank++) {
+        int status = 0;
+        while (waitpid(children[rank], &status, 0) < 0 && errno == EINTR) {}
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed += (failed.empty() ? "" : ", ") + std::to_string(rank);
+    }
+    if (!failed.empty())
+        throw std::runtime_error("launchLocalRanks: ranks " + failed + " failed");
+}
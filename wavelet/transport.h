@@ -0,0 +1,124 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief How the ranks of a DistributedGrid talk to each other. Messages between two ranks
+ * arrive in the order they were sent, and every receive has to ask for exactly the number of
+ * bytes that were sent.
+ *
+ * Failures, e.g. a peer that went away or a message of the wrong size, throw std::runtime_error.
+ */
+class Transport {
+public:
+    virtual ~Transport() = default;
+
+    virtual int rank() const = 0;
+    virtual int size() const = 0;
+
+    virtual void send(int peer, const void *data, size_t bytes) = 0;
+    virtual void receive(int peer, void *data, size_t bytes) = 0;
+
+    /**
+     * @brief Sends to peer and receives from it at the same time, so that two ranks exchanging
+     * with each other can't both wait for the other one to receive first.
+     */
+    virtual void exchange(int peer, const void *sendData, size_t sendBytes, void *receiveData, size_t receiveBytes) = 0;
+
+    /**
+     * @brief Returns once every rank called barrier.
+     */
+    virtual void barrier();
+};
+
+/**
+ * @brief Ranks that are threads of the same process, passing messages through shared mailboxes.
+ * Sends never wait, so exchange is a send followed by a receive.
+ */
+class SharedMemoryTransport : public Transport {
+public:
+    /**
+     * @brief The transports of size ranks that talk to each other, indexed by rank.
+     */
+    static std::vector<std::unique_ptr<SharedMemoryTransport>> createGroup(int size);
+
+    int rank() const override { return m_rank; }
+    int size() const override;
+
+    void send(int peer, const void *data, size_t bytes) override;
+    void receive(int peer, void *data, size_t bytes) override;
+    void exchange(int peer, const void *sendData, size_t sendBytes, void *receiveData, size_t receiveBytes) override;
+
+    /**
+     * @brief Makes every receive of the group throw, e.g. after one of the ranks failed and
+     * the others would wait for it forever.
+     */
+    void abort();
+
+private:
+    struct Mailboxes {
+        int size;
+        bool aborted = false;
+        std::mutex mutex;
+        std::condition_variable arrived;
+        // the messages in flight from rank i to rank j, at i * size + j
+        std::vector<std::deque<std::vector<char>>> messages;
+    };
+
+    SharedMemoryTransport(int rank, std::shared_ptr<Mailboxes> mailboxes);
+
+    int m_rank;
+    std::shared_ptr<Mailboxes> m_mailboxes;
+};
+
+/**
+ * @brief Ranks that are processes on the same machine, connected pairwise over TCP on the
+ * loopback interface. Rank i listens on basePort + i and connects to every rank below it, so
+ * the constructor returns once all the ranks were started.
+ */
+class TcpTransport : public Transport {
+public:
+    /**
+     * @param timeoutSeconds how long to keep trying to reach the other ranks.
+     */
+    TcpTransport(int rank, int size, uint16_t basePort, float timeoutSeconds = 30);
+    ~TcpTransport();
+
+    TcpTransport(const TcpTransport &) = delete;
+    TcpTransport &operator=(const TcpTransport &) = delete;
+
+    int rank() const override { return m_rank; }
+    int size() const override { return m_sockets.size(); }
+
+    void send(int peer, const void *data, size_t bytes) override;
+    void receive(int peer, void *data, size_t bytes) override;
+    void exchange(int peer, const void *sendData, size_t sendBytes, void *receiveData, size_t receiveBytes) override;
+
+private:
+    int socket(int peer) const;
+
+    int m_rank;
+    // the socket connected to every other rank, -1 for this one
+    std::vector<int> m_sockets;
+};
+
+/**
+ * @brief Runs body(transport) for size ranks on threads of this process, connected by a
+ * SharedMemoryTransport, and returns once all of them did. The first exception a rank throws
+ * is rethrown here.
+ */
+void runSharedMemoryRanks(int size, const std::function<void(Transport &)> &body);
+
+/**
+ * @brief Forks size processes that each run body(transport) with a TcpTransport on ports
+ * [basePort, basePort + size), and returns once all of them exited. Throws if any of them
+ * failed. POSIX only, and like any fork it should happen before the caller starts threads.
+ */
+void launchLocalRanks(int size, uint16_t basePort, const std::function<void(Transport &)> &body);
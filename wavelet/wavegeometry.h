@@ -14,6 +14,7 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 
+#include "profilebuffer.h"
 #include "waveletgrid.h"
 #include <memory>
 #include "camera.h"
@@ -1,16 +1,29 @@
 #include "waveletgrid.h"
 #include "wavelet/amplitude.h"
+#include <algorithm>
 #include <assert.h>
 #include <iterator>
+#include <limits>
+#include <optional>
 #include <math.h>
 #include <glm/vec2.hpp>
 #include "mathutil.h"
 #include <tuple>
 #include <iostream>
+#include <stdexcept>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // wavelet grid
-WaveletGrid::WaveletGrid(glm::vec4 minParam, glm::vec4 maxParam, glm::uvec4 resolution)
-    : m_minParam(minParam), m_maxParam(maxParam), m_resolution(resolution)
+WaveletGrid::WaveletGrid(glm::vec4 minParam, glm::vec4 maxParam, glm::uvec4 resolution, Setting setting)
+    : WaveletGrid(minParam, maxParam, resolution, setting,
+            Subdomain{glm::uvec2(0), glm::uvec2(resolution[Parameter::X], resolution[Parameter::Y])})
+{
+}
+
+WaveletGrid::WaveletGrid(glm::vec4 minParam, glm::vec4 maxParam, glm::uvec4 resolution, Setting setting, Subdomain subdomain)
+    : m_resolution(resolution), m_minParam(minParam), m_maxParam(maxParam), m_setting(setting)
 {
         glm::vec4 resolutionVec(resolution[Parameter::X], resolution[Parameter::Y], resolution[Parameter::THETA],
                 resolution[Parameter::K]);
@@ -18,155 +31,1420 @@ WaveletGrid::WaveletGrid(glm::vec4 minParam, glm::vec4 maxParam, glm::uvec4 reso
         //m_minParam = glm::vec4(-settings.size, -settings.size, 0, settings.k_range[0]);
         //m_maxParam = glm::vec4(settings.size, settings.size, tau, settings.k_range[1]);
         m_unitParam = (m_maxParam - m_minParam) / resolutionVec;
+        m_domainResolution = glm::uvec2(resolution[Parameter::X], resolution[Parameter::Y]);
 
-        for(int ik = 0; ik < m_resolution[Parameter::K]; ik++)
-            m_profileBuffers.push_back(std::make_unique<ProfileBuffer>(5, 
-                        m_unitParam[Parameter::X], settings.k_range.x, settings.k_range.y, m_unitParam[Parameter::K]));
-        amplitudes.resize(resolution);
-        amplitudes_nxt.resize(resolution);
+        m_bandsStep = bandsStepFor(resolution[Parameter::THETA], resolution[Parameter::K]);
+        setSubdomain(subdomain);
         //m_environment = Environment("100x100box.png", .9);
         //m_profileBuffer = std::make_unique<ProfileBuffer>(5);
 }
 
+void WaveletGrid::setSubdomain(Subdomain subdomain){
+    if (glm::any(glm::greaterThan(subdomain.offset + subdomain.resolution, m_domainResolution)))
+        throw std::runtime_error("WaveletGrid: the subdomain is not inside the grid");
+
+    m_cellOffset = subdomain.offset;
+    m_resolution[Parameter::X] = subdomain.resolution.x;
+    m_resolution[Parameter::Y] = subdomain.resolution.y;
+    m_activeRegion = std::make_shared<ActiveRegion>(subdomain.resolution);
+    m_reflectionTable.reset();
+    buildBands();
+}
+
+Subdomain WaveletGrid::getSubdomain() const {
+    return Subdomain{m_cellOffset, glm::uvec2(m_resolution[Parameter::X], m_resolution[Parameter::Y])};
+}
+
+glm::uvec2 WaveletGrid::subdomainAlignment() const {
+    const std::vector<unsigned int> downsampling = bandDownsampling(m_minParam, m_maxParam,
+            glm::uvec4(m_domainResolution, m_resolution[Parameter::THETA], m_resolution[Parameter::K]), m_setting,
+            settings.samplesPerWavelength);
+    const unsigned int maxDownsampling = *std::max_element(downsampling.begin(), downsampling.end());
+    // the flags of a tile are only the same if it covers the same cells
+    if (!settings.skipQuiescentTiles) return glm::uvec2(maxDownsampling);
+    return glm::uvec2(settings.tileColumns, settings.tileRows) * maxDownsampling;
+}
+
+unsigned int WaveletGrid::haloRows(float deltaTime) const {
+    const unsigned int tileRows = settings.tileRows;
+    unsigned int rows = 0;
+    for (unsigned int i_k = 0; i_k < m_resolution[Parameter::K]; i_k++) {
+        // the rows the advection of a row and its diffusion stencil read
+        unsigned int bandRows = advectionReach(deltaTime, i_k) + 1;
+        // the tiles next to the owned ones are advected as halo rows of the diffusion, so their
+        // awake flags have to be exact too, and those depend on the tiles within their reach
+        if (settings.skipQuiescentTiles)
+            bandRows = std::max(bandRows, ((awakeReach(deltaTime, i_k) + tileRows - 1) / tileRows + 1) * tileRows);
+        rows = std::max(rows, bandRows * m_bands[i_k].downsampling);
+    }
+    const unsigned int alignment = subdomainAlignment().y;
+    return (rows + alignment - 1) / alignment * alignment;
+}
+
 void WaveletGrid::takeStep(float dt){
     time += dt;
-    advectionStep(dt);
-    diffusionStep(dt);
+    stepBands(std::vector<StepSchedule>(m_resolution[Parameter::K], StepSchedule{1, dt}));
 }
 
-float WaveletGrid::angularFrequency(float wavenumber) {
-    return sqrt(wavenumber * gravity +
-            surfaceTension * wavenumber * wavenumber * wavenumber);
+void WaveletGrid::stepBands(const std::vector<StepSchedule> &bandSchedules){
+    (this->*m_bandsStep)(bandSchedules);
 }
 
-float WaveletGrid::advectionSpeed(float wavenumber) {
-    float numerator = (gravity + 3 * surfaceTension * wavenumber * wavenumber);
-    float denominator = 2 * angularFrequency(wavenumber);
-    assert(denominator);
-    return numerator / denominator;
+WaveletGrid::BandsStep WaveletGrid::bandsStepFor(unsigned int thetaResolution, unsigned int kResolution){
+    // the resolutions deployments run with, see Setting::simulationResolution
+    static constexpr struct {
+        unsigned int thetaResolution, kResolution;
+        BandsStep bandsStep;
+    } compiled[] = {
+        {4, 4, &WaveletGrid::stepBandsFor<4, 4>},
+        {8, 4, &WaveletGrid::stepBandsFor<8, 4>},
+        {16, 4, &WaveletGrid::stepBandsFor<16, 4>},
+    };
+    for (const auto &entry : compiled)
+        if (entry.thetaResolution == thetaResolution && entry.kResolution == kResolution) return entry.bandsStep;
+    return &WaveletGrid::stepBandsFor<0, 0>;
 }
 
-float WaveletGrid::dispersionSpeed(float wavenumber) {
-    // courtesy of wolfram alpha
-    // https://www.wolframalpha.com/input?i=d%5E2%2Fdx%5E2%28sqrt%28ax%2Bbx%5E3%29%29
-    float numerator =
-        (-2 * gravity + 6 * gravity * surfaceTension * wavenumber * wavenumber +
-         3 * surfaceTension * surfaceTension * wavenumber * wavenumber * wavenumber * wavenumber);
-    float denom = 4 * pow(wavenumber * (gravity + surfaceTension * wavenumber * wavenumber), 3 / 2);
-    assert(denom);
-    return numerator / denom;
+template <unsigned int NTheta, unsigned int NK>
+void WaveletGrid::stepBandsFor(const std::vector<StepSchedule> &bandSchedules){
+    if (settings.scheduler == Scheduler::WorkStealing) {
+        runStepGraph<NTheta, NK>(bandSchedules);
+        return;
+    }
+    const unsigned int resolutionK = NK > 0 ? NK : m_resolution[Parameter::K];
+    for (unsigned int i_k = 0; i_k < resolutionK; i_k++)
+        for (int i = 0; i < bandSchedules[i_k].substeps; i++)
+            stepBand<NTheta>(bandSchedules[i_k].deltaTime, i_k);
 }
 
-glm::vec2 WaveletGrid::getWaveDirection(glm::vec4 pos) const {
-  float theta = pos[Parameter::THETA];
-  return glm::vec2(cosf(theta), sinf(theta));
-}
+template <unsigned int NTheta, unsigned int NK>
+void WaveletGrid::runStepGraph(const std::vector<StepSchedule> &bandSchedules){
+    using TaskId = TaskGraph::TaskId;
+    TaskPool &pool = taskPool();
+    m_workerScratch.resize(pool.workerCount());
+    auto scratch = [this]() -> std::vector<float> & { return m_workerScratch[TaskPool::currentWorker()]; };
 
-void WaveletGrid::advectionStep(float deltaTime) {
-    /* std::cout << "ADVECTION" << std::endl; */
+    const unsigned int resolutionTheta = thetaResolution<NTheta>();
+    const unsigned int resolutionK = NK > 0 ? NK : m_resolution[Parameter::K];
+    const unsigned int tileRows = settings.tileRows;
+
+    // the bands don't interact, so their chains of substeps only meet at the end
+    TaskGraph graph;
+    for (unsigned int i_k = 0; i_k < resolutionK; i_k++) {
+        const float dt = bandSchedules[i_k].deltaTime;
+        const unsigned int numTiles = (m_bands[i_k].resolution.y + tileRows - 1) / tileRows;
+        std::vector<TaskId> previous;
+
+        for (int substep = 0; substep < bandSchedules[i_k].substeps; substep++) {
+            const TaskId prepare = graph.add([this, dt, i_k]() {
+                refreshGhostCells(i_k);
+                prepareTiles(i_k);
+                computeAwakeTiles(dt, i_k);
+                computeBandDisplacements<NTheta>(dt, i_k);
+            }, previous);
+
+            // the tasks that write each tile row of the band
+            std::vector<std::vector<TaskId>> writers(numTiles);
+            if (settings.inPlaceStep) {
+                // the tiles of a band have to go in order, so the band is a single task
+                const TaskId step = graph.add([this, dt, i_k]() { inPlaceStep<NTheta>(dt, i_k); }, {prepare});
+                for (std::vector<TaskId> &tileWriters : writers) tileWriters.push_back(step);
+            } else if (settings.fusedStep) {
+                std::vector<TaskId> tiles;
+                for (unsigned int tile = 0; tile < numTiles; tile++)
+                    tiles.push_back(graph.add([this, dt, i_k, tile, scratch]() {
+                        fusedTile<NTheta>(dt, i_k, tile, next(i_k), scratch());
+                    }, {prepare}));
+                const TaskId swap = graph.add([this, i_k]() { m_bands[i_k].swapped ^= 1; }, tiles);
+                for (std::vector<TaskId> &tileWriters : writers) tileWriters.push_back(swap);
+            } else {
+                // advect from the current buffer into the other one and diffuse back, so the
+                // band ends up where it started and the buffers never have to be swapped
+                const int reach = advectionReach(dt, i_k);
+                const int reachTiles = std::max<int>(1, (reach + tileRows - 1) / tileRows);
 
-/* #pragma omp parallel for collapse(2) */
-    for (unsigned int i_x = 0; i_x < amplitudes.getResolution(Parameter::X); i_x++) {
-        for (unsigned int i_y = 0; i_y < amplitudes.getResolution(Parameter::Y); i_y++) {
-            std::array<unsigned int, 2> i_xy = {i_x, i_y};
-            glm::vec2 pos = getPositionAtIndex(i_xy);
-            // we need not compute the advection for points outside of the domain.
-            /* if (m_environment.inDomain(pos)) { */
-                for (unsigned int i_theta = 0; i_theta < amplitudes.getResolution(Parameter::THETA); i_theta++) {
-                    for (unsigned int i_k = 0; i_k < amplitudes.getResolution(Parameter::K); i_k++) {
-                        glm::vec4 pos = getPositionAtIndex({i_x, i_y, i_theta, i_k});
-                        glm::vec2 kb = getWaveDirection(pos);
-                        // ought also use advectionSpeed here? representing omega in equation 17?
-                        float omega = advectionSpeed(pos[Parameter::K]);
-                        glm::vec4 lagrangianPos = pos;
-                        lagrangianPos[Parameter::X] -= deltaTime * kb[0] * omega;
-                        lagrangianPos[Parameter::Y] -= deltaTime * kb[1] * omega;
-                        // handle reflection over terrain.
-                        lagrangianPos = getReflected(lagrangianPos);
-                        amplitudes_nxt(glm::uvec4(i_x, i_y, i_theta, i_k)) = lookup_interpolated_amplitude(
-                                        lagrangianPos[Parameter::X], lagrangianPos[Parameter::Y],
-                                        i_theta, i_k);
+                std::vector<TaskId> advect(resolutionTheta * numTiles);
+                for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++)
+                    for (unsigned int tile = 0; tile < numTiles; tile++)
+                        advect[i_theta * numTiles + tile] = graph.add([this, dt, i_k, i_theta, tile, scratch]() {
+                            advectTile<NTheta>(dt, i_k, i_theta, tile, next(i_k), scratch());
+                        }, {prepare});
+
+                for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++) {
+                    for (int tile = 0; tile < (int) numTiles; tile++) {
+                        // the advected rows the stencil reads, and every advection that reads
+                        // the rows this tile overwrites
+                        std::vector<TaskId> dependencies;
+                        for (int other = std::max(0, tile - reachTiles); other <= std::min<int>(numTiles - 1, tile + reachTiles); other++)
+                            dependencies.push_back(advect[i_theta * numTiles + other]);
+                        dependencies.push_back(advect[((i_theta + resolutionTheta - 1) % resolutionTheta) * numTiles + tile]);
+                        dependencies.push_back(advect[((i_theta + 1) % resolutionTheta) * numTiles + tile]);
+
+                        writers[tile].push_back(graph.add([this, dt, i_k, i_theta, tile, scratch]() {
+                            diffuseTile<NTheta>(dt, i_k, i_theta, tile, next(i_k), current(i_k), scratch());
+                        }, dependencies));
+                    }
+                }
+            }
+
+            // the x and y solves need every tile of their theta, the theta solves of a tile row
+            // every theta of it
+            if (stableSpatialDiffusion() || stableAngularDiffusion()) {
+                std::vector<TaskId> written;
+                for (const std::vector<TaskId> &tileWriters : writers)
+                    written.insert(written.end(), tileWriters.begin(), tileWriters.end());
+                const TaskId cells = graph.add([this, i_k]() { computeImplicitCells(i_k); }, written);
+
+                // the spatial solves, or just the cells if there are none
+                std::vector<TaskId> spatial = {cells};
+                if (stableSpatialDiffusion()) {
+                    spatial.clear();
+                    for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++)
+                        spatial.push_back(graph.add([this, dt, i_k, i_theta, scratch]() {
+                            implicitSpatialDiffusion(dt, i_k, i_theta, scratch());
+                        }, {cells}));
+                }
+                for (unsigned int tileY = 0; tileY < numTiles; tileY++) {
+                    if (!stableAngularDiffusion()) {
+                        writers[tileY] = spatial;
+                        continue;
                     }
+                    writers[tileY] = {graph.add([this, dt, i_k, tileY, scratch]() {
+                        implicitAngularDiffusion(dt, i_k, tileY, scratch());
+                    }, spatial)};
+                }
+            }
+
+            // the shoreline of a tile row is reflected once all of its thetas are written
+            if (m_bands[i_k].reflectionTable)
+                for (unsigned int tileY = 0; tileY < numTiles; tileY++)
+                    writers[tileY] = {graph.add([this, i_k, tileY, scratch]() {
+                        reflectTileRow(i_k, tileY, scratch());
+                    }, writers[tileY])};
+
+            previous.clear();
+            for (unsigned int tileY = 0; tileY < numTiles; tileY++) {
+                if (!settings.skipQuiescentTiles) {
+                    previous.insert(previous.end(), writers[tileY].begin(), writers[tileY].end());
+                    continue;
                 }
-            /* } */
+                previous.push_back(graph.add([this, i_k, tileY, scratch]() {
+                    computeDisturbedTileRow(i_k, tileY, scratch());
+                }, writers[tileY]));
+            }
         }
     }
-    std::swap(amplitudes, amplitudes_nxt);
+    pool.run(graph);
+}
+
+template <unsigned int NTheta>
+void WaveletGrid::stepBand(float dt, unsigned int i_k){
+    refreshGhostCells(i_k);
+    prepareTiles(i_k);
+    computeAwakeTiles(dt, i_k);
+    if (settings.inPlaceStep) {
+        inPlaceStep<NTheta>(dt, i_k);
+    } else if (settings.fusedStep) {
+        fusedStep<NTheta>(dt, i_k);
+    } else {
+        advectionStep<NTheta>(dt, i_k);
+        diffusionStep<NTheta>(dt, i_k);
+    }
+    if (stableSpatialDiffusion() || stableAngularDiffusion()) {
+        computeImplicitCells(i_k);
+        implicitDiffusionStep(dt, i_k);
+    }
+    reflect(i_k);
+    computeDisturbedTiles(i_k);
+}
+
+StepSchedule WaveletGrid::advance(float interval){
+    // the most restricted band decides how much of the interval fits in maxSubsteps
+    StepSchedule schedule = stepSchedule(interval);
+    interval = schedule.substeps * schedule.deltaTime;
+
+    time += interval;
+    std::vector<StepSchedule> bandSchedules;
+    for (unsigned int i_k = 0; i_k < m_resolution[Parameter::K]; i_k++)
+        bandSchedules.push_back(DispersionPlan::splitBandInterval(interval, bandMaxStableTimeStep(i_k)));
+    stepBands(bandSchedules);
+    return schedule;
 }
 
-void WaveletGrid::diffusionStep(float deltaTime) {
-    float spacialResolution = m_unitParam[Parameter::X];
+float WaveletGrid::maxStableTimeStep() const {
+    float deltaTime = std::numeric_limits<float>::infinity();
+    for (unsigned int i_k = 0; i_k < m_resolution[Parameter::K]; i_k++)
+        deltaTime = std::min(deltaTime, bandMaxStableTimeStep(i_k));
+    return deltaTime;
+}
+
+float WaveletGrid::bandMaxStableTimeStep(unsigned int i_k) const {
+    // only the advection limit of the plan applies, its diffusion limits are for stencils over
+    // world distances and radians
+    float deltaTime = m_plan->bandMaxStableTimeStep(i_k, m_setting.cflNumber, true, true);
+
+    // diffuseRow takes unit differences over band cells and thetas, with delta scaled down by
+    // downsampling^2, so forward euler needs delta * dt / downsampling^2 <= 1/2 and gamma * dt <= 1/2
+    const float downsampling = m_bands[i_k].downsampling;
+    const float delta = m_plan->spatialDiffusion(i_k);
+    const float gamma = m_plan->angularDiffusion(i_k);
+    if (!stableSpatialDiffusion() && delta > 0)
+        deltaTime = std::min(deltaTime, downsampling * downsampling / (2 * delta));
+    if (!stableAngularDiffusion() && gamma > 0)
+        deltaTime = std::min(deltaTime, 1 / (2 * gamma));
+    return deltaTime;
+}
+
+StepSchedule WaveletGrid::stepSchedule(float interval) const {
+    return DispersionPlan::splitInterval(interval, maxStableTimeStep(), m_setting.maxSubsteps);
+}
+
+void WaveletGrid::setThreadCount(int threadCount){
+    settings.threadCount = threadCount;
+    // started again with the new count when needed
+    m_pool.reset();
+    pinThreads();
+}
+
+void WaveletGrid::setScheduler(Scheduler scheduler){
+    settings.scheduler = scheduler;
+}
+
+TaskPool &WaveletGrid::taskPool(){
+    if (!m_pool) {
+        m_pool = std::make_unique<TaskPool>(std::max(0, settings.threadCount));
+        m_pool->pinWorkers(Topology::threadCpus(settings.affinity));
+    }
+    return *m_pool;
+}
+
+void WaveletGrid::setThreadAffinity(Topology::Affinity affinity){
+    settings.affinity = affinity;
+    pinThreads();
+    placeAmplitudes();
+}
+
+void WaveletGrid::pinThreads(){
+    const std::vector<int> cpus = Topology::threadCpus(settings.affinity);
+    if (cpus.empty()) return;
+#ifdef _OPENMP
+    // OpenMP keeps its threads from one parallel region to the next, and so their pinning. Thread
+    // 0 is the calling thread, which may draw or run the gui, so it is left to the caller as the
+    // first worker of the pool is
+#pragma omp parallel num_threads(numThreads())
+    if (omp_get_thread_num() != 0) Topology::pinThread(cpus[omp_get_thread_num() % cpus.size()]);
+#endif
+    if (m_pool) m_pool->pinWorkers(cpus);
+}
+
+void WaveletGrid::firstTouch(const std::function<void(unsigned int i_k, int begin, int end)> &touch){
+    const unsigned int tileRows = settings.tileRows;
+    const int ghost = amplitudes.getGhostCells();
+    for (unsigned int i_k = 0; i_k < m_resolution[Parameter::K]; i_k++) {
+        const unsigned int resolutionY = m_bands[i_k].resolution.y;
+        const unsigned int numTiles = (resolutionY + tileRows - 1) / tileRows;
+        // the ghost rows go with the first and the last tile
+        auto touchTile = [&](unsigned int tile) {
+            const int begin = tile == 0 ? -ghost : tile * tileRows;
+            const int end = tile + 1 == numTiles ? resolutionY + ghost : (tile + 1) * tileRows;
+            touch(i_k, begin, end);
+        };
+
+        if (settings.scheduler == Scheduler::WorkStealing) {
+            taskPool().parallelFor(0, numTiles, 1, [&](unsigned int begin, unsigned int end) {
+                for (unsigned int tile = begin; tile < end; tile++)
+                    touchTile(tile);
+            });
+        } else {
+#pragma omp parallel for schedule(static) num_threads(numThreads())
+            for (unsigned int tile = 0; tile < numTiles; tile++)
+                touchTile(tile);
+        }
+    }
+}
+
+void WaveletGrid::placeAmplitudes(){
+    for (Amplitude *buffer : {&amplitudes, &amplitudes_nxt}) {
+        if (buffer == &amplitudes_nxt && settings.inPlaceStep) continue;
+        Amplitude placed;
+        placed.allocateLike(*buffer);
+        firstTouch([&](unsigned int i_k, int begin, int end) { placed.copyRows(*buffer, i_k, begin, end); });
+        *buffer = std::move(placed);
+    }
+}
+
+std::vector<size_t> WaveletGrid::residentBytes() const {
+    std::vector<size_t> bytes;
+    for (const Amplitude *buffer : {&amplitudes, &amplitudes_nxt}) {
+        const std::vector<size_t> bufferBytes = buffer->residentBytes();
+        if (bufferBytes.size() > bytes.size()) bytes.resize(bufferBytes.size(), 0);
+        for (size_t node = 0; node < bufferBytes.size(); node++)
+            bytes[node] += bufferBytes[node];
+    }
+    return bytes;
+}
+
+std::vector<TaskPool::WorkerStats> WaveletGrid::schedulerStats() const {
+    return m_pool ? m_pool->stats() : std::vector<TaskPool::WorkerStats>();
+}
+
+void WaveletGrid::resetSchedulerStats(){
+    if (m_pool) m_pool->resetStats();
+}
+
+int WaveletGrid::numThreads() const {
+    // a task of the pool already has its own worker
+    if (TaskPool::currentWorker() >= 0) return 1;
+#ifdef _OPENMP
+    return settings.threadCount > 0 ? settings.threadCount : omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+void WaveletGrid::setSetting(const Setting &setting){
+    m_setting = setting;
+    updatePlan();
+    // the ambient amplitude may have changed
+    disturbAll();
+}
+
+void WaveletGrid::setActiveRegion(std::shared_ptr<const ActiveRegion> region){
+    assert(region->getResolution() == glm::uvec2(m_resolution[Parameter::X], m_resolution[Parameter::Y]));
+    m_activeRegion = region;
+
+    for (unsigned int i_k = 0; i_k < m_resolution[Parameter::K]; i_k++) {
+        Band &band = m_bands[i_k];
+        band.activeRegion = band.downsampling == 1 ? region :
+            std::make_shared<const ActiveRegion>(region->downsampled(band.downsampling));
+
+        // dry cells are read as zero by the stencils of their wet neighbours
+        for (Amplitude *buffer : {&amplitudes, &amplitudes_nxt})
+        if (buffer == &amplitudes || !settings.inPlaceStep)
+        for (unsigned int i_theta = 0; i_theta < m_resolution[Parameter::THETA]; i_theta++)
+        for (unsigned int i_y = 0; i_y < band.resolution.y; i_y++) {
+            unsigned int wetEnd = 0;
+            for (const ActiveRegion::Span *span = band.activeRegion->spansBegin(i_y); span != band.activeRegion->spansEnd(i_y); span++) {
+                buffer->fillRow(i_y, i_theta, i_k, wetEnd, span->begin, 0.0f);
+                wetEnd = span->end;
+            }
+            buffer->fillRow(i_y, i_theta, i_k, wetEnd, band.resolution.x, 0.0f);
+        }
+    }
+    disturbAll();
+}
+
+void WaveletGrid::setReflectionTable(std::shared_ptr<const ReflectionTable> table){
+    assert(!table || (table->getResolution() == glm::uvec2(m_resolution[Parameter::X], m_resolution[Parameter::Y]) &&
+                table->getThetaResolution() == m_resolution[Parameter::THETA]));
+    m_reflectionTable = table;
+
+    for (Band &band : m_bands)
+        band.reflectionTable = !table || band.downsampling == 1 ? table :
+            std::make_shared<const ReflectionTable>(table->downsampled(band.downsampling));
+    disturbAll();
+}
+
+void WaveletGrid::setSamplesPerWavelength(float samplesPerWavelength){
+    if (samplesPerWavelength == settings.samplesPerWavelength) return;
+    settings.samplesPerWavelength = samplesPerWavelength;
+    buildBands();
+}
+
+void WaveletGrid::setInPlaceStep(bool inPlace){
+    if (inPlace == settings.inPlaceStep) return;
+    settings.inPlaceStep = inPlace;
+
+    if (inPlace) {
+        // in place steps always work on the first buffer
+        std::vector<float> scratch(m_resolution[Parameter::X]);
+        for (unsigned int i_k = 0; i_k < m_resolution[Parameter::K]; i_k++) {
+            Band &band = m_bands[i_k];
+            if (!band.swapped) continue;
+            for (unsigned int i_theta = 0; i_theta < m_resolution[Parameter::THETA]; i_theta++)
+            for (unsigned int i_y = 0; i_y < band.resolution.y; i_y++)
+                amplitudes.writeRow(i_y, i_theta, i_k, amplitudes_nxt.readRow(i_y, i_theta, i_k, scratch.data()));
+            band.swapped = false;
+        }
+        amplitudes_nxt = Amplitude();
+    } else {
+        // same storage, layout and zeroed dry cells
+        amplitudes_nxt = amplitudes;
+    }
+}
+
+void WaveletGrid::setAdvectionMode(AdvectionMode mode){
+    settings.advectionMode = mode;
+}
+
+void WaveletGrid::setFusedStep(bool fused){
+    settings.fusedStep = fused;
+}
+
+void WaveletGrid::setDiffusionMode(DiffusionMode mode){
+    settings.diffusionMode = mode;
+    // the awake reach depends on it
+    disturbAll();
+}
+
+void WaveletGrid::setAngularDiffusionMode(AngularDiffusionMode mode){
+    settings.angularDiffusionMode = mode;
+}
+
+void WaveletGrid::setSkipQuiescentTiles(bool skip){
+    settings.skipQuiescentTiles = skip;
+    // the disturbed flags are stale while the tiles aren't skipped
+    disturbAll();
+}
+
+void WaveletGrid::setTileSize(unsigned int tileRows, unsigned int tileColumns){
+    // every sweep divides by them
+    settings.tileRows = std::max(1u, tileRows);
+    settings.tileColumns = std::max(1u, tileColumns);
+    disturbAll();
+}
+
+void WaveletGrid::setGhostCells(unsigned int ghostCells, unsigned int thetaGhostCells){
+    settings.ghostCells = ghostCells;
+    settings.thetaGhostCells = thetaGhostCells;
+    amplitudes.setGhostCells(ghostCells, thetaGhostCells);
+    amplitudes_nxt.setGhostCells(ghostCells, thetaGhostCells);
+}
+
+void WaveletGrid::setStorage(Storage::Type storage){
+    amplitudes.setStorage(storage);
+    amplitudes_nxt.setStorage(storage);
+    // the ambient amplitude of sleeping tiles is rounded differently now
+    disturbAll();
+}
+
+void WaveletGrid::setLayout(Layout::Type layout){
+    amplitudes.setLayout(layout);
+    amplitudes_nxt.setLayout(layout);
+}
+
+void WaveletGrid::readBandRows(unsigned int i_k, unsigned int begin, unsigned int end, float *out) const {
+    const unsigned int resolutionX = m_bands[i_k].resolution.x;
+    const Amplitude &amplitude = current(i_k);
+    for (unsigned int i_theta = 0; i_theta < m_resolution[Parameter::THETA]; i_theta++)
+        for (unsigned int i_y = begin; i_y < end; i_y++)
+            amplitude.decode(i_y, i_theta, i_k, 0, resolutionX,
+                    out + ((size_t) i_theta * (end - begin) + (i_y - begin)) * resolutionX);
+}
+
+void WaveletGrid::writeBandRows(unsigned int i_k, unsigned int begin, unsigned int end, const float *in){
+    Band &band = m_bands[i_k];
+    const unsigned int resolutionX = band.resolution.x;
+    Amplitude &amplitude = current(i_k);
+    for (unsigned int i_theta = 0; i_theta < m_resolution[Parameter::THETA]; i_theta++)
+        for (unsigned int i_y = begin; i_y < end; i_y++)
+            amplitude.writeRow(i_y, i_theta, i_k, in + ((size_t) i_theta * (end - begin) + (i_y - begin)) * resolutionX);
+
+    // no flags yet means everything is disturbed
+    if (!settings.skipQuiescentTiles || band.tileDisturbed.empty() || begin >= end) return;
+
+    // scanning every tile of the rows gives the flags the tiles would have had if they had
+    // been computed here, which is what keeps subdomains in step with the whole grid
+    std::vector<float> scratch;
+    for (unsigned int tileY = begin / settings.tileRows; tileY <= (end - 1) / settings.tileRows; tileY++) {
+        std::fill(band.tileAwake.begin() + tileY * band.tilesX, band.tileAwake.begin() + (tileY + 1) * band.tilesX, 1);
+        computeDisturbedTileRow(i_k, tileY, scratch);
+    }
+}
+
+AmplitudeError WaveletGrid::amplitudeError(const WaveletGrid &reference) const {
+    const unsigned int resolutionTheta = m_resolution[Parameter::THETA];
+    std::vector<float> scratch(2 * m_resolution[Parameter::X]);
+    float *rowScratch = scratch.data();
+    float *referenceScratch = scratch.data() + m_resolution[Parameter::X];
+
+    AmplitudeError error;
+    double squaredSum = 0;
+    size_t count = 0;
+    for (unsigned int i_k = 0; i_k < m_resolution[Parameter::K]; i_k++) {
+        const glm::uvec2 resolution = m_bands[i_k].resolution;
+        assert(reference.getBandResolution(i_k) == resolution);
+        for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++)
+        for (unsigned int i_y = 0; i_y < resolution.y; i_y++) {
+            const float *row = current(i_k).readRow(i_y, i_theta, i_k, rowScratch);
+            const float *referenceRow = reference.current(i_k).readRow(i_y, i_theta, i_k, referenceScratch);
+            for (unsigned int i_x = 0; i_x < resolution.x; i_x++) {
+                const float difference = std::abs(row[i_x] - referenceRow[i_x]);
+                error.maxAbsolute = std::max(error.maxAbsolute, difference);
+                error.referenceMax = std::max(error.referenceMax, std::abs(referenceRow[i_x]));
+                squaredSum += (double) difference * difference;
+            }
+            count += resolution.x;
+        }
+    }
+    error.rms = count > 0 ? std::sqrt(squaredSum / count) : 0;
+    error.maxRelative = error.referenceMax > 0 ? error.maxAbsolute / error.referenceMax : 0;
+    return error;
+}
+
+std::vector<unsigned int> WaveletGrid::bandDownsampling(glm::vec4 minParam, glm::vec4 maxParam, glm::uvec4 resolution,
+        const Setting &setting, float samplesPerWavelength){
+    const glm::vec4 unitParam = (maxParam - minParam) / glm::vec4(resolution);
+    const glm::uvec2 gridResolution(resolution[Parameter::X], resolution[Parameter::Y]);
+    // a coarse cell has to resolve the wavelength along both axes
+    const float cellSize = std::max(unitParam[Parameter::X], unitParam[Parameter::Y]);
+    // anything smaller leaves little but boundary cells for the diffusion
+    const unsigned int minResolution = 8;
+
+    std::vector<unsigned int> bandDownsampling(resolution[Parameter::K], 1);
+    if (samplesPerWavelength <= 0) return bandDownsampling;
+
+    for (unsigned int i_k = 0; i_k < resolution[Parameter::K]; i_k++) {
+        const float wavenumber = minParam[Parameter::K] + (i_k + 0.5) * unitParam[Parameter::K];
+        const float wavelength = setting.tau / wavenumber;
+
+        // halve the resolution while the band stays resolved and the coarse cells still tile the grid
+        unsigned int &downsampling = bandDownsampling[i_k];
+        while (gridResolution.x % (2 * downsampling) == 0 && gridResolution.y % (2 * downsampling) == 0 &&
+                gridResolution.x / (2 * downsampling) >= minResolution &&
+                gridResolution.y / (2 * downsampling) >= minResolution &&
+                2 * downsampling * cellSize * samplesPerWavelength <= wavelength)
+            downsampling *= 2;
+    }
+    return bandDownsampling;
+}
+
+void WaveletGrid::buildBands(){
+    const glm::uvec2 resolution(m_resolution[Parameter::X], m_resolution[Parameter::Y]);
+    const glm::vec2 unit(m_unitParam[Parameter::X], m_unitParam[Parameter::Y]);
+    const std::vector<unsigned int> downsampling = bandDownsampling(m_minParam, m_maxParam,
+            glm::uvec4(m_domainResolution, m_resolution[Parameter::THETA], m_resolution[Parameter::K]), m_setting,
+            settings.samplesPerWavelength);
+
+    m_bands.assign(m_resolution[Parameter::K], Band());
+    std::vector<glm::uvec2> bandResolutions;
+    for (unsigned int i_k = 0; i_k < m_resolution[Parameter::K]; i_k++) {
+        // the subdomain has to start and end on cells of the band
+        unsigned int bandDownsampling = downsampling[i_k];
+        while (glm::any(glm::notEqual(m_cellOffset % bandDownsampling, glm::uvec2(0))) ||
+                glm::any(glm::notEqual(resolution % bandDownsampling, glm::uvec2(0))))
+            bandDownsampling /= 2;
+
+        Band &band = m_bands[i_k];
+        band.downsampling = bandDownsampling;
+        band.offset = m_cellOffset / bandDownsampling;
+        band.resolution = resolution / bandDownsampling;
+        band.unit = unit * (float) bandDownsampling;
+        band.activeRegion = bandDownsampling == 1 ? m_activeRegion :
+            std::make_shared<const ActiveRegion>(m_activeRegion->downsampled(bandDownsampling));
+        band.reflectionTable = !m_reflectionTable || bandDownsampling == 1 ? m_reflectionTable :
+            std::make_shared<const ReflectionTable>(m_reflectionTable->downsampled(bandDownsampling));
+        bandResolutions.push_back(band.resolution);
+    }
+
+    // zeroed by the threads that step the rows, see firstTouch
+    amplitudes.setGhostCells(settings.ghostCells, settings.thetaGhostCells);
+    amplitudes.allocate(bandResolutions, m_resolution[Parameter::THETA]);
+    if (!settings.inPlaceStep) {
+        amplitudes_nxt.setGhostCells(settings.ghostCells, settings.thetaGhostCells);
+        amplitudes_nxt.allocate(bandResolutions, m_resolution[Parameter::THETA]);
+    }
+    firstTouch([this](unsigned int i_k, int begin, int end) {
+        amplitudes.clearRows(i_k, begin, end);
+        if (!settings.inPlaceStep) amplitudes_nxt.clearRows(i_k, begin, end);
+    });
+    for (Band &band : m_bands)
+        band.swapped = false;
+    // sized once, the bands fill in their own part concurrently
+    m_bandDisplacements.resize(m_resolution[Parameter::THETA] * m_resolution[Parameter::K]);
+
+    // the diffusion coefficients depend on the cell size of each band
+    m_plan.reset();
+    updatePlan();
+}
+
+void WaveletGrid::disturbAll(){
+    for (Band &band : m_bands)
+        band.tileDisturbed.clear();
+}
+
+void WaveletGrid::wake(glm::uvec2 begin, glm::uvec2 end){
+    if (begin.x >= end.x || begin.y >= end.y) return;
+
+    for (Band &band : m_bands) {
+        // no flags yet means everything is disturbed
+        if (band.tileDisturbed.empty()) continue;
+
+        // the cells of the band that overlap [begin, end)
+        const glm::uvec2 bandBegin = begin / band.downsampling;
+        const glm::uvec2 bandEnd = (end + band.downsampling - 1u) / band.downsampling;
+
+        const unsigned int tileXBegin = bandBegin.x / settings.tileColumns;
+        const unsigned int tileXEnd = std::min(band.tilesX, (bandEnd.x + settings.tileColumns - 1) / settings.tileColumns);
+        const unsigned int tileYBegin = bandBegin.y / settings.tileRows;
+        const unsigned int tileYEnd = std::min(band.tilesY, (bandEnd.y + settings.tileRows - 1) / settings.tileRows);
+        for (unsigned int tileY = tileYBegin; tileY < tileYEnd; tileY++)
+            for (unsigned int tileX = tileXBegin; tileX < tileXEnd; tileX++)
+                band.tileDisturbed[tileY * band.tilesX + tileX] = 1;
+    }
+}
+
+float WaveletGrid::awakeFraction() const {
+    // weighted by cells, so the coarse bands count for as little as they cost
+    float awakeCells = 0, cells = 0;
+    for (const Band &band : m_bands) {
+        const float bandCells = (float) band.resolution.x * band.resolution.y;
+        cells += bandCells;
+        if (band.tileAwake.empty()) awakeCells += bandCells;
+        else awakeCells += bandCells * std::count(band.tileAwake.begin(), band.tileAwake.end(), 1) / band.tileAwake.size();
+    }
+    return cells > 0 ? awakeCells / cells : 1;
+}
+
+void WaveletGrid::prepareTiles(unsigned int i_k){
+    Band &band = m_bands[i_k];
+    const unsigned int tilesX = (band.resolution.x + settings.tileColumns - 1) / settings.tileColumns;
+    const unsigned int tilesY = (band.resolution.y + settings.tileRows - 1) / settings.tileRows;
+
+    // the tile size changed or the amplitudes were replaced, so nothing is known to be ambient
+    if (tilesX != band.tilesX || tilesY != band.tilesY || band.tileDisturbed.empty()) {
+        band.tilesX = tilesX;
+        band.tilesY = tilesY;
+        band.tileDisturbed.assign(tilesY * tilesX, 1);
+        band.tileAwake.assign(tilesY * tilesX, 1);
+    }
+}
+
+void WaveletGrid::refreshGhostCells(unsigned int i_k){
+    std::vector<float> ambient(m_resolution[Parameter::THETA]);
+    for (unsigned int i_theta = 0; i_theta < m_resolution[Parameter::THETA]; i_theta++)
+        ambient[i_theta] = ambientAmplitude(0, 0, i_theta, i_k);
+    current(i_k).refreshGhostCells(i_k, ambient.data());
+}
+
+void WaveletGrid::computeAwakeTiles(float deltaTime, unsigned int i_k){
+    Band &band = m_bands[i_k];
+    const int tilesX = band.tilesX;
+    const int tilesY = band.tilesY;
+    const unsigned char *disturbed = band.tileDisturbed.data();
+    unsigned char *awake = band.tileAwake.data();
+    if (!settings.skipQuiescentTiles) {
+        std::fill(awake, awake + tilesY * tilesX, 1);
+        return;
+    }
+
+    const int reach = awakeReach(deltaTime, i_k);
+    const int reachX = (reach + settings.tileColumns - 1) / settings.tileColumns;
+    const int reachY = (reach + settings.tileRows - 1) / settings.tileRows;
+
+    for (int tileY = 0; tileY < tilesY; tileY++) {
+        for (int tileX = 0; tileX < tilesX; tileX++) {
+            bool nearDisturbance = false;
+            for (int y = std::max(0, tileY - reachY); y <= std::min(tilesY - 1, tileY + reachY) && !nearDisturbance; y++)
+                for (int x = std::max(0, tileX - reachX); x <= std::min(tilesX - 1, tileX + reachX); x++)
+                    if (disturbed[y * tilesX + x]) {
+                        nearDisturbance = true;
+                        break;
+                    }
+            awake[tileY * tilesX + tileX] = nearDisturbance;
+        }
+    }
+
+    if (!band.reflectionTable) return;
+    for (const ReflectionTable::Entry &entry : band.reflectionTable->getEntries())
+        awake[(entry.cell.y / settings.tileRows) * tilesX + entry.cell.x / settings.tileColumns] = 1;
+}
+
+void WaveletGrid::computeDisturbedTiles(unsigned int i_k){
+    if (!settings.skipQuiescentTiles) return;
+
+#pragma omp parallel num_threads(numThreads())
+    {
+        std::vector<float> scratch;
+
+#pragma omp for schedule(static)
+        for (unsigned int tileY = 0; tileY < m_bands[i_k].tilesY; tileY++)
+            computeDisturbedTileRow(i_k, tileY, scratch);
+    }
+}
+
+void WaveletGrid::computeDisturbedTileRow(unsigned int i_k, unsigned int tileY, std::vector<float> &scratch){
+    Band &band = m_bands[i_k];
+    const ActiveRegion &region = *band.activeRegion;
+    const unsigned int resolutionY = band.resolution.y;
+    const unsigned int resolutionTheta = m_resolution[Parameter::THETA];
+    const unsigned int tileRows = settings.tileRows;
+    const unsigned int tileColumns = settings.tileColumns;
+    const float epsilon = settings.quiescentEpsilon;
+    const Amplitude &amplitude = current(i_k);
+    scratch.resize(band.resolution.x);
+
+    unsigned char *disturbed = band.tileDisturbed.data() + tileY * band.tilesX;
+    const unsigned char *awake = band.tileAwake.data() + tileY * band.tilesX;
+    std::fill(disturbed, disturbed + band.tilesX, 0);
+
+    // sleeping tiles were set to exactly the ambient amplitude, so only the awake ones are scanned
+    const unsigned int tileEnd = std::min(resolutionY, (tileY + 1) * tileRows);
+    for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++) {
+        // the ambient amplitude as the sleeping tiles store it
+        const float ambient = amplitude.quantize(ambientAmplitude(0, 0, i_theta, i_k));
+        for (unsigned int i_y = tileY * tileRows; i_y < tileEnd; i_y++) {
+            const float *row = amplitude.readRow(i_y, i_theta, i_k, scratch.data());
+            for (const ActiveRegion::Span *span = region.spansBegin(i_y); span != region.spansEnd(i_y); span++)
+                for (unsigned int i_x = span->begin; i_x < span->end; i_x++)
+                    if (awake[i_x / tileColumns] && std::abs(row[i_x] - ambient) > epsilon)
+                        disturbed[i_x / tileColumns] = 1;
+        }
+    }
+}
+
+void WaveletGrid::reflect(unsigned int i_k){
+    if (!m_bands[i_k].reflectionTable) return;
+
+#pragma omp parallel num_threads(numThreads())
+    {
+        std::vector<float> scratch;
+
+#pragma omp for schedule(static)
+        for (unsigned int tileY = 0; tileY < m_bands[i_k].tilesY; tileY++)
+            reflectTileRow(i_k, tileY, scratch);
+    }
+}
+
+void WaveletGrid::reflectTileRow(unsigned int i_k, unsigned int tileY, std::vector<float> &scratch){
+    const Band &band = m_bands[i_k];
+    if (!band.reflectionTable) return;
+    const ReflectionTable &table = *band.reflectionTable;
+    const unsigned int resolutionTheta = m_resolution[Parameter::THETA];
+    Amplitude &amplitude = current(i_k);
+    // the amplitudes of a cell before and after the reflection
+    scratch.resize(2 * resolutionTheta);
+    float *incident = scratch.data();
+    float *reflected = scratch.data() + resolutionTheta;
+
+    const unsigned int tileEnd = std::min(band.resolution.y, (tileY + 1) * settings.tileRows);
+    for (unsigned int i_y = tileY * settings.tileRows; i_y < tileEnd; i_y++) {
+        const ReflectionTable::Entry *entry = table.entriesBegin(i_y);
+        const ReflectionTable::Entry *rowEnd = table.entriesEnd(i_y);
+        while (entry != rowEnd) {
+            const glm::uvec2 cell = entry->cell;
+            const ReflectionTable::Entry *cellEnd = entry;
+            while (cellEnd != rowEnd && cellEnd->cell == cell) cellEnd++;
+
+            for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++)
+                incident[i_theta] = reflected[i_theta] = amplitude.get(glm::ivec4(cell, i_theta, i_k));
+            for (const ReflectionTable::Entry *e = entry; e != cellEnd; e++)
+                reflected[e->theta] = 0;
+            for (const ReflectionTable::Entry *e = entry; e != cellEnd; e++) {
+                reflected[e->targets[0]] += e->weights[0] * incident[e->theta];
+                reflected[e->targets[1]] += e->weights[1] * incident[e->theta];
+            }
+            for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++)
+                amplitude.set(glm::ivec4(cell, i_theta, i_k), reflected[i_theta]);
+            entry = cellEnd;
+        }
+    }
+}
+
+unsigned int WaveletGrid::advectionReach(float deltaTime, unsigned int i_k) const {
+    return std::ceil(deltaTime * m_plan->advectionSpeed(i_k) / m_bands[i_k].unit.y) + 2;
+}
+
+unsigned int WaveletGrid::awakeReach(float deltaTime, unsigned int i_k) const {
+    const glm::vec2 unit = m_bands[i_k].unit;
+    unsigned int reach = std::ceil(deltaTime * m_plan->advectionSpeed(i_k) / std::min(unit.x, unit.y)) + 3;
+    // a backward euler step falls off by e every diffusion length, sqrt(delta dt) cells
+    if (settings.diffusionMode == DiffusionMode::Implicit)
+        reach += std::ceil(3 * std::sqrt(deltaTime * m_plan->spatialDiffusion(i_k)) / m_bands[i_k].downsampling);
+    return reach;
+}
+
+template <class F>
+void WaveletGrid::forEachWetSpan(unsigned int i_y, unsigned int i_k, F &&f) const {
+    const unsigned int tileColumns = settings.tileColumns;
+    const Band &band = m_bands[i_k];
+    const ActiveRegion &region = *band.activeRegion;
+    const unsigned char *awake = band.tileAwake.data() + (i_y / settings.tileRows) * band.tilesX;
+
+    for (const ActiveRegion::Span *span = region.spansBegin(i_y); span != region.spansEnd(i_y); span++) {
+        unsigned int begin = span->begin;
+        while (begin < span->end) {
+            // extend over the following tiles with the same state
+            const bool isAwake = awake[begin / tileColumns];
+            unsigned int end = begin;
+            while (end < span->end && (bool) awake[end / tileColumns] == isAwake)
+                end = std::min(span->end, (end / tileColumns + 1) * tileColumns);
+            f(begin, end, isAwake);
+            begin = end;
+        }
+    }
+}
+
+void WaveletGrid::setInstructionSet(DiffusionKernels::Isa isa){
+    m_diffuseRow = DiffusionKernels::rowKernel(isa);
+}
+
+void WaveletGrid::updatePlan(){
+    std::vector<float> spatialResolutions(m_resolution[Parameter::K]);
+    for (unsigned int i_k = 0; i_k < m_resolution[Parameter::K]; i_k++)
+        spatialResolutions[i_k] = m_bands[i_k].unit.x;
+    if (m_plan && m_plan->isBuiltFor(m_setting, m_resolution, spatialResolutions)) return;
+
+    // the plan samples the same wavenumbers and directions as the cells of the grid
+    std::vector<float> wavenumbers(m_resolution[Parameter::K]);
+    for (unsigned int i_k = 0; i_k < m_resolution[Parameter::K]; i_k++)
+        wavenumbers[i_k] = idxToPos(i_k, Parameter::K);
+    std::vector<float> thetas(m_resolution[Parameter::THETA]);
+    for (unsigned int i_theta = 0; i_theta < m_resolution[Parameter::THETA]; i_theta++)
+        thetas[i_theta] = idxToPos(i_theta, Parameter::THETA);
+    m_plan = std::make_shared<const DispersionPlan>(m_setting, m_resolution, spatialResolutions, wavenumbers, thetas);
+}
+
+template <unsigned int NTheta>
+void WaveletGrid::advectionStep(float deltaTime, unsigned int i_k) {
+    /* std::cout << "ADVECTION" << std::endl; */
+    const unsigned int resolutionTheta = thetaResolution<NTheta>();
+    const unsigned int numTiles = (m_bands[i_k].resolution.y + settings.tileRows - 1) / settings.tileRows;
+    computeBandDisplacements<NTheta>(deltaTime, i_k);
+    Amplitude &out = next(i_k);
+
+#pragma omp parallel num_threads(numThreads())
+    {
+        std::vector<float> scratch;
+
+        // sweep in storage order (theta slowest, x fastest) so every thread streams through
+        // contiguous rows of a single (theta,k) band
+#pragma omp for collapse(2) schedule(static)
+        for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++)
+        for (unsigned int tile = 0; tile < numTiles; tile++)
+            advectTile<NTheta>(deltaTime, i_k, i_theta, tile, out, scratch);
+    }
+    m_bands[i_k].swapped ^= 1;
+}
+
+template <unsigned int NTheta>
+void WaveletGrid::advectTile(float deltaTime, unsigned int i_k, unsigned int i_theta, unsigned int tile, Amplitude &out,
+        std::vector<float> &scratch) const {
+    const unsigned int resolutionX = m_bands[i_k].resolution.x;
+    const unsigned int resolutionY = m_bands[i_k].resolution.y;
+    const unsigned int tileRows = settings.tileRows;
+    const bool direct = out.directRows();
+    // reduced precision rows are computed in fp32 here and rounded once complete
+    scratch.resize(resolutionX);
+
+    const unsigned int tileEnd = std::min(resolutionY, (tile + 1) * tileRows);
+    const float ambient = ambientAmplitude(0, 0, i_theta, i_k);
+    for (unsigned int i_y = tile * tileRows; i_y < tileEnd; i_y++) {
+        float *row = out.rowBuffer(i_y, i_theta, i_k, scratch.data());
+        // dry cells stay zero
+        if (!direct) std::fill(row, row + resolutionX, 0.0f);
+        forEachWetSpan(i_y, i_k, [&](unsigned int begin, unsigned int end, bool awake) {
+            if (awake) advectRow<NTheta>(deltaTime, i_y, i_theta, i_k, begin, end, row);
+            else std::fill(row + begin, row + end, ambient);
+        });
+        out.writeRow(i_y, i_theta, i_k, row);
+    }
+}
+
+template <unsigned int NTheta>
+void WaveletGrid::diffusionStep(float deltaTime, unsigned int i_k) {
     /* std::cout << "DIFFUSION" << std::endl; */
+    const unsigned int resolutionTheta = thetaResolution<NTheta>();
+    const unsigned int numTiles = (m_bands[i_k].resolution.y + settings.tileRows - 1) / settings.tileRows;
+    const Amplitude &in = current(i_k);
+    Amplitude &out = next(i_k);
+
+#pragma omp parallel num_threads(numThreads())
+    {
+        std::vector<float> scratch;
+
+#pragma omp for collapse(2) schedule(static)
+        for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++)
+        for (unsigned int tile = 0; tile < numTiles; tile++)
+            diffuseTile<NTheta>(deltaTime, i_k, i_theta, tile, in, out, scratch);
+    }
+
+    m_bands[i_k].swapped ^= 1;
+}
+
+template <unsigned int NTheta>
+void WaveletGrid::diffuseTile(float deltaTime, unsigned int i_k, unsigned int i_theta, unsigned int tile,
+        const Amplitude &in, Amplitude &out, std::vector<float> &scratch) const {
+    const unsigned int resolutionX = m_bands[i_k].resolution.x;
+    const unsigned int resolutionY = m_bands[i_k].resolution.y;
+    const unsigned int resolutionTheta = thetaResolution<NTheta>();
+    const unsigned int tileRows = settings.tileRows;
+    const bool direct = out.directRows();
+    // the five stencil rows and the output, for reduced precision storage
+    scratch.resize(6 * resolutionX);
+    auto scratchRow = [&](unsigned int i) { return scratch.data() + i * resolutionX; };
+
+    const unsigned int i_thetaPrev = (i_theta + resolutionTheta - 1) % resolutionTheta;
+    const unsigned int i_thetaNext = (i_theta + 1) % resolutionTheta;
+
+    const unsigned int tileEnd = std::min(resolutionY, (tile + 1) * tileRows);
+    for (unsigned int i_y = tile * tileRows; i_y < tileEnd; i_y++) {
+        DiffusionKernels::Rows rows;
+        rows.center = in.readRow(i_y, i_theta, i_k, scratchRow(0));
+        rows.yPrev = i_y > 0 ? in.readRow(i_y - 1, i_theta, i_k, scratchRow(1)) : nullptr;
+        rows.yNext = i_y + 1 < resolutionY ? in.readRow(i_y + 1, i_theta, i_k, scratchRow(2)) : nullptr;
+        rows.thetaPrev = in.readRow(i_y, i_thetaPrev, i_k, scratchRow(3));
+        rows.thetaNext = in.readRow(i_y, i_thetaNext, i_k, scratchRow(4));
+        rows.out = out.rowBuffer(i_y, i_theta, i_k, scratchRow(5));
+        if (!direct) std::fill(rows.out, rows.out + resolutionX, 0.0f);
+        forEachWetSpan(i_y, i_k, [&](unsigned int begin, unsigned int end, bool awake) {
+            if (awake) diffuseRow(deltaTime, i_y, i_theta, i_k, rows, begin, end);
+            else std::copy(rows.center + begin, rows.center + end, rows.out + begin);
+        });
+        out.writeRow(i_y, i_theta, i_k, rows.out);
+    }
+}
+
+template <unsigned int NTheta>
+void WaveletGrid::fusedStep(float deltaTime, unsigned int i_k) {
+    const unsigned int numTiles = (m_bands[i_k].resolution.y + settings.tileRows - 1) / settings.tileRows;
+    computeBandDisplacements<NTheta>(deltaTime, i_k);
+    Amplitude &out = next(i_k);
+
+#pragma omp parallel num_threads(numThreads())
+    {
+        std::vector<float> scratch;
+
+#pragma omp for schedule(static)
+        for (unsigned int tile = 0; tile < numTiles; tile++)
+            fusedTile<NTheta>(deltaTime, i_k, tile, out, scratch);
+    }
+
+    m_bands[i_k].swapped ^= 1;
+}
+
+template <unsigned int NTheta>
+void WaveletGrid::fusedTile(float deltaTime, unsigned int i_k, unsigned int tile, Amplitude &out,
+        std::vector<float> &scratch) const {
+    const unsigned int resolutionX = m_bands[i_k].resolution.x;
+    const unsigned int resolutionY = m_bands[i_k].resolution.y;
+    const unsigned int resolutionTheta = thetaResolution<NTheta>();
+    const unsigned int tileRows = settings.tileRows;
+    // the diffusion stencil reaches one row up and down
+    const unsigned int scratchRows = tileRows + 2;
+    const bool direct = out.directRows();
+
+    // advected amplitudes of the tile and its halo rows for every theta of the band, followed
+    // by the diffused row for reduced precision storage
+    scratch.resize(((size_t) resolutionTheta * scratchRows + 1) * resolutionX);
+    float *outScratch = scratch.data() + (size_t) resolutionTheta * scratchRows * resolutionX;
+
+    const unsigned int tileBegin = tile * tileRows;
+    const unsigned int tileEnd = std::min(resolutionY, tileBegin + tileRows);
+    const unsigned int haloBegin = tileBegin > 0 ? tileBegin - 1 : 0;
+    const unsigned int haloEnd = std::min(resolutionY, tileEnd + 1);
+
+    auto scratchRow = [&](unsigned int i_y, unsigned int i_theta) -> float * {
+        return scratch.data() + ((size_t) i_theta * scratchRows + (i_y - haloBegin)) * resolutionX;
+    };
+
+    for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++) {
+        const float ambient = ambientAmplitude(0, 0, i_theta, i_k);
+        for (unsigned int i_y = haloBegin; i_y < haloEnd; i_y++) {
+            // dry cells read as zero, like in the grid itself
+            float *row = scratchRow(i_y, i_theta);
+            std::fill(row, row + resolutionX, 0.0f);
+            forEachWetSpan(i_y, i_k, [&](unsigned int begin, unsigned int end, bool awake) {
+                if (awake) advectRow<NTheta>(deltaTime, i_y, i_theta, i_k, begin, end, row);
+                else std::fill(row + begin, row + end, ambient);
+            });
+        }
+    }
+
+    for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++) {
+        const unsigned int i_thetaPrev = (i_theta + resolutionTheta - 1) % resolutionTheta;
+        const unsigned int i_thetaNext = (i_theta + 1) % resolutionTheta;
+
+        for (unsigned int i_y = tileBegin; i_y < tileEnd; i_y++) {
+            DiffusionKernels::Rows rows;
+            rows.center = scratchRow(i_y, i_theta);
+            rows.yPrev = i_y > haloBegin ? scratchRow(i_y - 1, i_theta) : nullptr;
+            rows.yNext = i_y + 1 < haloEnd ? scratchRow(i_y + 1, i_theta) : nullptr;
+            rows.thetaPrev = scratchRow(i_y, i_thetaPrev);
+            rows.thetaNext = scratchRow(i_y, i_thetaNext);
+            rows.out = out.rowBuffer(i_y, i_theta, i_k, outScratch);
+            if (!direct) std::fill(rows.out, rows.out + resolutionX, 0.0f);
+            forEachWetSpan(i_y, i_k, [&](unsigned int begin, unsigned int end, bool awake) {
+                if (awake) diffuseRow(deltaTime, i_y, i_theta, i_k, rows, begin, end);
+                else std::copy(rows.center + begin, rows.center + end, rows.out + begin);
+            });
+            out.writeRow(i_y, i_theta, i_k, rows.out);
+        }
+    }
+}
 
-/* #pragma omp parallel for collapse(2) */
-    for (unsigned int i_x = 0; i_x < amplitudes.getResolution(Parameter::X); i_x++)
-    for (unsigned int i_y = 0; i_y < amplitudes.getResolution(Parameter::Y); i_y++) {
+template <unsigned int NTheta>
+void WaveletGrid::inPlaceStep(float deltaTime, unsigned int i_k) {
+    const Band &band = m_bands[i_k];
+    const unsigned int resolutionX = band.resolution.x;
+    const unsigned int resolutionY = band.resolution.y;
+    const unsigned int resolutionTheta = thetaResolution<NTheta>();
+    const unsigned int tileRows = settings.tileRows;
+    const unsigned int numTiles = (resolutionY + tileRows - 1) / tileRows;
+    const unsigned int scratchRows = tileRows + 2;
+    computeBandDisplacements<NTheta>(deltaTime, i_k);
+    Amplitude &grid = amplitudes;
+    const bool direct = grid.directRows();
 
-        std::array<unsigned int, 2> i_xy = {i_x, i_y};
-        float distanceToBoundary = 0;
-            /* m_environment.levelSet(getPositionAtIndex(i_xy)); */
+    // rows the advection of a halo row reads
+    const unsigned int reach = advectionReach(deltaTime, i_k);
+    // a tile, its halo rows and the reach on either side
+    RowWindow window;
+    window.resolutionX = resolutionX;
+    window.ghost = grid.getGhostCells();
+    window.capacity = std::min(resolutionY + 2 * window.ghost, scratchRows + 2 * reach);
+    window.begin = window.end = -(int) window.ghost;
+    window.data.resize((size_t) resolutionTheta * window.capacity * window.stride());
+    const int ghost = window.ghost;
 
-        for (unsigned int i_theta = 0; i_theta < amplitudes.getResolution(Parameter::THETA); i_theta++)
-        for (unsigned int i_k = 0; i_k < amplitudes.getResolution(Parameter::K); i_k++) {
-            glm::vec4 pos = getPositionAtIndex({i_x, i_y, i_theta, i_k});
-            float wavenumber = pos[K];
-            float theta = pos[THETA];
+    // advected amplitudes of the tile and its halo rows, for every theta of the band
+    std::vector<float> advected((size_t) resolutionTheta * scratchRows * resolutionX);
 
-            // TODO: precompute this
-            glm::vec2 k_hat(cos(theta), sin(theta));
+#pragma omp parallel num_threads(numThreads())
+    {
+        // the diffused row, for reduced precision storage
+        std::vector<float> outScratch(resolutionX);
+        // where the window ended after the last tile, the same on every thread
+        int loadedEnd = -ghost;
 
-            /* bool atLeast2AwayFromBoundary = distanceToBoundary >= 4 * spacialResolution; */
-            bool atLeast2AwayFromBoundary = i_x > 1 && i_x < amplitudes.getResolution(Parameter::X) - 2
-                && i_y > 1 && i_y < amplitudes.getResolution(Parameter::Y) - 2;
+        // the tiles overwrite their own source rows, so they go one after another, and each
+        // phase of a tile is split over its (theta, row) pairs like the tiles of fusedStep are
+        for (unsigned int tile = 0; tile < numTiles; tile++) {
+            const unsigned int tileBegin = tile * tileRows;
+            const unsigned int tileEnd = std::min(resolutionY, tileBegin + tileRows);
+            const unsigned int haloBegin = tileBegin > 0 ? tileBegin - 1 : 0;
+            const unsigned int haloEnd = std::min(resolutionY, tileEnd + 1);
 
-            float amplitude = amplitudes(glm::uvec4(i_x, i_y, i_theta, i_k));
+            // slide the window down. The rows it gains are below every tile written so far,
+            // and the rows it drops are above everything this tile reads. Nothing reads the
+            // bounds of the window until the rows are loaded
+            const int windowBegin = std::max<int>(-ghost, (int) haloBegin - (int) reach);
+            const int windowEnd = std::min<int>(resolutionY + ghost, haloEnd + reach);
+            const int loadBegin = std::max(loadedEnd, windowBegin);
+            loadedEnd = windowEnd;
+#pragma omp single nowait
+            {
+                window.begin = windowBegin;
+                window.end = windowEnd;
+            }
+#pragma omp for collapse(2) schedule(static)
+            for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++)
+                for (int i_y = loadBegin; i_y < windowEnd; i_y++)
+                    grid.decode(i_y, i_theta, i_k, -ghost, resolutionX + ghost, window.row(i_y, i_theta) - ghost);
 
-            if (atLeast2AwayFromBoundary) {
-                // found on bottom of page 6
-                float delta = 1e-5 * spacialResolution * spacialResolution *
-                    (m_unitParam[Parameter::K] * m_unitParam[Parameter::K]) * dispersionSpeed(wavenumber);
+            auto scratchRow = [&](unsigned int i_y, unsigned int i_theta) -> float * {
+                return advected.data() + ((size_t) i_theta * scratchRows + (i_y - haloBegin)) * resolutionX;
+            };
 
-                // found on bottom of page 6
-                float gamma = 0.025 * advectionSpeed(wavenumber) * m_unitParam[Parameter::THETA] *
-                    m_unitParam[Parameter::THETA] / spacialResolution;
+#pragma omp for collapse(2) schedule(static)
+            for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++) {
+                for (unsigned int i_y = haloBegin; i_y < haloEnd; i_y++) {
+                    const float ambient = ambientAmplitude(0, 0, i_theta, i_k);
+                    // dry cells read as zero, like in the grid itself
+                    float *row = scratchRow(i_y, i_theta);
+                    std::fill(row, row + resolutionX, 0.0f);
+                    forEachWetSpan(i_y, i_k, [&](unsigned int begin, unsigned int end, bool awake) {
+                        if (awake) advectRow<NTheta>(deltaTime, i_y, i_theta, i_k, begin, end, row, &window);
+                        else std::fill(row + begin, row + end, ambient);
+                    });
+                }
+            }
 
-                int h = 1; // step size
+            // the diffusion only reads the advected rows, so the tile can be written over
+#pragma omp for collapse(2) schedule(static)
+            for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++) {
+                for (unsigned int i_y = tileBegin; i_y < tileEnd; i_y++) {
+                    const unsigned int i_thetaPrev = (i_theta + resolutionTheta - 1) % resolutionTheta;
+                    const unsigned int i_thetaNext = (i_theta + 1) % resolutionTheta;
+                    DiffusionKernels::Rows rows;
+                    rows.center = scratchRow(i_y, i_theta);
+                    rows.yPrev = i_y > haloBegin ? scratchRow(i_y - 1, i_theta) : nullptr;
+                    rows.yNext = i_y + 1 < haloEnd ? scratchRow(i_y + 1, i_theta) : nullptr;
+                    rows.thetaPrev = scratchRow(i_y, i_thetaPrev);
+                    rows.thetaNext = scratchRow(i_y, i_thetaNext);
+                    rows.out = grid.rowBuffer(i_y, i_theta, i_k, outScratch.data());
+                    if (!direct) std::fill(rows.out, rows.out + resolutionX, 0.0f);
+                    forEachWetSpan(i_y, i_k, [&](unsigned int begin, unsigned int end, bool awake) {
+                        if (awake) diffuseRow(deltaTime, i_y, i_theta, i_k, rows, begin, end);
+                        else std::copy(rows.center + begin, rows.center + end, rows.out + begin);
+                    });
+                    grid.writeRow(i_y, i_theta, i_k, rows.out);
+                }
+            }
+        }
+    }
+}
 
-                // caching some values common to the calculations below
-                float inverseH2 = 1.0f / (h*h);
-                float inverse2H = 1.0f / (2*h);
+template <unsigned int NTheta>
+void WaveletGrid::computeBandDisplacements(float deltaTime, unsigned int i_k) {
+    if (settings.advectionMode != AdvectionMode::ConstantDisplacement) return;
 
-                float lookup_xh_y_theta_k = lookup_amplitude(i_x + h, i_y, i_theta, i_k);
-                float lookup_xnegh_y_theta_k = lookup_amplitude(i_x - h, i_y, i_theta, i_k);
+    // cubic (catmull-rom) weights of the 4 taps around a fractional position s
+    auto cubicWeights = [](float s, float weights[4]) {
+        float s2 = s * s, s3 = s2 * s;
+        weights[0] = 0.5f * (-s + 2 * s2 - s3);
+        weights[1] = 0.5f * (2 - 5 * s2 + 3 * s3);
+        weights[2] = 0.5f * (s + 4 * s2 - 3 * s3);
+        weights[3] = 0.5f * (-s2 + s3);
+    };
 
-                float lookup_x_yh_theta_k = lookup_amplitude(i_x, i_y + h, i_theta, i_k);
-                float lookup_x_ynegh_theta_k = lookup_amplitude(i_x, i_y - h, i_theta, i_k);
+    const unsigned int resolutionTheta = thetaResolution<NTheta>();
+    for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++) {
+        // backtrace in units of cells, equation 17
+        glm::vec2 velocity = m_plan->groupVelocity(i_theta, i_k);
+        float displacementX = -deltaTime * velocity.x / m_bands[i_k].unit.x;
+        float displacementY = -deltaTime * velocity.y / m_bands[i_k].unit.y;
 
-                // we are actually using a step size of h/2 here
-                // use central difference to obtain d2A / dtheta^2 numerically
-                float secondPartialDerivativeWRTtheta = (lookup_amplitude(i_x, i_y, i_theta + h, i_k) + lookup_amplitude(i_x, i_y, i_theta - h, i_k) - 2 * amplitude) * inverseH2;
+        BandDisplacement &band = m_bandDisplacements[i_k * resolutionTheta + i_theta];
+        band.offsetX = std::floor(displacementX);
+        band.offsetY = std::floor(displacementY);
+        cubicWeights(displacementX - band.offsetX, band.weightsX);
+        cubicWeights(displacementY - band.offsetY, band.weightsY);
+    }
+}
 
-                // use central difference to obtain (k dot V_x)
-                float partialDerivativeWRTX = (lookup_xh_y_theta_k - lookup_xnegh_y_theta_k) * inverse2H;
-                float partialDerivativeWRTY = (lookup_x_yh_theta_k - lookup_x_ynegh_theta_k) * inverse2H;
-                float directionalDerivativeWRTK = glm::dot(k_hat, glm::vec2(partialDerivativeWRTX, partialDerivativeWRTY));
+/**
+ * @brief out[i] for i in [0, count) from the 4x4 samples starting at rows[j][i].
+ */
+static void applyDisplacementStencil(const float *weightsX, const float *weightsY, const float *const rows[4],
+        int count, float *out) {
+    for (int i_x = 0; i_x < count; i_x++) {
+        float value = 0;
+        for (int j = 0; j < 4; j++) {
+            const float *row = rows[j] + i_x;
+            value += weightsY[j] * (weightsX[0] * row[0] + weightsX[1] * row[1] +
+                    weightsX[2] * row[2] + weightsX[3] * row[3]);
+        }
+        // keep the result within the cells it lies between, so the cubic can't overshoot
+        float lower = std::min(std::min(rows[1][i_x + 1], rows[1][i_x + 2]), std::min(rows[2][i_x + 1], rows[2][i_x + 2]));
+        float upper = std::max(std::max(rows[1][i_x + 1], rows[1][i_x + 2]), std::max(rows[2][i_x + 1], rows[2][i_x + 2]));
+        out[i_x] = std::min(std::max(value, lower), upper);
+    }
+}
 
-                // central difference to obtain (k dot V_x)^2
-                float secondPartialDerivativeWRTX = (lookup_xh_y_theta_k + lookup_xnegh_y_theta_k - 2 * amplitude) * inverseH2;
-                float secondPartialDerivativeWRTY = (lookup_x_yh_theta_k + lookup_x_ynegh_theta_k - 2 * amplitude) * inverseH2;
-                float secondDirectionalDerivativeWRTK = glm::dot(k_hat * k_hat, glm::vec2(secondPartialDerivativeWRTX, secondPartialDerivativeWRTY));
+template <unsigned int NTheta>
+void WaveletGrid::advectRow(float deltaTime, unsigned int i_y, unsigned int i_theta, unsigned int i_k,
+        unsigned int spanBegin, unsigned int spanEnd, float *out, const RowWindow *source) const {
+    const int resolutionX = m_bands[i_k].resolution.x;
+    const int resolutionY = m_bands[i_k].resolution.y;
+    int begin = spanBegin, end = spanBegin;
+
+    if (settings.advectionMode == AdvectionMode::ConstantDisplacement) {
+        const BandDisplacement &band = m_bandDisplacements[i_k * thetaResolution<NTheta>() + i_theta];
+        const int sourceY = (int) i_y + band.offsetY;
+        const Amplitude &in = current(i_k);
+        const int ghost = source ? source->ghost : in.getGhostCells();
+
+        // the cells whose 4x4 source stencil lies inside the grid and its ghost cells
+        if (sourceY >= 1 - ghost && sourceY + 2 < resolutionY + ghost) {
+            begin = std::clamp(1 - ghost - band.offsetX, (int) spanBegin, (int) spanEnd);
+            end = std::clamp(resolutionX + ghost - 2 - band.offsetX, begin, (int) spanEnd);
+        }
+
+        if (begin < end && (source || in.directRows())) {
+            const float *rows[4];
+            for (int j = 0; j < 4; j++)
+                rows[j] = (source ? source->row(sourceY + j - 1, i_theta) : in.row(sourceY + j - 1, i_theta, i_k)) +
+                    band.offsetX - 1 + begin;
+            applyDisplacementStencil(band.weightsX, band.weightsY, rows, end - begin, out + begin);
+        } else if (begin < end) {
+            // convert the source rows a block at a time, so the stencil itself stays fp32
+            const int blockSize = 256;
+            float block[4][blockSize + 3];
+            for (int blockBegin = begin; blockBegin < end; blockBegin += blockSize) {
+                const int count = std::min(end - blockBegin, blockSize);
+                const float *rows[4];
+                for (int j = 0; j < 4; j++) {
+                    const int sourceBegin = blockBegin + band.offsetX - 1;
+                    in.decode(sourceY + j - 1, i_theta, i_k, sourceBegin, sourceBegin + count + 3, block[j]);
+                    rows[j] = block[j];
+                }
+                applyDisplacementStencil(band.weightsX, band.weightsY, rows, count, out + blockBegin);
+            }
+        }
+    }
+
+    // everything whose stencil leaves the ghost cells is traced cell by cell
+    for (int i_x = spanBegin; i_x < begin; i_x++)
+        out[i_x] = advectedAmplitude(deltaTime, i_x, i_y, i_theta, i_k, source);
+    for (int i_x = std::max(begin, end); i_x < (int) spanEnd; i_x++)
+        out[i_x] = advectedAmplitude(deltaTime, i_x, i_y, i_theta, i_k, source);
+}
+
+float WaveletGrid::advectedAmplitude(float deltaTime, unsigned int i_x, unsigned int i_y, unsigned int i_theta,
+        unsigned int i_k, const RowWindow *source) const {
+    // we need not compute the advection for points outside of the domain.
+    /* if (!m_environment.inDomain(getPositionAtIndex({i_x, i_y}))) return 0; */
+    glm::vec4 pos = getPositionAtIndex({i_x, i_y, i_theta, i_k});
+    // the band may be coarser than the grid
+    glm::vec2 position = bandPosition(i_x, i_y, i_k);
+    pos[Parameter::X] = position.x;
+    pos[Parameter::Y] = position.y;
+    // the wave direction kb scaled by the group speed, equation 17
+    glm::vec2 velocity = m_plan->groupVelocity(i_theta, i_k);
+    glm::vec4 lagrangianPos = pos;
+    lagrangianPos[Parameter::X] -= deltaTime * velocity[0];
+    lagrangianPos[Parameter::Y] -= deltaTime * velocity[1];
+    // waves that hit the terrain are reflected after the step, see reflect
+    return lookup_interpolated_amplitude(lagrangianPos[Parameter::X], lagrangianPos[Parameter::Y], i_theta, i_k, source);
+}
+
+void WaveletGrid::diffuseRow(float deltaTime, unsigned int i_y, unsigned int i_theta, unsigned int i_k,
+        const DiffusionKernels::Rows &rows, unsigned int begin, unsigned int end) const {
+    const unsigned int resolutionX = m_bands[i_k].resolution.x;
+    const unsigned int resolutionY = m_bands[i_k].resolution.y;
+
+    // cells less than 2 away from the boundary keep their amplitude
+    /* bool atLeast2AwayFromBoundary = distanceToBoundary >= 4 * spacialResolution; */
+    bool atLeast2AwayFromBoundary = i_y > 1 && i_y < resolutionY - 2 && resolutionX > 4;
+    const unsigned int interiorBegin = atLeast2AwayFromBoundary ? std::clamp(2u, begin, end) : end;
+    const unsigned int interiorEnd = atLeast2AwayFromBoundary ? std::clamp(resolutionX - 2, interiorBegin, end) : end;
+
+    std::copy(rows.center + begin, rows.center + interiorBegin, rows.out + begin);
+    std::copy(rows.center + interiorEnd, rows.center + end, rows.out + interiorEnd);
+    if (interiorBegin == interiorEnd) return;
+
+    // the kernel differentiates per cell, and the coefficients are per full resolution cell
+    const float cellScale = 1.0f / m_bands[i_k].downsampling;
+
+    // found on bottom of page 6
+    DiffusionKernels::Coefficients coefficients;
+    coefficients.deltaTime = deltaTime;
+    coefficients.advectionSpeed = m_plan->advectionSpeed(i_k) * cellScale;
+    coefficients.direction = m_plan->waveDirection(i_theta);
+    coefficients.delta = m_plan->spatialDiffusion(i_k) * cellScale * cellScale;
+    coefficients.gamma = m_plan->angularDiffusion(i_k);
+    // integrated afterwards, see implicitDiffusionStep
+    if (stableSpatialDiffusion()) coefficients.delta = 0;
+    if (stableAngularDiffusion()) coefficients.gamma = 0;
+
+    // equation 18 for every cell at least 2 away from the boundary
+    m_diffuseRow(coefficients, rows, interiorBegin, interiorEnd);
+}
 
-                // equation 18
-                float derivativeWRTt = -advectionSpeed(wavenumber) * directionalDerivativeWRTK + delta * secondDirectionalDerivativeWRTK + gamma * secondPartialDerivativeWRTtheta;
+void WaveletGrid::computeImplicitCells(unsigned int i_k){
+    Band &band = m_bands[i_k];
+    const unsigned int resolutionX = band.resolution.x;
+    const unsigned int resolutionY = band.resolution.y;
+    band.implicitCells.assign((size_t) resolutionX * resolutionY, 0);
+    band.implicitCellsTransposed.assign((size_t) resolutionX * resolutionY, 0);
+    if (resolutionX <= 4) return;
 
-                amplitude += derivativeWRTt * deltaTime;
+    // the cells of diffuseRow, the first and last two of every row and column stay fixed
+    for (unsigned int i_y = 2; i_y + 2 < resolutionY; i_y++) {
+        forEachWetSpan(i_y, i_k, [&](unsigned int begin, unsigned int end, bool awake) {
+            if (!awake) return;
+            for (unsigned int i_x = std::max(2u, begin); i_x < std::min(resolutionX - 2, end); i_x++) {
+                band.implicitCells[i_x + (size_t) i_y * resolutionX] = 1;
+                band.implicitCellsTransposed[i_y + (size_t) i_x * resolutionY] = 1;
             }
+        });
+    }
+}
+
+void WaveletGrid::implicitDiffusionStep(float deltaTime, unsigned int i_k){
+    const unsigned int resolutionTheta = m_resolution[Parameter::THETA];
+    const unsigned int numTiles = (m_bands[i_k].resolution.y + settings.tileRows - 1) / settings.tileRows;
+
+#pragma omp parallel num_threads(numThreads())
+    {
+        std::vector<float> scratch;
+
+        if (stableSpatialDiffusion()) {
+#pragma omp for schedule(static)
+            for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++)
+                implicitSpatialDiffusion(deltaTime, i_k, i_theta, scratch);
+        }
 
-            amplitudes_nxt(glm::uvec4(i_x, i_y, i_theta, i_k)) = amplitude;
+        if (stableAngularDiffusion()) {
+#pragma omp for schedule(static)
+            for (unsigned int tileY = 0; tileY < numTiles; tileY++)
+                implicitAngularDiffusion(deltaTime, i_k, tileY, scratch);
         }
     }
+}
+
+void WaveletGrid::implicitSpatialDiffusion(float deltaTime, unsigned int i_k, unsigned int i_theta,
+        std::vector<float> &scratch){
+    const Band &band = m_bands[i_k];
+    const unsigned int resolutionX = band.resolution.x;
+    const unsigned int resolutionY = band.resolution.y;
+    const size_t cells = (size_t) resolutionX * resolutionY;
+    Amplitude &grid = current(i_k);
+
+    // the same coefficients as diffuseRow, per band cell
+    const float cellScale = 1.0f / band.downsampling;
+    const float delta = m_plan->spatialDiffusion(i_k) * cellScale * cellScale;
+    const glm::vec2 direction = m_plan->waveDirection(i_theta);
+    const float rX = deltaTime * delta * direction.x * direction.x;
+    const float rY = deltaTime * delta * direction.y * direction.y;
+    if (rX == 0 && rY == 0) return;
+
+    // the band as [y][x], the systems along y side by side, then as [x][y] for the ones along x
+    scratch.resize(3 * cells);
+    float *slice = scratch.data();
+    float *transposed = slice + cells;
+    float *solverScratch = transposed + cells;
+
+    for (unsigned int i_y = 0; i_y < resolutionY; i_y++)
+        grid.decode(i_y, i_theta, i_k, 0, resolutionX, slice + (size_t) i_y * resolutionX);
+
+    if (rY > 0) DiffusionKernels::solveDiffusion(rY, band.implicitCells.data(), slice, solverScratch, resolutionY, resolutionX);
+    if (rX > 0) {
+        for (unsigned int i_y = 0; i_y < resolutionY; i_y++)
+            for (unsigned int i_x = 0; i_x < resolutionX; i_x++)
+                transposed[i_y + (size_t) i_x * resolutionY] = slice[i_x + (size_t) i_y * resolutionX];
+        DiffusionKernels::solveDiffusion(rX, band.implicitCellsTransposed.data(), transposed, solverScratch,
+                resolutionX, resolutionY);
+        for (unsigned int i_x = 0; i_x < resolutionX; i_x++)
+            for (unsigned int i_y = 0; i_y < resolutionY; i_y++)
+                slice[i_x + (size_t) i_y * resolutionX] = transposed[i_y + (size_t) i_x * resolutionY];
+    }
 
-    std::swap(amplitudes, amplitudes_nxt);
+    for (unsigned int i_y = 0; i_y < resolutionY; i_y++)
+        grid.writeRow(i_y, i_theta, i_k, slice + (size_t) i_y * resolutionX);
+}
+
+void WaveletGrid::implicitAngularDiffusion(float deltaTime, unsigned int i_k, unsigned int tileY,
+        std::vector<float> &scratch){
+    const Band &band = m_bands[i_k];
+    const unsigned int resolutionX = band.resolution.x;
+    const unsigned int resolutionY = band.resolution.y;
+    const unsigned int resolutionTheta = m_resolution[Parameter::THETA];
+    const float r = deltaTime * m_plan->angularDiffusion(i_k);
+    if (r == 0) return;
+    Amplitude &grid = current(i_k);
+
+    const bool spectral = settings.angularDiffusionMode == AngularDiffusionMode::Spectral;
+    std::optional<DiffusionKernels::SpectralDecay> decay;
+    if (spectral) decay.emplace(resolutionTheta, r);
+
+    // every theta of a row as [theta][x], the systems along theta side by side
+    const size_t solverFloats = spectral ? (size_t) resolutionTheta * (resolutionX + 1) : 2 * resolutionTheta;
+    scratch.resize((size_t) resolutionTheta * resolutionX + resolutionX + solverFloats);
+    float *rows = scratch.data();
+    float *original = rows + (size_t) resolutionTheta * resolutionX;
+    float *solverScratch = original + resolutionX;
+
+    const unsigned int tileEnd = std::min(resolutionY, (tileY + 1) * settings.tileRows);
+    for (unsigned int i_y = tileY * settings.tileRows; i_y < tileEnd; i_y++) {
+        const std::uint8_t *free = band.implicitCells.data() + (size_t) i_y * resolutionX;
+        if (std::find(free, free + resolutionX, 1) == free + resolutionX) continue;
+
+        for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++)
+            grid.decode(i_y, i_theta, i_k, 0, resolutionX, rows + (size_t) i_theta * resolutionX);
+        if (spectral) decay->apply(rows, solverScratch, resolutionX);
+        else DiffusionKernels::solvePeriodicDiffusion(r, rows, solverScratch, resolutionTheta, resolutionX);
+
+        // the fixed cells were solved along with the others, but keep their amplitude
+        for (unsigned int i_theta = 0; i_theta < resolutionTheta; i_theta++) {
+            float *row = rows + (size_t) i_theta * resolutionX;
+            grid.decode(i_y, i_theta, i_k, 0, resolutionX, original);
+            for (unsigned int i_x = 0; i_x < resolutionX; i_x++)
+                row[i_x] = free[i_x] ? row[i_x] : original[i_x];
+            grid.writeRow(i_y, i_theta, i_k, row);
+        }
+    }
 }
 
 float WaveletGrid::amplitude(std::array<float, 4> pos) const{
@@ -189,8 +1467,8 @@ float WaveletGrid::idxToPos(const unsigned int idx, Parameter p) const{
 bool WaveletGrid::outOfBounds(glm::vec2 pos) const {
     for (int dim = 0; dim < 2; dim++)
         if ( m_minParam[dim] > pos[dim] || m_maxParam[dim] < pos[dim] )
-            return false;
-    return true;
+            return true;
+    return false;
 }
 
 std::tuple<float,float> WaveletGrid::posToIdx(float x, float y) const {
@@ -211,66 +1489,107 @@ glm::vec2 WaveletGrid::getPositionAtIndex(std::array<unsigned int, 2> index) con
     return glm::vec2(idxToPos(index[0], Parameter::X), idxToPos(index[1], Parameter::Y));
 }
 
-float WaveletGrid::ambientAmplitude(float x, float y, int i_theta, int i_k) const {
-    // TODO: figure out this ambient term
-    return 0.0f;
+glm::vec2 WaveletGrid::bandPosition(int i_x, int i_y, unsigned int i_k) const {
+    const Band &band = m_bands[i_k];
+    // the index in the whole grid, so that a subdomain computes the same positions
+    const glm::ivec2 index = glm::ivec2(i_x, i_y) + glm::ivec2(band.offset);
+    return glm::vec2(m_minParam) + (glm::vec2(index) + glm::vec2(0.5)) * band.unit;
 }
 
-glm::vec4 WaveletGrid::getReflected(glm::vec4 pos) const {
-    glm::vec2 posxy = glm::vec2(pos);
-
-    /* float distanceToBoundary = m_environment.levelSet(posxy); */
-    /* // 0 is on the boundary and we only simulate anything below 0, so we don't need */
-    /* // to reflect if this is higher or equal */
-    /* if (distanceToBoundary >= 0) { */
-    /*     return pos; */
-    /* } */
+std::tuple<float,float> WaveletGrid::bandIndex(float x, float y, unsigned int i_k) const {
+    const Band &band = m_bands[i_k];
+    // rounded in the whole grid first, the offset then moves it exactly
+    const glm::vec2 index((x - m_minParam.x) / band.unit.x - 0.5, (y - m_minParam.y) / band.unit.y - 0.5);
+    return { index.x - band.offset.x, index.y - band.offset.y };
+}
 
-    /* glm::vec2 normal = m_environment.levelSetGradient(posxy); */
-    /* float theta = pos[Parameter::THETA]; */
-    /* glm::vec2 wavedirection = glm::vec2(std::cos(theta), std::sin(theta)); */
+float WaveletGrid::ambientAmplitude(float x, float y, int i_theta, int i_k) const {
+    return m_setting.ambientStrength * m_plan->ambientAmplitude(i_theta, i_k);
+}
 
-    /* glm::vec2 reflectedPos = posxy - 2.f * normal * distanceToBoundary; */
-    /* glm::vec2 reflectedDirection = wavedirection - 2.f * (glm::dot(normal, wavedirection) * normal); */
+float WaveletGrid::lookup_interpolated_amplitude(float x, float y, int i_theta, int i_k, const RowWindow *source) const {
+    if (outOfBounds(glm::vec2(x,y))) return ambientAmplitude(x,y,i_theta,i_k);
 
-    /* float reflectedTheta = std::atan2(reflectedDirection.y, reflectedDirection.x); */
+    // convert (x,y) into index positions of the band
+    std::tie(x,y) = bandIndex(x, y, i_k);
 
-    /* // this should be in the domain (like right on the edge) */
-    /* assert(m_environment.inDomain(pos)); */
+    const Amplitude &in = current(i_k);
+    // the ghost cells hold the ambient amplitude, only taps beyond them need it computed
+    const int ghost = source ? source->ghost : in.getGhostCells();
+    const int resolutionX = m_bands[i_k].resolution.x;
+    const int resolutionY = m_bands[i_k].resolution.y;
+    const int i_x = std::floor(x);
+    const int i_y = std::floor(y);
+    auto outside = [=](int i_x, int i_y) {
+        return i_x < -ghost || i_x >= resolutionX + ghost || i_y < -ghost || i_y >= resolutionY + ghost;
+    };
 
-    /* return glm::vec4(reflectedPos.x, reflectedPos.y, reflectedTheta, pos[Parameter::K]); */
-    return glm::vec4(0);
-}
+    if (source) {
+        return Math::interpolate2D(x, y, [&](int i_x, int i_y) -> float {
+            if (outside(i_x, i_y)) {
+                glm::vec2 pos = bandPosition(i_x, i_y, i_k);
+                return ambientAmplitude(pos.x, pos.y, i_theta, i_k);
+            }
+            return source->row(i_y, i_theta)[i_x];
+        });
+    }
 
-float WaveletGrid::lookup_interpolated_amplitude(float x, float y, int i_theta, int i_k) {
-    if (outOfBounds(glm::vec2(x,y))) return ambientAmplitude(x,y,i_theta,i_k);
+    // all 16 taps are inside the grid or its ghost cells, read them straight from the band
+    if (!outside(i_x - 1, i_y - 1) && !outside(i_x + 2, i_y + 2) && in.getLayout() == Layout::Type::XMajor) {
+        return Storage::dispatch(in.getStorage(), [&](auto element) {
+            return Math::interpolate2D(in.rowAs<decltype(element)>(0, i_theta, i_k), 1, in.rowStride(i_k), x, y);
+        });
+    }
 
-    // convert (x,y) into index positions
-    std::tie(x,y) = posToIdx(x,y);
+    // the same for the Z order curve, whose index is a sum of an x and a y part
+    if (!outside(i_x - 1, i_y - 1) && !outside(i_x + 2, i_y + 2) && in.getLayout() == Layout::Type::Morton) {
+        const glm::uvec2 padded = in.paddedResolution(i_k);
+        size_t xOffsets[4], yOffsets[4];
+        for (int i = 0; i < 4; i++) {
+            xOffsets[i] = Layout::Morton::xOffset(i_x - 1 + i + ghost);
+            yOffsets[i] = Layout::Morton::yOffset(i_y - 1 + i + ghost, padded);
+        }
+        return Storage::dispatch(in.getStorage(), [&](auto element) {
+            const auto *slice = in.sliceAs<decltype(element)>(i_theta, i_k);
+            return Math::interpolate2D(x, y, [&](int j_x, int j_y) {
+                return Storage::toFloat(slice[xOffsets[j_x - i_x + 1] + yOffsets[j_y - i_y + 1]]);
+            });
+        });
+    }
 
-    auto f = [this, i_theta, i_k](int i_x, int i_y) -> float {
-        if (i_x < 0 || i_x >= m_resolution[Parameter::X] || i_y < 0 || i_y >= m_resolution[Y]) {
+    auto f = [&](int i_x, int i_y) -> float {
+        if (outside(i_x, i_y)) {
             // we need an amplitude for a point outside of the simulation box
-            return ambientAmplitude(idxToPos(i_x, Parameter::X), idxToPos(i_y, Parameter::Y), i_theta, i_k);
+            glm::vec2 pos = bandPosition(i_x, i_y, i_k);
+            return ambientAmplitude(pos.x, pos.y, i_theta, i_k);
         }
 
-        return amplitudes(glm::uvec4(i_x, i_y, i_theta, i_k));
+        return in.get(glm::ivec4(i_x, i_y, i_theta, i_k));
     };
 
     return Math::interpolate2D(x, y, f);
 }
 
 float WaveletGrid::lookup_amplitude(int i_x, int i_y, int i_theta, int i_k) const {
-    i_theta = (i_theta + m_resolution[Parameter::THETA]) % m_resolution[Parameter::THETA];
-
     if (i_k < 0 || i_k >= m_resolution[Parameter::K])
         return 0.0f;
 
-    if (i_x < 0 || i_x >= m_resolution[Parameter::X] || i_y < 0 || i_y >= m_resolution[Y])
+    // the ghost cells hold the wrapped thetas and the ambient amplitude around the band
+    const Amplitude &in = current(i_k);
+    const int resolutionTheta = m_resolution[Parameter::THETA];
+    const int thetaGhost = in.getThetaGhostCells();
+    if (i_theta < -thetaGhost || i_theta >= resolutionTheta + thetaGhost)
+        i_theta = (i_theta % resolutionTheta + resolutionTheta) % resolutionTheta;
+
+    const int ghost = in.getGhostCells();
+    const glm::ivec2 resolution(m_bands[i_k].resolution);
+    if (i_x < -ghost || i_x >= resolution.x + ghost || i_y < -ghost || i_y >= resolution.y + ghost) {
         // we need an amplitude for a point outside of the simulation box
-        return ambientAmplitude(idxToPos(i_x, Parameter::X), idxToPos(i_y, Parameter::Y), i_theta, i_k);
+        glm::vec2 pos = bandPosition(i_x, i_y, i_k);
+        return ambientAmplitude(pos.x, pos.y, (i_theta + resolutionTheta) % resolutionTheta, i_k);
+    }
 
-    return amplitudes(glm::uvec4(i_x, i_y, i_theta, i_k));
+    return in.get(glm::ivec4(i_x, i_y, i_theta, i_k));
 };
 
 
@@ -1,25 +1,124 @@
 #pragma once
 
+#include "activeregion.h"
 #include "amplitude.h"
-#include "profilebuffer.h"
+#include "diffusionkernels.h"
+#include "dispersionplan.h"
+#include "reflectiontable.h"
 #include "environment.h"
+#include "setting.h"
 #include "spectrum.h"
+#include "taskpool.h"
+#include "topology.h"
 
 #include <cmath>
 #include <glm/glm.hpp>
 
+#include <cassert>
 #include <memory>
 
+enum class AdvectionMode {
+    // backtrace and interpolate every cell on its own
+    Interpolated,
+    // the backtrace is the same for a whole (theta,k) band, so apply it as a fixed 16 tap stencil
+    ConstantDisplacement,
+};
+
+enum class DiffusionMode {
+    // forward euler on equation 18, which limits the step to what its stencils keep stable
+    Explicit,
+    // the advective term of equation 18 stays explicit, the spatial and angular diffusion are
+    // backward euler steps solved along x, y and then theta, which are stable for any step
+    Implicit,
+};
+
+enum class AngularDiffusionMode {
+    // the theta term of equation 18 goes with the rest, as DiffusionMode says
+    Stencil,
+    // every Fourier mode of the thetas of a cell decays exactly as the theta term says, which
+    // holds for any step
+    Spectral,
+};
+
+enum class Scheduler {
+    // every step sweep is an OpenMP loop over the tiles of one band, one band after another
+    OpenMP,
+    // the tiles of all bands are tasks of a TaskPool, which balances uneven tiles by stealing
+    WorkStealing,
+};
+
 struct GridSettings {
     float size = 50;
     glm::vec2 k_range = glm::vec2(0.01, 10);
     float initialTime = 100;
+
+    // number of worker threads used by the step sweeps, 0 lets OpenMP decide
+    int threadCount = 0;
+    Scheduler scheduler = Scheduler::OpenMP;
+    // which cpus the worker threads are pinned to. Use setThreadAffinity to change it
+    Topology::Affinity affinity = Topology::Affinity::None;
+    // number of y rows handed to a thread at a time in the step sweeps. Use setTileSize to
+    // change it
+    unsigned int tileRows = 16;
+    // advect and diffuse each tile in a single pass instead of two sweeps over the grid. Use
+    // setFusedStep to change it
+    bool fusedStep = true;
+    // update the amplitudes in place, tile after tile, keeping only the source rows the next tiles
+    // still read instead of a second copy of the grid. Use setInPlaceStep to change it
+    bool inPlaceStep = false;
+    // use setAdvectionMode to change it
+    AdvectionMode advectionMode = AdvectionMode::Interpolated;
+    // the implicit diffusion solves along whole columns, so a subdomain grid only matches the
+    // whole grid up to how far the diffusion reaches past its halo rows. Use setDiffusionMode
+    // to change it
+    DiffusionMode diffusionMode = DiffusionMode::Explicit;
+    // use setAngularDiffusionMode to change it
+    AngularDiffusionMode angularDiffusionMode = AngularDiffusionMode::Stencil;
+
+    // tiles of tileRows x tileColumns cells of a k band that, together with everything the step
+    // can reach from them, are within quiescentEpsilon of the ambient amplitude are not updated.
+    // They drift up to quiescentEpsilon from what a full step computes, so it is off unless the
+    // caller opts in. Use setSkipQuiescentTiles to change it
+    bool skipQuiescentTiles = false;
+    unsigned int tileColumns = 32;
+    float quiescentEpsilon = 1e-3f;
+
+    // k bands are simulated on a grid that is a power of two coarser than the full resolution,
+    // as long as their wavelength still spans this many cells. 0 keeps every band at full
+    // resolution. Nothing samples one band at the resolution of another, so the bands only
+    // interact through what the caller reads back. Use setSamplesPerWavelength to change it
+    float samplesPerWavelength = 0;
+
+    // cells of ambient amplitude around every band in x and y, so that the advection stencils
+    // near the edge read them instead of checking bounds. 2 is enough for the 4x4 stencil of any
+    // backtrace that starts in the grid. Use setGhostCells to change them
+    unsigned int ghostCells = 2;
+    // wrapped copies of the thetas on either side of every band, for kernels that read theta
+    // neighbours by index. The steps look up their theta neighbours once per row, so by default
+    // the copies are not kept
+    unsigned int thetaGhostCells = 0;
 };
 
-class WaveletGrid {
-        const float gravity = 9.81;
-        const float surfaceTension = 72.8 / 1000; // surface tension of water
+/**
+ * @brief A rectangle of the x,y cells of a grid, in full resolution cells.
+ */
+struct Subdomain {
+    glm::uvec2 offset = glm::uvec2(0);
+    glm::uvec2 resolution = glm::uvec2(0);
+};
 
+/**
+ * @brief How far the amplitudes of a grid are from those of a reference grid.
+ */
+struct AmplitudeError {
+    float maxAbsolute = 0;
+    float rms = 0;
+    // maxAbsolute over the largest reference amplitude
+    float maxRelative = 0;
+    float referenceMax = 0;
+};
+
+class WaveletGrid {
     public:
         constexpr static float tau = 6.28318530718f;
 
@@ -29,11 +128,248 @@ class WaveletGrid {
          * for x and y.
          * The last two values represents the frequency resolution, in terms of theta and
          * the wavenumber.
+         * The physical constants and diffusion multipliers are read from setting.
+         */
+        WaveletGrid(glm::vec4 minParam, glm::vec4 maxParam, glm::uvec4 resolution, Setting setting = Setting());
+
+        /**
+         * Create a grid that only simulates the cells of subdomain of the grid described by
+         * minParam, maxParam and resolution. Positions and band resolutions are those of the
+         * whole grid, and everything outside of the subdomain reads as the ambient amplitude,
+         * so the cells near its edges are only right if someone keeps them up to date, see
+         * DistributedGrid. A grid over an empty subdomain allocates no amplitudes.
+         */
+        WaveletGrid(glm::vec4 minParam, glm::vec4 maxParam, glm::uvec4 resolution, Setting setting, Subdomain subdomain);
+
+        /**
+         * @brief The downsampling every k band of a grid gets, see GridSettings::samplesPerWavelength.
+         * Subdomains that don't start and end on the cells of a band simulate it finer.
          */
-        WaveletGrid(glm::vec4 minParam, glm::vec4 maxParam, glm::uvec4 resolution);
+        static std::vector<unsigned int> bandDownsampling(glm::vec4 minParam, glm::vec4 maxParam, glm::uvec4 resolution,
+                const Setting &setting, float samplesPerWavelength);
 
         void takeStep(float dt);
 
+        /**
+         * @brief Advances the simulation by interval. Every k band takes the fewest substeps
+         * that are stable for its own group speed and diffusion, so slow bands take longer
+         * steps than fast ones and all bands are in sync again when this returns.
+         *
+         * @return the schedule of the most restricted band, see DispersionPlan::schedule.
+         */
+        StepSchedule advance(float interval);
+
+        /**
+         * @brief The longest step takeStep can take without becoming unstable.
+         */
+        float maxStableTimeStep() const;
+        // the same, for band i_k only
+        float bandMaxStableTimeStep(unsigned int i_k) const;
+
+        /**
+         * @brief How advance splits interval if every band took the same substeps.
+         */
+        StepSchedule stepSchedule(float interval) const;
+
+        /**
+         * @brief Sets the number of threads used by advectionStep and diffusionStep.
+         *
+         * @param threadCount the number of threads, or 0 to use the OpenMP default.
+         */
+        void setThreadCount(int threadCount);
+
+        /**
+         * @brief Picks how the steps are spread over the threads, see Scheduler.
+         */
+        void setScheduler(Scheduler scheduler);
+
+        /**
+         * @brief The counters of the workers of Scheduler::WorkStealing, empty if it never ran.
+         */
+        std::vector<TaskPool::WorkerStats> schedulerStats() const;
+        void resetSchedulerStats();
+
+        /**
+         * @brief Pins the worker threads of the steps to cpus as affinity says and moves the
+         * amplitudes to their nodes with placeAmplitudes. The calling thread, which takes part
+         * in the steps as well, is left to the caller. Affinity::None leaves the threads where
+         * an earlier call pinned them.
+         */
+        void setThreadAffinity(Topology::Affinity affinity);
+
+        /**
+         * @brief Copies the amplitudes to new pages, each row by the thread that steps it, so
+         * that on a NUMA system it streams them from its own node. The grid does this whenever it
+         * allocates the amplitudes, call it again after changing the thread count, the scheduler,
+         * tileRows, or the storage, layout or ghost cells, which reorder the amplitudes on the
+         * calling thread.
+         */
+        void placeAmplitudes();
+
+        /**
+         * @brief The bytes of the amplitudes resident on every NUMA node, see Topology. With
+         * pinned threads these should split like the rows do.
+         */
+        std::vector<size_t> residentBytes() const;
+
+        /**
+         * @brief Replaces the physical setting, rebuilding the dispersion plan if anything it
+         * depends on changed.
+         */
+        void setSetting(const Setting &setting);
+
+        /**
+         * @brief Restricts the simulation to the wet cells of region, which must have the same
+         * x,y resolution as the subdomain of the grid. Dry cells are set to zero and never updated. Coarser k
+         * bands use a downsampled copy of the region.
+         */
+        void setActiveRegion(std::shared_ptr<const ActiveRegion> region);
+
+        /**
+         * @brief Reflects the waves that run into the shore at the cells of table, which must have
+         * the same x,y resolution as the subdomain of the grid and its theta resolution, after
+         * every step. Coarser k bands use a downsampled copy of the table. Null reflects nothing.
+         */
+        void setReflectionTable(std::shared_ptr<const ReflectionTable> table);
+
+        /**
+         * @brief Changes GridSettings::samplesPerWavelength and reallocates the bands at their
+         * new resolutions. The amplitudes are reset to zero.
+         */
+        void setSamplesPerWavelength(float samplesPerWavelength);
+
+        /**
+         * @brief Switches between double buffered and in place steps, see GridSettings::inPlaceStep.
+         * Going in place frees the second buffer, going back allocates it again.
+         */
+        void setInPlaceStep(bool inPlace);
+
+        /**
+         * @brief Picks how the amplitudes are backtraced, see AdvectionMode.
+         */
+        void setAdvectionMode(AdvectionMode mode);
+
+        /**
+         * @brief Switches between the fused and the two sweep step, see GridSettings::fusedStep.
+         */
+        void setFusedStep(bool fused);
+
+        /**
+         * @brief Picks how the diffusion is integrated, see DiffusionMode. maxStableTimeStep and
+         * advance only limit the step by the advection for DiffusionMode::Implicit.
+         */
+        void setDiffusionMode(DiffusionMode mode);
+
+        /**
+         * @brief Picks how the theta term of the diffusion is integrated, see
+         * AngularDiffusionMode. With AngularDiffusionMode::Spectral it no longer limits
+         * maxStableTimeStep.
+         */
+        void setAngularDiffusionMode(AngularDiffusionMode mode);
+
+        /**
+         * @brief Turns skipping quiescent tiles on or off, see GridSettings::skipQuiescentTiles.
+         * Every tile counts as disturbed again.
+         */
+        void setSkipQuiescentTiles(bool skip);
+
+        /**
+         * @brief Changes GridSettings::tileRows and GridSettings::tileColumns, each at least 1.
+         * Every tile counts as disturbed again.
+         */
+        void setTileSize(unsigned int tileRows, unsigned int tileColumns);
+
+        /**
+         * @brief Changes GridSettings::ghostCells and GridSettings::thetaGhostCells, keeping the
+         * amplitudes.
+         */
+        void setGhostCells(unsigned int ghostCells, unsigned int thetaGhostCells = 0);
+
+        /**
+         * @brief Moves the grid to another subdomain of the same whole grid and reallocates the
+         * bands. The amplitudes are reset to zero, the active region to every cell and the
+         * reflection table to none.
+         */
+        void setSubdomain(Subdomain subdomain);
+        Subdomain getSubdomain() const;
+
+        /**
+         * @brief What the offset and resolution of a subdomain have to be multiples of, unless
+         * they end at the edge of the whole grid, for the bands and tiles of the subdomain to
+         * line up with those of the whole grid.
+         */
+        glm::uvec2 subdomainAlignment() const;
+
+        /**
+         * @brief The number of full resolution rows a subdomain needs on either side of the
+         * rows it owns for a step of at most deltaTime to compute them exactly as the whole grid
+         * would, provided all the rows hold the amplitudes of the whole grid before the step.
+         * A multiple of subdomainAlignment().y.
+         */
+        unsigned int haloRows(float deltaTime) const;
+
+        /**
+         * @brief The x,y resolution band i_k is simulated at.
+         */
+        glm::uvec2 getBandResolution(unsigned int i_k) const { return m_bands[i_k].resolution; }
+        unsigned int getBandDownsampling(unsigned int i_k) const { return m_bands[i_k].downsampling; }
+
+        /**
+         * @brief Copies the rows [begin, end) of band i_k, in cells of the band, to out as fp32,
+         * indexed by [theta][y - begin][x].
+         */
+        void readBandRows(unsigned int i_k, unsigned int begin, unsigned int end, float *out) const;
+
+        /**
+         * @brief The inverse of readBandRows. The tiles the rows overlap are checked for
+         * amplitudes other than the ambient one again, so they don't have to be woken.
+         */
+        void writeBandRows(unsigned int i_k, unsigned int begin, unsigned int end, const float *in);
+
+        /**
+         * @brief Wakes the tiles overlapping the cells [begin, end) in every k band. Anything that
+         * changes amplitudes outside of takeStep must call this for the cells it touched.
+         * The cells are in the full resolution of the grid.
+         */
+        void wake(glm::uvec2 begin, glm::uvec2 end);
+
+        /**
+         * @brief The fraction of tiles that were updated by the last step.
+         */
+        float awakeFraction() const;
+
+        /**
+         * @brief Converts the amplitudes to another storage type. The steps still compute in
+         * fp32 and round when they store.
+         */
+        void setStorage(Storage::Type storage);
+        Storage::Type getStorage() const { return amplitudes.getStorage(); }
+
+        /**
+         * @brief Reorders the amplitudes to another memory layout. The steps go through the
+         * row helpers of Amplitude, so they work on every layout.
+         */
+        void setLayout(Layout::Type layout);
+        Layout::Type getLayout() const { return amplitudes.getLayout(); }
+
+        /**
+         * @brief Memory used by the amplitudes of both buffers, in bytes. The second buffer
+         * takes none in place.
+         */
+        size_t amplitudeBytes() const { return amplitudes.bytes() + amplitudes_nxt.bytes(); }
+
+        /**
+         * @brief Compares the current amplitudes to those of reference, e.g. the same grid run
+         * with fp32 storage. Both grids must have the same band resolutions.
+         */
+        AmplitudeError amplitudeError(const WaveletGrid &reference) const;
+
+        /**
+         * @brief Forces the instruction set used by the diffusion kernels. By default the widest
+         * one supported by the cpu is used.
+         */
+        void setInstructionSet(DiffusionKernels::Isa isa);
+
     private:
         float amplitude(std::array<float, 4> index) const;
 
@@ -52,47 +388,247 @@ class WaveletGrid {
          */
         glm::vec2 getPositionAtIndex(std::array<unsigned int, 2> index) const;
 
-        void advectionStep(float dt); // see section 4.2 of paper
-        void diffusionStep(float dt); // see section 4.2 of paper
+        /**
+         * @brief Advances the k band i_k by dt. The bands don't interact, so each one can be
+         * stepped on its own.
+         */
+        template <unsigned int NTheta>
+        void stepBand(float dt, unsigned int i_k);
 
-        float idxToPos(const unsigned int idx, Parameter p) const;
+        /**
+         * @brief Takes bandSchedules[i_k].substeps steps of bandSchedules[i_k].deltaTime with
+         * every band i_k, using the scheduler from the settings.
+         */
+        void stepBands(const std::vector<StepSchedule> &bandSchedules);
 
         /**
-         * @brief Computes the angular frequency at a certain wavenumber.
-         *
-         * @param wavenumber this is k in the paper, which is the length of the wavevector bold k
-         *
-         * see angularFrequency on page 4, equation 3
+         * @brief stepBands compiled for NTheta thetas and NK k bands, or for the resolution of
+         * the grid where they are 0. Everything it calls down to the row kernels is compiled for
+         * NTheta, so the band and theta loops have constant trip counts and the theta neighbours
+         * wrap around with masks.
          */
-        float angularFrequency(float wavenumber);
+        template <unsigned int NTheta, unsigned int NK>
+        void stepBandsFor(const std::vector<StepSchedule> &bandSchedules);
 
+        using BandsStep = void (WaveletGrid::*)(const std::vector<StepSchedule> &bandSchedules);
         /**
-         * @brief Computes the group speed / advection speed. This is essentially the derivative of angular
-         * frequency with respect to the wavenumber.
-         *
-         * @param wavenumber this is k in the paper, which is the length of the wavevector bold k
-         *
-         * see equation 18 in the paper. We use this to compute the diffusion amount.
+         * @brief The stepBandsFor compiled for thetaResolution and kResolution, or the one for any
+         * resolution if there is none.
          */
-        float advectionSpeed(float wavenumber);
+        static BandsStep bandsStepFor(unsigned int thetaResolution, unsigned int kResolution);
+        BandsStep m_bandsStep;
+
+        // the theta resolution of a kernel compiled for NTheta thetas, see stepBandsFor
+        template <unsigned int NTheta>
+        unsigned int thetaResolution() const { return NTheta > 0 ? NTheta : m_resolution[Parameter::THETA]; }
 
         /**
-         * @brief Computes the dispersion speed. This is the derivative of the advection speed.
-         *
-         * @param wavenumber this is k in the paper, which is the length of the wavevector bold k
-         *
-         * see equation 18 in the paper. We use this to compute the diffusion amount.
+         * @brief stepBands as a single task graph. Each substep of a band prepares its tile flags,
+         * then updates its tiles and finally checks which tiles are disturbed, and the tasks only
+         * wait for the ones that produce what they read or read what they overwrite.
          */
-        float dispersionSpeed(float wavenumber);
+        template <unsigned int NTheta, unsigned int NK>
+        void runStepGraph(const std::vector<StepSchedule> &bandSchedules);
+
+        /**
+         * @brief The pool of Scheduler::WorkStealing, started on first use.
+         */
+        TaskPool &taskPool();
+
+        // pins the OpenMP threads and the workers of the pool, all but the calling thread, as
+        // settings.affinity says
+        void pinThreads();
 
         /**
-         * @brief Returns the wave direction (\hat{k}_b) given some position (and therefore angle).
+         * @brief Calls touch(i_k, begin, end) for the rows of every band, ghost rows included,
+         * from the thread that steps them: tile by tile as the fused and in place steps hand
+         * them out, or as tasks of the pool for Scheduler::WorkStealing. The split step hands
+         * out (theta, tile) pairs instead, so there only part of the rows of a thread are local.
+         */
+        void firstTouch(const std::function<void(unsigned int i_k, int begin, int end)> &touch);
+
+        template <unsigned int NTheta>
+        void advectionStep(float dt, unsigned int i_k); // see section 4.2 of paper
+        template <unsigned int NTheta>
+        void diffusionStep(float dt, unsigned int i_k); // see section 4.2 of paper
+
+        /**
+         * @brief The rows of tile tile of theta i_theta of advectionStep and diffusionStep.
+         * scratch is resized as needed and can be reused from tile to tile.
+         */
+        template <unsigned int NTheta>
+        void advectTile(float dt, unsigned int i_k, unsigned int i_theta, unsigned int tile, Amplitude &out,
+                std::vector<float> &scratch) const;
+        template <unsigned int NTheta>
+        void diffuseTile(float dt, unsigned int i_k, unsigned int i_theta, unsigned int tile, const Amplitude &in,
+                Amplitude &out, std::vector<float> &scratch) const;
+
+        /**
+         * @brief advectionStep followed by diffusionStep, computed tile by tile. The advected
+         * amplitudes of a tile and its halo rows only live in a small per thread scratch buffer,
+         * so the grid is read and written once per step instead of twice.
+         */
+        template <unsigned int NTheta>
+        void fusedStep(float dt, unsigned int i_k);
+        template <unsigned int NTheta>
+        void fusedTile(float dt, unsigned int i_k, unsigned int tile, Amplitude &out, std::vector<float> &scratch) const;
+
+        /**
+         * @brief fp32 copies of the rows [begin, end) of a band for every theta, kept in a ring so
+         * that the window can slide down the grid.
+         */
+        struct RowWindow {
+            unsigned int resolutionX = 0;
+            // the ghost cells of the band, which the window holds as well, on either side of
+            // every row and as rows above and below the band
+            unsigned int ghost = 0;
+            unsigned int capacity = 0; // rows per theta
+            int begin = 0, end = 0;
+            std::vector<float> data;
+
+            size_t stride() const { return resolutionX + 2 * ghost; }
+            const float *row(int y, unsigned int theta) const {
+                assert(y >= begin && y < end);
+                return data.data() + ((size_t) theta * capacity + (y + ghost) % capacity) * stride() + ghost;
+            }
+            float *row(int y, unsigned int theta) {
+                return data.data() + ((size_t) theta * capacity + (y + ghost) % capacity) * stride() + ghost;
+            }
+        };
+
+        /**
+         * @brief The same update as fusedStep, written straight back into the current amplitudes.
+         * The tiles are computed in order of y, and a RowWindow holds the source rows that the
+         * tiles still to come read but the ones before already overwrote.
+         */
+        template <unsigned int NTheta>
+        void inPlaceStep(float dt, unsigned int i_k);
+
+        /**
+         * @brief The backtrace of a whole (theta,k) band for AdvectionMode::ConstantDisplacement,
+         * as an integer cell offset and the cubic weights of the fractional part.
+         */
+        struct BandDisplacement {
+            int offsetX, offsetY;
+            float weightsX[4], weightsY[4];
+        };
+
+        /**
+         * @brief Computes m_bandDisplacements of band i_k for a step of length dt.
+         */
+        template <unsigned int NTheta>
+        void computeBandDisplacements(float dt, unsigned int i_k);
+
+        /**
+         * @brief The semi-lagrangian advection of the cells [begin, end) of an x row into out,
+         * using the advection mode from the settings.
          *
-         * @param position, specifically theta term.
+         * @param source where to read the amplitudes from instead of the current buffer, if set.
+         */
+        template <unsigned int NTheta>
+        void advectRow(float dt, unsigned int i_y, unsigned int i_theta, unsigned int i_k,
+                unsigned int begin, unsigned int end, float *out, const RowWindow *source = nullptr) const;
+
+        /**
+         * @brief The semi-lagrangian advection of a single cell.
+         */
+        float advectedAmplitude(float dt, unsigned int i_x, unsigned int i_y, unsigned int i_theta, unsigned int i_k,
+                const RowWindow *source = nullptr) const;
+
+        /**
+         * @brief Diffuses the cells [begin, end) of an x row of a (theta,k) band.
          *
-         * see equation 17 in the paper and the following paragraph. Used for advection step.
+         * @param rows the rows around the one being diffused. The y neighbours are only
+         * read when i_y is at least 2 away from the boundary.
+         */
+        void diffuseRow(float dt, unsigned int i_y, unsigned int i_theta, unsigned int i_k,
+                const DiffusionKernels::Rows &rows, unsigned int begin, unsigned int end) const;
+
+        /**
+         * @brief Marks the cells of band i_k that implicitDiffusionStep updates: the awake
+         * wet cells at least 2 away from the boundary, the ones diffuseRow updates. The others
+         * keep their amplitude.
+         */
+        void computeImplicitCells(unsigned int i_k);
+
+        // whether the spatial and the angular diffusion are integrated after the tile steps, in
+        // a way that is stable for any step
+        bool stableSpatialDiffusion() const { return settings.diffusionMode == DiffusionMode::Implicit; }
+        bool stableAngularDiffusion() const {
+            return settings.diffusionMode == DiffusionMode::Implicit ||
+                settings.angularDiffusionMode == AngularDiffusionMode::Spectral;
+        }
+
+        /**
+         * @brief The stable diffusion of band i_k in place, the x and y solves of every theta
+         * and then the theta solves or spectral decays of every tile row.
+         */
+        void implicitDiffusionStep(float dt, unsigned int i_k);
+        void implicitSpatialDiffusion(float dt, unsigned int i_k, unsigned int i_theta, std::vector<float> &scratch);
+        void implicitAngularDiffusion(float dt, unsigned int i_k, unsigned int tileY, std::vector<float> &scratch);
+
+        /**
+         * @brief Calls f(begin, end, awake) for the wet cells of row i_y of band i_k, split
+         * into runs of awake and sleeping tiles.
+         */
+        template <class F>
+        void forEachWetSpan(unsigned int i_y, unsigned int i_k, F &&f) const;
+
+        /**
+         * @brief Resizes the tile flags of band i_k if the tile size changed, marking everything
+         * as disturbed.
+         */
+        void prepareTiles(unsigned int i_k);
+
+        /**
+         * @brief Chooses the resolution of every k band and reallocates the amplitudes.
+         */
+        void buildBands();
+
+        /**
+         * @brief Marks every tile of every band as disturbed, e.g. after the amplitudes or the
+         * ambient amplitude changed.
+         */
+        void disturbAll();
+
+        /**
+         * @brief Sets the ghost cells of the current amplitudes of band i_k to the ambient
+         * amplitude and the wrapped thetas. Called at the start of every step of the band.
+         */
+        void refreshGhostCells(unsigned int i_k);
+
+        /**
+         * @brief Wakes every tile of band i_k that is disturbed or that a disturbed tile can
+         * reach within a step of dt, and every tile on the shoreline, which reflects even the
+         * ambient amplitude.
+         */
+        void computeAwakeTiles(float dt, unsigned int i_k);
+
+        /**
+         * @brief Marks the awake tiles of band i_k whose new amplitudes are not all ambient as disturbed.
          */
-        glm::vec2 getWaveDirection(glm::vec4 pos) const;
+        void computeDisturbedTiles(unsigned int i_k);
+        void computeDisturbedTileRow(unsigned int i_k, unsigned int tileY, std::vector<float> &scratch);
+
+        /**
+         * @brief The rows of band i_k the advection of a row reads on either side of it in a
+         * step of deltaTime: the backtrace and the rows of its 4x4 stencil.
+         */
+        unsigned int advectionReach(float deltaTime, unsigned int i_k) const;
+
+        /**
+         * @brief The cells of band i_k around a disturbed tile that computeAwakeTiles wakes:
+         * the advection backtrace, its 4x4 stencil and the diffusion stencil, or a few diffusion
+         * lengths for DiffusionMode::Implicit.
+         */
+        unsigned int awakeReach(float deltaTime, unsigned int i_k) const;
+
+        /**
+         * @brief Number of threads the step sweeps should run with.
+         */
+        int numThreads() const;
+
+        float idxToPos(const unsigned int idx, Parameter p) const;
 
         // TODO: make inline
         /**
@@ -115,6 +651,16 @@ class WaveletGrid {
         std::tuple<float,float> posToIdx(float x, float y) const;
         glm::vec4 posToIdx(glm::vec4 pos4) const;
 
+        /**
+         * @brief The position of the center of cell (i_x, i_y) of band i_k.
+         */
+        glm::vec2 bandPosition(int i_x, int i_y, unsigned int i_k) const;
+
+        /**
+         * @brief The inverse of bandPosition, keeping the fractional component.
+         */
+        std::tuple<float,float> bandIndex(float x, float y, unsigned int i_k) const;
+
         /**
          * @brief Obtain the default ambient amplitude, used as boundary conditions for
          * the amplitude table calculations
@@ -129,14 +675,12 @@ class WaveletGrid {
         float ambientAmplitude(float x, float y, int i_theta, int i_k) const;
 
         /**
-         * @brief Obtain the reflected (position,wavevector) pair correponding to the input (x,k) pair
-         * and the environment.
-         *
-         * @param pos the (x,y,theta,wavenumber) position.
-         * @return glm::vec4 the reflected position.
+         * @brief Scatters the amplitudes of the shoreline cells of band i_k, in the current buffer,
+         * from their incident directions to the reflected ones. All the incident amplitudes of a
+         * cell are read before any is written, so reflecting into an incident direction keeps it.
          */
-        glm::vec4 getReflected(glm::vec4 pos) const;
-
+        void reflect(unsigned int i_k);
+        void reflectTileRow(unsigned int i_k, unsigned int tileY, std::vector<float> &scratch);
 
         /**
          * @brief Obtain an interpolated amplitude at a non-grid position.
@@ -145,10 +689,11 @@ class WaveletGrid {
          * @param y the y coordinate.
          * @param i_theta the theta index.
          * @param i_k the wavenumber index.
+         * @param source where to read the amplitudes from instead of the current buffer, if set.
          *
          * @return float the interpolated amplitude.
          */
-        float lookup_interpolated_amplitude(float x, float y, int i_theta, int i_k);
+        float lookup_interpolated_amplitude(float x, float y, int i_theta, int i_k, const RowWindow *source = nullptr) const;
 
         /**
          * @brief Obtain the wave amplitude at a certain index.
@@ -164,20 +709,72 @@ class WaveletGrid {
         float k(float zeta);
         float zeta(float k);
 
+        // the x,y resolution is that of the subdomain
         glm::uvec4 m_resolution;
+        // the x,y resolution of the whole grid and the first cell of the subdomain
+        glm::uvec2 m_domainResolution;
+        glm::uvec2 m_cellOffset = glm::uvec2(0);
 
         // important: max is exclusive
         glm::vec4 m_minParam;
         glm::vec4 m_maxParam;
         glm::vec4 m_unitParam;
 
-        std::vector<std::unique_ptr<ProfileBuffer>> m_profileBuffers;
+        /**
+         * @brief Rebuilds m_plan if it was not built for the current setting.
+         */
+        void updatePlan();
+
         float time = 0;
 
+        /**
+         * @brief Everything about one k band that depends on its spatial resolution.
+         */
+        struct Band {
+            glm::uvec2 resolution;
+            glm::vec2 unit;              // size of a cell
+            unsigned int downsampling;   // full resolution cells per band cell, along x and y
+            glm::uvec2 offset;           // the first cell of the subdomain, in cells of the band
+            // whether the current amplitudes are in amplitudes_nxt. The bands are stepped
+            // independently, so each one flips its buffers on its own
+            bool swapped = false;
+            std::shared_ptr<const ActiveRegion> activeRegion;
+            std::shared_ptr<const ReflectionTable> reflectionTable;
+
+            // per (tile y, tile x) flags. Disturbed tiles hold non ambient amplitudes, awake tiles
+            // are the ones the current step updates, sleeping tiles hold exactly the ambient amplitude
+            unsigned int tilesX = 0, tilesY = 0;
+            std::vector<unsigned char> tileDisturbed;
+            std::vector<unsigned char> tileAwake;
+
+            // the cells the implicit diffusion solves for, indexed by x + y * resolution.x and
+            // transposed, by y + x * resolution.y
+            std::vector<std::uint8_t> implicitCells;
+            std::vector<std::uint8_t> implicitCellsTransposed;
+        };
+
         Amplitude amplitudes;
         Amplitude amplitudes_nxt;
+        std::vector<Band> m_bands;
+
+        const Amplitude &current(unsigned int i_k) const { return m_bands[i_k].swapped ? amplitudes_nxt : amplitudes; }
+        Amplitude &current(unsigned int i_k) { return m_bands[i_k].swapped ? amplitudes_nxt : amplitudes; }
+        Amplitude &next(unsigned int i_k) { return m_bands[i_k].swapped ? amplitudes : amplitudes_nxt; }
 
         GridSettings settings;
+        Setting m_setting;
+        // per (theta,k) coefficients, shared with everything else built from the same setting
+        std::shared_ptr<const DispersionPlan> m_plan;
+        DiffusionKernels::RowKernel m_diffuseRow = DiffusionKernels::rowKernel();
+        // the cells the steps update at full resolution, by default all of them
+        std::shared_ptr<const ActiveRegion> m_activeRegion;
+        // the shoreline at full resolution, if any
+        std::shared_ptr<const ReflectionTable> m_reflectionTable;
+        // per (theta,k) backtrace of the current step, indexed by i_k * resolution[THETA] + i_theta
+        std::vector<BandDisplacement> m_bandDisplacements;
+        std::unique_ptr<TaskPool> m_pool;
+        // step scratch of every worker of m_pool
+        std::vector<std::vector<float>> m_workerScratch;
         /* Environment m_environment; */
 
         std::shared_ptr<Spectrum> m_spectrum;